@@ -24,144 +24,209 @@
       timbl@uvt.nl
 */
 
-#include <cstdlib>
-#include <unistd.h>
 #include <string>
-#include <signal.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
 #include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "ticcutils/CommandLine.h"
 #include "ticcutils/StringOps.h"
-#include "ticcutils/SocketBasics.h"
+#include "timblserver/UnixSocket.h"
 
 using namespace std;
+using namespace TimblServer;
 
-int globalTimeOut;
 //
-// a simple program to demonstrate and test the Timbl Socket interface
+// measures the transport baseline of timblserver: the round trip time
+// and the throughput of plain lines echoed by sockettestServer, for a
+// range of payload sizes and numbers of concurrent connections.
+// The client side is the same as that of transportbench, so its
+// numbers for the real protocols can be held against these.
 //
 
-const string lines[] = { "eerste regel", "tweede regel", "derde regel",
-			 "laatste regel", "" };
+inline void usage(){
+  cerr << "sockettestClient [-n NodeName] -p PortNumber | -u SocketPath" << endl
+       << "\t[-s sizes] [-c connections] [-t seconds]" << endl
+       << "echoes lines of every size in 'sizes' (default 16,256,4096)"
+       << " bytes over" << endl
+       << "every number of concurrent connections in 'connections'"
+       << " (default 1,4,16)," << endl
+       << "for 't' seconds each (default 2), and reports the latencies."
+       << endl;
+}
 
-bool runClient( const string& sock, int id ){
-  cerr << "Starting Client " << id << " on localhost, port:" << sock << endl;
-  Sockets::ClientSocket client;
-  if ( client.connect( "localhost", sock) ){
-    string resultLine;
-    if ( client.read( resultLine ) ){
-      cerr << "Client " << id << " read():\t\t\t\t" << resultLine << endl;
-      int i = 0;
-      string testLine = lines[i];
-      while ( !testLine.empty() ){
-	if ( client.write( testLine + "\n" ) ){
-	  cerr << "Client " << id << " wrote():\t\t\t\t" << testLine << endl;
-	  if ( client.read( resultLine ) ){
-	    if ( resultLine == "" )
-	      continue;
-	    cerr << "Client " << id << " read() \t\t\t\t" << resultLine << endl;
-	  }
-	  else {
-	    cerr << "read failed: "  + client.getMessage() << endl;
-	    return false;
-	  }
-	}
-	else {
-	  cerr << "write failed: "  + client.getMessage() << endl;
-	  return false;
-	}
-	testLine = lines[++i];
-      }
-      cerr << "all lines processed" << endl;
-    }
-    else {
-      cerr << "connection failed: " + client.getMessage() << endl;
-      return false;
-    }
+struct Target {
+  string host;
+  string port;
+  string path;
+};
+
+bool connect( UnixClientSocket& sock, const Target& target ){
+  string greeting;
+  bool ok;
+  if ( target.path.empty() ){
+    ok = sock.connect( target.host, target.port );
   }
-  return true;
+  else {
+    ok = sock.connect_path( target.path );
+  }
+  return ok && sock.read( greeting );
 }
 
-int randomSecs(){
-  long int r = random();
-  ldiv_t dif = ldiv( r, 5 );
-  return abs(dif.rem);
+bool echo( UnixClientSocket& sock, const string& request, string& answer ){
+  return sock.write( request )
+    && sock.read( answer )
+    && answer.size() + 1 == request.size();
 }
 
-bool runToClient( const string& sock, int id ){
-  cerr << "Starting Client " << id << " on localhost, port:" << sock << endl;
-  Sockets::ClientSocket client;
-  if ( client.connect( "localhost", sock) ){
-    client.setNonBlocking();
-    string resultLine;
-    int timeOut = globalTimeOut;
-    int snorr = randomSecs();
-    cerr << "client " << id << " sleeps " << snorr << " seconds" << endl;
-    sleep( snorr);
-    if ( client.read( resultLine, timeOut ) ){
-      cerr << "Client " << id << " read():\t\t\t\t" << resultLine << endl;
-      int i = 0;
-      string testLine = lines[i];
-      while ( !testLine.empty() ){
-	snorr = randomSecs();
-	cerr << "client " << id << " sleeps " << snorr << " seconds" << endl;
-	sleep( snorr);
-	if ( client.write( testLine + "\n", timeOut ) ){
-	  cerr << "Client " << id << " wrote():\t\t\t\t" << testLine << endl;
-	  snorr = randomSecs();
-	  cerr << "client " << id << " sleeps " << snorr << " seconds" << endl;
-	  sleep( snorr);
-	  if ( client.read( resultLine, timeOut ) ){
-	    if ( resultLine == "" )
-	      continue;
-	    cerr << "Client " << id << " read() \t\t\t\t" << resultLine << endl;
+bool run( const Target& target, size_t size, size_t connections,
+	  double seconds ){
+  const string request = string( size, 'x' ) + "\n";
+  vector<vector<double>> latencies( connections );
+  atomic<size_t> ready( 0 );
+  atomic<bool> go( false );
+  atomic<bool> stop( false );
+  atomic<bool> failed( false );
+  vector<thread> workers;
+  for ( size_t i=0; i < connections; ++i ){
+    workers.push_back( thread( [&,i](){
+	  UnixClientSocket sock;
+	  string answer;
+	  bool ok = connect( sock, target );
+	  // warm up: let the connection and its thread settle
+	  const size_t warm_up = 100;
+	  auto w0 = chrono::steady_clock::now();
+	  for ( size_t w=0; ok && w < warm_up; ++w ){
+	    ok = echo( sock, request, answer );
 	  }
-	  else {
-	    cerr << "read failed: "  + client.getMessage() << endl;
-	    return false;
+	  chrono::duration<double> warm_time = chrono::steady_clock::now() - w0;
+	  if ( !ok ){
+	    cerr << "connection " << i << ": " << sock.getMessage() << endl;
+	    failed = true;
 	  }
-	}
-	else {
-	  cerr << "write failed: "  + client.getMessage() << endl;
-	  return false;
-	}
-	testLine = lines[++i];
-      }
-      cerr << "all lines processed" << endl;
-    }
-    else {
-      cerr << "connection failed: " + client.getMessage() << endl;
+	  ++ready;
+	  while ( !go ){
+	    this_thread::yield();
+	  }
+	  vector<double>& lat = latencies[i];
+	  // room for the echoes expected at the warm-up pace, so the vector
+	  // rarely grows while we measure
+	  if ( ok && warm_time.count() > 0 ){
+	    double expected = warm_up * seconds / warm_time.count();
+	    lat.reserve( size_t( expected * 1.25 ) );
+	  }
+	  while ( ok && !stop ){
+	    auto t0 = chrono::steady_clock::now();
+	    if ( !echo( sock, request, answer ) ){
+	      cerr << "connection " << i << ": echo failed "
+		   << sock.getMessage() << endl;
+	      failed = true;
+	      break;
+	    }
+	    chrono::duration<double,micro> d = chrono::steady_clock::now() - t0;
+	    lat.push_back( d.count() );
+	  }
+	} ) );
+  }
+  while ( ready < connections ){
+    this_thread::sleep_for( chrono::milliseconds( 1 ) );
+  }
+  auto start = chrono::steady_clock::now();
+  go = true;
+  this_thread::sleep_for( chrono::duration<double>( seconds ) );
+  stop = true;
+  for ( auto& w : workers ){
+    w.join();
+  }
+  chrono::duration<double> total = chrono::steady_clock::now() - start;
+  if ( failed ){
+    return false;
+  }
+  vector<double> all;
+  for ( const auto& lat : latencies ){
+    all.insert( all.end(), lat.begin(), lat.end() );
+  }
+  if ( all.empty() ){
+    return true;
+  }
+  sort( all.begin(), all.end() );
+  double mean = accumulate( all.begin(), all.end(), 0.0 ) / all.size();
+  double rate = all.size() / total.count();
+  cout << right << setw(8) << size << setw(6) << connections
+       << fixed << setprecision(1)
+       << setw(10) << mean
+       << setw(10) << all[all.size()/2]
+       << setw(10) << all[ min( all.size()-1, size_t(all.size()*0.99) ) ]
+       << setw(12) << setprecision(0) << rate
+       << setw(10) << setprecision(1) << rate * size * 2 / 1e6 << endl;
+  return true;
+}
+
+bool parse_list( const string& value, vector<size_t>& result ){
+  result.clear();
+  for ( const auto& item : TiCC::split_at( value, "," ) ){
+    size_t n;
+    if ( !TiCC::stringTo( item, n ) || n == 0 ){
       return false;
     }
+    result.push_back( n );
   }
-  return true;
+  return !result.empty();
 }
 
-int main( int argc, const char *argv[] ){
-  string port = "1234";
-  string tos = "0";
-  if ( argc > 1 )
-    port = argv[1];
-  if ( argc > 2 )
-    tos = argv[2];
-  int timeOut;
-  if ( !TiCC::stringTo<int>( tos, timeOut ) ){
-    cerr << "invalid timeout" << endl;
-    cerr << "usage: " << argv[0] << " <port> <timeout>" << endl;
-    return 1;
-  }
-  else
-    globalTimeOut = timeOut;
-  int i;
-#pragma omp parallel for
-  for ( i=0; i < 6; ++i ){
-    cerr << "creating client: " << i+1 << endl;
-    if ( globalTimeOut > 0 ){
-      if ( !runToClient( port, i+1 ) )
-	cerr << "runClient failed" << endl;
+int main( int argc, char *argv[] ){
+  TiCC::CL_Options opts( "n:p:u:s:c:t:h", "" );
+  try {
+    opts.init( argc, argv );
+  }
+  catch( TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'h' ) ){
+    usage();
+    exit(EXIT_SUCCESS);
+  }
+  Target target;
+  target.host = "localhost";
+  vector<size_t> sizes = { 16, 256, 4096 };
+  vector<size_t> connections = { 1, 4, 16 };
+  double seconds = 2;
+  string value;
+  opts.extract( 'n', target.host );
+  opts.extract( 'p', target.port );
+  opts.extract( 'u', target.path );
+  if ( opts.extract( 's', value ) && !parse_list( value, sizes ) ){
+    cerr << "invalid sizes: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'c', value ) && !parse_list( value, connections ) ){
+    cerr << "invalid connections: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 't', value )
+       && ( !TiCC::stringTo( value, seconds ) || seconds <= 0 ) ){
+    cerr << "invalid time: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  if ( target.port.empty() && target.path.empty() ){
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  cout << "   bytes conns  mean(us)   p50(us)   p99(us)      msgs/s      MB/s"
+       << endl;
+  for ( const auto& size : sizes ){
+    for ( const auto& conns : connections ){
+      if ( !run( target, size, conns, seconds ) ){
+	exit(EXIT_FAILURE);
+      }
     }
-    else if ( !runClient( port, i+1 ) )
-      cerr << "runClient failed" << endl;
-    cerr << "Client "<< i+1 << " Done" << endl;
   }
-  cerr << "clientTest done" << endl;
-  return 0;
+  return EXIT_SUCCESS;
 }
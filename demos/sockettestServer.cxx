@@ -26,168 +26,86 @@
 
 #include <string>
 #include <cstdlib>
-#include <cstdint>
-#include <unistd.h>
-#include <cstdio>
-#include <signal.h>
 #include <iostream>
-#include "ticcutils/StringOps.h"
-#include "ticcutils/SocketBasics.h"
+#include <exception>
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/ServerBase.h"
+#include "timblserver/UnixSocket.h"
 
 using namespace std;
+using namespace TiCCServer;
+using namespace TimblServer;
 
 //
-// a simple program to demonstrate and test the Timbl Socket interface
+// an echo server, the transport baseline for timblserver: it accepts
+// connections through the same server layer as the real servers (one
+// thread per connection, the same socket streams, optionally a Unix
+// domain socket too), but answers every line with the line itself.
+// Use sockettestClient to measure it.
 //
 
-int globalTimeOut = 0; // evil
-
-void *do_child( void *arg ){
-  Sockets::Socket *mysock = static_cast<Sockets::Socket*>(arg);
-  // Greeting message for the client
-  //
-  //
-  mysock->write( "Welcome to the Timbl socket tester.\n" );
-  // process the test material
-  //
-  char line[256];
-  sprintf( line, "Server: Thread %lu, on Socket %d",
-	   (uintptr_t)pthread_self(),
-	   mysock->getSockId() );
-  cerr << line << ", started" << endl;
-  string buf;
-  while( mysock->read( buf ) ){
-    cerr << "Server: read()" << buf << endl;
-    string answer = string( "echo: " ) + buf + "\n";
-    mysock->write( answer );
-    cerr << "Server: wrote()" << answer << endl;
+class EchoServer : public TcpServerBase {
+public:
+  explicit EchoServer( const TiCC::Configuration *c ):
+    TcpServerBase( c, 0 ){};
+  void callback( childArgs* );
+};
+
+void EchoServer::callback( childArgs *args ){
+  args->os() << "Welcome to the Timbl socket tester." << endl;
+  string line;
+  while ( getline( args->is(), line ) ){
+    // flushed per line, like the answers of the real servers
+    args->os() << line << endl;
   }
-  if ( !mysock->getMessage().empty() )
-    cerr << "Server result: " << mysock->getMessage() << endl;
-  delete mysock;
-  return NULL;
-}
-
-int randomSecs(){
-  long int r = random();
-  ldiv_t dif = ldiv( r, 5 );
-  return abs(dif.rem);
 }
 
-void *do_to_child( void *arg ){
-  Sockets::Socket *mysock = static_cast<Sockets::Socket*>(arg);
-  // Greeting message for the client
-  //
-  //
-  int timeOut = globalTimeOut;
-  int snorr = randomSecs();
-  cerr << "Server sleeps " << snorr << " seconds" << endl;
-  sleep( snorr);
-  mysock->write( "Welcome to the Timbl socket tester.\n", timeOut );
-  // process the test material
-  //
-  char line[256];
-  sprintf( line, "ToServer: Thread %lu, on Socket %d",
-	   (uintptr_t)pthread_self(),
-	   mysock->getSockId() );
-  cerr << line << ", started" << endl;
-  string buf;
-  while( mysock->read( buf, timeOut ) ){
-    cerr << "ToServer: read()" << buf << endl;
-    string answer = string( "echo: " ) + buf + "\n";
-    snorr = randomSecs();
-    cerr << "Server sleeps " << snorr << " seconds" << endl;
-    sleep( snorr);
-    mysock->write( answer, timeOut );
-    cerr << "ToServer: wrote()" << answer << endl;
-  }
-  if ( !mysock->getMessage().empty() )
-    cerr << "Toserver result: " << mysock->getMessage() << endl;
-  delete mysock;
-  return NULL;
+inline void usage(){
+  cerr << "usage: sockettestServer -S port [--unixsocket=<path>] [ServerOptions]"
+       << endl;
+  ServerBase::server_usage();
 }
 
-bool startServer( const string& portString ){
-  Sockets::ServerSocket server;
-  pthread_attr_t attr;
-  if ( pthread_attr_init(&attr) ||
-       pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED ) ){
-    cerr  << "Threads: couldn't set attributes" << endl;
-    return false;
-  }
-  if ( !server.connect( portString ) ){
-    cerr << "failed to start Server: " << server.getMessage() << endl;
-    return false;
-  }
-
-  if ( !server.listen( 5 ) ) {
-    // maximum of 5 pending requests
-    cerr << server.getMessage() << endl;
-    return false;
-  }
-
-  cerr << "Started Server on port:" << portString << endl;
-  int failcount = 0;
-  while( true ){ // waiting for connections loop
-    signal( SIGPIPE, SIG_IGN );
-    Sockets::ClientSocket *newSocket = new Sockets::ClientSocket();
-    if ( !server.accept( *newSocket ) ){
-      cerr << server.getMessage() << endl;
-      if ( ++failcount > 20 ){
-	cerr << "accept failcount >20 " << endl;
-	cerr << "server stopped." << endl;
-	return false;
-	}
-      else {
-	continue;
-      }
+int main( int argc, char *argv[] ){
+  try {
+    TiCC::CL_Options opts;
+    opts.add_short_options( serv_short_opts );
+    opts.add_long_options( serv_long_opts );
+    opts.add_long_options( "unixsocket:" );
+    opts.init( argc, argv );
+    if ( opts.is_present( 'h' )
+	 || opts.is_present( "help" ) ){
+      usage();
+      return EXIT_SUCCESS;
+    }
+    string unix_path;
+    opts.extract( "unixsocket", unix_path );
+    TiCC::Configuration *config = initServerConfig( opts );
+    if ( !config ){
+      usage();
+      return EXIT_FAILURE;
     }
-    else {
-      failcount = 0;
-      cerr  << "Server: Accepting Connection #" << newSocket->getSockId()
-	    << " from remote host: " << newSocket->getClientName() << endl;
-      // create a new thread to process the incoming request
-      // (The thread will terminate itself when done processing
-      // and release its socket handle)
-      //
-      pthread_t chld_thr;
-      if ( globalTimeOut > 0 ){
-	newSocket->setNonBlocking();
-	pthread_create( &chld_thr,
-			&attr,
-			do_to_child,
-			static_cast<void *>(newSocket) );
+    // a benchmark runs in the foreground; the Unix socket listener is a
+    // thread, which would not survive the fork of daemonizing anyway
+    config->setatt( "daemonize", "no" );
+    EchoServer server( config );
+    if ( !unix_path.empty() ){
+      UnixListener *listener = new UnixListener( &server, unix_path );
+      if ( !listener->open() ){
+	cerr << "unable to listen on Unix socket: "
+	     << listener->getMessage() << endl;
+	return EXIT_FAILURE;
       }
-      else {
-	pthread_create( &chld_thr,
-			&attr, do_child,
-			static_cast<void *>(newSocket) );
+      if ( config->lookUp( "port" ).empty() ){
+	listener->run();
+	return EXIT_FAILURE;
       }
+      listener->start();
     }
-    // the server is now free to accept another socket request
-  }
-  pthread_attr_destroy(&attr);
-  return true;
-}
-
-int main( int argc, const char *argv[] ){
-  string port = "1234";
-  string tos = "0";
-  if ( argc > 1 )
-    port = argv[1];
-  if ( argc > 2 )
-    tos = argv[2];
-  int timeOut;
-  if ( !TiCC::stringTo<int>( tos, timeOut ) ){
-    cerr << "invalid timeout" << endl;
-    cerr << "usage: " << argv[0] << " <port> <timeout>" << endl;
-    return 1;
+    return server.Run();
   }
-  else
-    globalTimeOut = timeOut;
-  if ( !startServer( port ) ){
-    cerr << "creating server failed" << endl;
+  catch( const exception& e ){
+    cerr << "sockettestServer failed: " << e.what() << endl;
   }
-  cerr << "Server DONE" << endl;
-  return 0;
+  return EXIT_FAILURE;
 }
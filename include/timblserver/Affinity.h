@@ -0,0 +1,84 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  std::vector<int> parse_cpulist( const std::string& );
+  std::string cpulist_to_string( const std::vector<int>& );
+
+  class Affinity {
+    // places connection threads on CPUs and NUMA nodes
+    // configured by the global settings:
+    //   cpus=<list>     restrict worker threads to these CPUs (e.g. 0-7,16-23)
+    //   pinning=spread  pin every connection to a single CPU, round robin
+    //   numa=yes        distribute connections over the NUMA nodes
+    //   numa=replicate  idem, and load a copy of every base on each node
+    // and an optional [[affinity]] section with lines: basename=<list>
+    // which confines threads serving that base to the given CPUs.
+  public:
+    explicit Affinity( const TiCC::Configuration * );
+    bool numa() const { return _numa; };
+    bool replicate() const { return _replicate; };
+    size_t nodes() const { return node_cpus.size(); };
+    bool bind_to_node( size_t ) const;
+    bool pin_to_cpu( size_t ) const;
+    int bind_connection();
+    bool bind_experiment( const std::string&, int );
+    void count( int, size_t );
+    nlohmann::json stats() const;
+  private:
+    bool bind( const std::vector<int>& ) const;
+    bool _numa;
+    bool _replicate;
+    bool spread;
+    std::vector<int> cpus;
+    std::vector<std::vector<int>> node_cpus;
+    std::vector<int> node_ids;
+    std::map<std::string,std::vector<int>> exp_cpus;
+    std::atomic<unsigned int> next_node;
+    mutable std::atomic<unsigned int> next_cpu;
+    struct node_stats {
+      std::atomic<unsigned long> connections{0};
+      std::atomic<unsigned long> instances{0};
+    };
+    std::vector<node_stats> counters;
+  };
+
+}
+#endif // AFFINITY_H
@@ -0,0 +1,136 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef ALLOCTRACKER_H
+#define ALLOCTRACKER_H
+
+#include <string>
+#include <cstdint>
+#include "ticcutils/LogStream.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class StageTimer;
+
+  struct AllocCounts {
+    // the heap use of a piece of work. peak is the most memory it had
+    // allocated and not yet freed at any moment
+    unsigned long allocs;
+    unsigned long frees;
+    uint64_t bytes;
+    uint64_t freed;
+    int64_t peak;
+    void clear() { allocs = frees = 0; bytes = freed = 0; peak = 0; };
+    void add( const AllocCounts& );
+    nlohmann::json to_json() const;
+  };
+
+  struct AllocTotals {
+    // the allocations of requests per phase: the setup of working copies
+    // of bases, then the stages of a StageTimer
+    static const int NumPhases = 6;
+    static const char *phase_name( int );
+    unsigned long requests;
+    AllocCounts phases[NumPhases];
+    void clear();
+    nlohmann::json to_json() const;
+  };
+
+  class AllocMeter {
+    // the allocations of this thread from one lap to the next
+  public:
+    AllocMeter(){ restart(); };
+    void restart();
+    AllocCounts lap();
+  private:
+    unsigned long allocs;
+    unsigned long frees;
+    uint64_t bytes;
+    uint64_t freed;
+    int64_t live;
+  };
+
+  class AllocTracker {
+    // counts the heap allocations of the server per protocol, base and
+    // phase of a request: the setup of a working copy of a base, and the
+    // stages of the StageTimer. Needs a server configured with
+    // --enable-alloc-stats, which counts every operator new and delete;
+    // otherwise nothing is counted and active() is false.
+    // Counts are per thread: the work of fan-out and batching threads is
+    // not booked on the connection that asked for it
+  public:
+    static bool active() { return hooked; };
+    static void set_active() { hooked = true; };
+    static void note_alloc( size_t );
+    static void note_free( size_t );
+    static void record( const std::string&,
+			const std::string&,
+			const StageTimer& );
+    static nlohmann::json stats();
+  private:
+    friend class AllocMeter;
+    friend class AllocScope;
+    static bool hooked;
+  };
+
+  class AllocScope {
+    // books the allocations while it exists as the setup of base 'name',
+    // on the connection of this thread
+  public:
+    explicit AllocScope( const std::string& );
+    ~AllocScope();
+  private:
+    AllocScope( const AllocScope& ) = delete;
+    AllocScope& operator=( const AllocScope& ) = delete;
+    std::string name;
+    AllocMeter meter;
+  };
+
+  class AllocConnection {
+    // the allocations of one connection, served by this thread. Logged
+    // when the connection closes
+  public:
+    AllocConnection( const char *, int, TiCC::LogStream& );
+    ~AllocConnection();
+  private:
+    AllocConnection( const AllocConnection& ) = delete;
+    AllocConnection& operator=( const AllocConnection& ) = delete;
+    friend class AllocTracker;
+    friend class AllocScope;
+    const char *protocol;
+    int id;
+    TiCC::LogStream& log;
+    AllocTotals totals;
+    AllocConnection *prev;
+  };
+
+}
+#endif // ALLOCTRACKER_H
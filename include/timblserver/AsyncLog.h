@@ -0,0 +1,119 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Configuration.h"
+
+namespace TimblServer {
+
+  class AsyncLog {
+    // a logging backend which doesn't make the worker threads wait for
+    // each other. Every thread writes complete lines into a ring buffer
+    // of its own, without locking; a background thread moves them to the
+    // LogStream of the server. Configured by the global settings:
+    //   asynclog=yes              use it (default: no, log directly)
+    //   asynclog_buffer=<KB>      the buffer size per thread (default 64).
+    //                             Lines that don't fit are dropped and
+    //                             counted, logging never blocks
+  public:
+    explicit AsyncLog( const TiCC::Configuration * );
+    ~AsyncLog();
+    bool enabled() const { return target != 0; };
+    void start( TiCC::LogStream& );
+    void push( const std::string& ) const;
+  private:
+    struct Ring {
+      // single producer (the owning thread), single consumer (the writer)
+      explicit Ring( size_t s ): data( s ){};
+      std::vector<char> data;
+      std::atomic<size_t> head{0};
+      std::atomic<size_t> tail{0};
+      std::atomic<bool> retired{false};
+      std::atomic<unsigned long> dropped{0};
+    };
+    Ring *my_ring() const;
+    void writer();
+    void drain();
+    AsyncLog( const AsyncLog& ) = delete;
+    AsyncLog& operator=( const AsyncLog& ) = delete;
+    bool wanted;
+    size_t ring_size;
+    TiCC::LogStream *target;
+    // logging doesn't change the server, so these are mutable and push()
+    // can be used from const members
+    mutable std::vector<Ring*> rings;
+    mutable std::vector<Ring*> spare;
+    mutable std::mutex mtx;
+    mutable std::thread writer_thread;
+    std::condition_variable cv;
+    std::atomic<bool> stopping;
+  };
+
+  inline bool log_enabled( TiCC::LogStream& ls, LogLevel level ){
+    return ls.getlevel() >= level;
+  }
+
+  class LogLine {
+    // one LOG or DBG statement. With an AsyncLog the line is collected
+    // here and handed over as a whole when the statement ends; otherwise
+    // it goes to the LogStream directly, as with TiCC::Log and TiCC::Dbg
+  public:
+    LogLine( const AsyncLog&, TiCC::LogStream&, bool = false );
+    ~LogLine();
+    std::ostream& stream();
+  private:
+    const AsyncLog& sink;
+    std::ostringstream buffer;
+    std::optional<TiCC::Log> log;
+    std::optional<TiCC::Dbg> dbg;
+  };
+
+}
+
+// 'sink' is the AsyncLog of the server. The arguments of a DBG or SDBG
+// statement are not even evaluated when debugging is off
+#define ASYNC_LOG( sink, ls ) \
+  if ( false ) {} else TimblServer::LogLine( sink, ls ).stream()
+#define ASYNC_DBG( sink, ls ) \
+  if ( !TimblServer::log_enabled( ls, LogDebug ) ) {}	\
+  else TimblServer::LogLine( sink, ls, true ).stream()
+
+#endif // ASYNCLOG_H
@@ -0,0 +1,116 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include "timbl/TimblAPI.h"
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+#include "timblserver/Affinity.h"
+
+namespace TimblServer {
+
+  class Batcher {
+    // classifies the instances of all connections on a few pinned worker
+    // threads, in small batches per base and options, instead of in the
+    // connection threads themselves. Configured by the global settings:
+    //   batching=yes        use it (default: no)
+    //   batch_size=<num>    max. instances in a batch (default 16)
+    //   batch_wait=<us>     max. time the first instance of a batch
+    //                       waits for more (default 500)
+    //   batch_workers=<num> the number of workers, each pinned to a CPU
+    //                       of its own (default: one per CPU)
+    // A worker keeps a clone per base and options, at most 'max_clones'
+    // of them: the one used longest ago goes first
+  public:
+    typedef std::function<std::shared_ptr<Timbl::TimblExperiment>( const std::string& )> Lookup;
+    typedef std::function<void( Timbl::TimblExperiment * )> Work;
+    explicit Batcher( const TiCC::Configuration * );
+    ~Batcher();
+    bool enabled() const { return wanted; };
+    void setup( const Lookup&, const Affinity * );
+    bool run( const std::string&, const std::string&, const Work&,
+	      std::string& );
+    nlohmann::json stats() const;
+  private:
+    struct Job {
+      const Work *work;
+      std::chrono::steady_clock::time_point queued;
+      std::string error;
+      std::promise<void> finished;
+    };
+    struct Clone {
+      std::shared_ptr<Timbl::TimblExperiment> source;
+      Timbl::TimblExperiment *exp = 0;
+      std::chrono::steady_clock::time_point used;
+    };
+    Batcher( const Batcher& ) = delete;
+    Batcher& operator=( const Batcher& ) = delete;
+    void worker( size_t );
+    Timbl::TimblExperiment *clone_for( std::map<std::string,Clone>&,
+				       const std::string&,
+				       std::ostream&,
+				       std::string& );
+    bool wanted;
+    size_t max_batch;
+    long wait_us;
+    size_t num_workers;
+    size_t max_clones;
+    Lookup lookup;
+    const Affinity *affinity;
+    // per base+TAB+options the jobs waiting. Removed when empty
+    std::map<std::string,std::deque<Job*>> queues;
+    std::vector<std::thread> workers;
+    bool stopping;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    // statistics, under mtx
+    unsigned long batches;
+    unsigned long jobs;
+    size_t largest;
+    double total_wait_us;
+    double max_wait_us;
+    std::vector<unsigned long> sizes; // batches of 1, 2-3, 4-7, ...
+  };
+
+}
+#endif // BATCHER_H
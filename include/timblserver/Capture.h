@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include "ticcutils/Configuration.h"
+
+namespace TimblServer {
+
+  class Capture {
+    // records the incoming requests, for replay with timblreplay.
+    // configured by the global settings:
+    //   capture=<file>          where to write (no file: no capture)
+    //   capture_sample=<frac>   the fraction of the connections to record
+    //                           (default 1). Connections are sampled as a
+    //                           whole, so BASE and SET commands are kept
+    //                           together with the requests depending on them
+    // every record is a line of tab separated fields:
+    //   <microseconds since capture start> <connection id> <type> [<data>]
+    // where type is O (open, data is the protocol), R (request, data is
+    // the request line as read) or C (close).
+  public:
+    explicit Capture( const TiCC::Configuration * );
+    bool enabled() const { return sample > 0; };
+    unsigned long open( const std::string& );
+    void record( unsigned long, const std::string& );
+    void close( unsigned long );
+  private:
+    void write( unsigned long, char, const std::string& );
+    double sample;
+    unsigned long seen;
+    unsigned long last_id;
+    std::chrono::steady_clock::time_point start;
+    std::ofstream capture_file;
+    std::mutex mtx;
+  };
+
+}
+#endif // CAPTURE_H
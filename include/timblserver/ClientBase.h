@@ -32,6 +32,8 @@
 #include "timbl/TimblAPI.h"
 #include "ticcutils/LogStream.h"
 #include "ticcutils/SocketBasics.h"
+#include "timblserver/UnixSocket.h"
+#include "timblserver/LineIO.h"
 
 namespace TimblServer {
 
@@ -40,28 +42,35 @@ namespace TimblServer {
     virtual ~ClientClass();
     ClientClass();
     bool connect( const std::string&, const std::string& );
+    bool connect( const std::string& );
     const std::string& getBase( ) const { return _base; };
     bool setBase( const std::string& );
     const std::set<std::string>& baseNames() const { return bases;};
     bool classify( const std::string& );
     bool classifyFile( std::istream&, std::ostream& );
+    bool classifyFile( LineSource&, AsyncWriter& );
     bool runScript( std::istream&, std::ostream& );
     const std::string& getClass() const { return Class; };
     const std::string& getDistance() const { return distance; };
     const std::string& getDistribution() const { return distribution; };
     const std::vector<std::string>& getNeighbors() const { return neighbors; };
   private:
+    bool handshake();
     bool extractBases( const std::string& );
     bool extractResult( const std::string& );
+    bool classifyLine( std::string_view );
     int serverPort;
     std::string serverName;
-    Sockets::ClientSocket client;
+    UnixClientSocket client;
     std::string _base;
     std::set<std::string> bases;
     std::string Class;
     std::string distance;
     std::string distribution;
     std::vector<std::string> neighbors;
+    std::string request;
+    std::string response;
+    std::string rest;
   };
 
 }
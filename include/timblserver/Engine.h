@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include "timbl/TimblAPI.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Configuration.h"
+
+namespace TimblServer {
+
+  struct EngineResult {
+    EngineResult(): ok(false), distance(0.0), confidence(0.0),
+		    match_depth(0) {};
+    bool ok;
+    std::string error;
+    std::string category;
+    std::string distribution;
+    double distance;
+    double confidence;
+    size_t match_depth;
+  };
+
+  class Engine {
+    // the experiments of a server configuration, for use without a
+    // server: the bases are loaded like TimblServer does, and classify()
+    // may be called from any number of threads. Every call borrows a
+    // clone of the base (with the requested options) from a pool, so
+    // concurrent calls don't share Timbl state
+  public:
+    explicit Engine( const TiCC::Configuration * );
+    explicit Engine( const std::string& );
+    ~Engine();
+    std::vector<std::string> bases() const;
+    bool has_base( const std::string& ) const;
+    EngineResult classify( const std::string&,
+			   const std::string&,
+			   const std::string& = "" );
+    std::vector<EngineResult> classifyBatch( const std::string&,
+					     const std::vector<std::string>&,
+					     const std::string& = "" );
+    TiCC::LogStream& logstream() { return e_log; };
+  private:
+    Engine( const Engine& ) = delete;
+    Engine& operator=( const Engine& ) = delete;
+    struct Worker {
+      Worker(): exp(0), null_stream(0) {};
+      Timbl::TimblExperiment *exp;
+      std::ostream null_stream;
+    };
+    void load( const TiCC::Configuration * );
+    Worker *acquire( const std::string&, const std::string&, std::string& );
+    void release( const std::string&, const std::string&, Worker * );
+    void classify_one( Worker *, const std::string&, EngineResult& );
+    TiCC::LogStream e_log;
+    std::map<std::string,Timbl::TimblExperiment*> experiments;
+    std::map<std::string,std::vector<Worker*>> idle;
+    std::vector<Worker*> workers;
+    std::mutex mtx;
+  };
+
+}
+#endif // ENGINE_H
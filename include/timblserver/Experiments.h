@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef EXPERIMENTS_H
+#define EXPERIMENTS_H
+
+#include <string>
+#include <map>
+#include <set>
+#include "timbl/TimblAPI.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Configuration.h"
+
+namespace TimblServer {
+
+  // the global settings which are NOT old style experiment definitions
+  extern const std::set<std::string> server_settings;
+
+  // the experiments defined by a configuration: basename -> Timbl options
+  std::map<std::string,std::string>
+    experiment_definitions( const TiCC::Configuration * );
+
+  // the 'cachedir' setting, created when needed. Empty if not usable
+  std::string cache_directory( const TiCC::Configuration *,
+			       TiCC::LogStream& );
+
+  Timbl::TimblExperiment *create_experiment( const std::string&,
+					     const std::string&,
+					     TiCC::LogStream&,
+					     const std::string& = "" );
+
+}
+#endif // EXPERIMENTS_H
@@ -0,0 +1,104 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef FALLBACK_H
+#define FALLBACK_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "timbl/TimblAPI.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class Fallbacks {
+    // routes requests for an overloaded base to a faster base for the
+    // same data, e.g. an IGTREE version of an IB1 base. Configured by a
+    // [[fallback]] section with lines: basename=fallback:latency[:depth]
+    //   latency  switch when the recent latency of basename (queueing
+    //            included) exceeds this many ms (0: don't look at it)
+    //   depth    or when this many requests for basename are in progress
+    // Back to basename when its latency is below 80% of the threshold
+    // and at most half of 'depth' requests are in progress. Meanwhile,
+    // one request per 100 ms still goes to basename, to measure it
+  public:
+    class Route {
+      // the base that serves one request. Books the latency of the
+      // request when it goes out of scope
+    public:
+      Route(): owner(0), is_fallback(false) {};
+      Route( Route&& );
+      Route& operator=( Route&& );
+      Route( const Route& ) = delete;
+      Route& operator=( const Route& ) = delete;
+      ~Route();
+      const std::string& base() const { return _base; };
+      bool fallback() const { return is_fallback; };
+    private:
+      friend class Fallbacks;
+      Fallbacks *owner;
+      std::string primary;
+      std::string _base;
+      bool is_fallback;
+      std::chrono::steady_clock::time_point start;
+    };
+    explicit Fallbacks( const TiCC::Configuration * );
+    void check( const std::map<std::string,Timbl::TimblExperiment*>&,
+		TiCC::LogStream& );
+    bool has_fallback( const std::string& b ) const {
+      return states.find( b ) != states.end();
+    };
+    Route route( const std::string& );
+    nlohmann::json stats() const;
+  private:
+    struct state {
+      std::string fallback;
+      double latency_ms = 0;
+      size_t depth = 0;
+      double recent_ms = 0;
+      size_t in_progress = 0;
+      bool active = false;
+      std::chrono::steady_clock::time_point last_probe;
+      unsigned long switches = 0;
+      unsigned long primary_served = 0;
+      unsigned long fallback_served = 0;
+    };
+    void finish( const Route& );
+    std::map<std::string,state> states; // fixed after check()
+    TiCC::LogStream *log;
+    mutable std::mutex mtx;
+  };
+
+}
+#endif // FALLBACK_H
@@ -0,0 +1,135 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef LEARNER_H
+#define LEARNER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "timbl/TimblAPI.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class Learner {
+    // adds instances sent by the clients (the 'learn' command) to the
+    // bases. Configured by the global settings:
+    //   learn=<base>,<base>    the bases which may learn ('yes': all)
+    //   learn_batch=<num>      publish after this many instances (def. 100)
+    //   learn_interval=<ms>    or when the oldest waited this long (1000)
+    //   learn_queue=<num>      max. instances waiting (default 100000)
+    // A batch is applied to a private copy of the base, which is then
+    // published: new requests use the new version, while requests busy
+    // with the old one finish on it. A version is freed with its last
+    // clone. The copies take turns: once the clones have left the
+    // previous version, the next batch goes to that one, after the batch
+    // it missed. Only when a clone still holds it, a new copy is built
+    // from the original base plus everything learned so far, which takes
+    // as long as loading the base and learning all that again. So a
+    // learning base takes twice the memory, keeps the learned instances
+    // as text, and is not replicated on NUMA nodes
+  public:
+    explicit Learner( const TiCC::Configuration * );
+    ~Learner();
+    bool enabled() const { return all || !wanted.empty(); };
+    void setup( const std::map<std::string,Timbl::TimblExperiment*>&,
+		const TiCC::Configuration *,
+		TiCC::LogStream& );
+    bool learns( const std::string& b ) const {
+      return bases.find( b ) != bases.end();
+    };
+    std::shared_ptr<Timbl::TimblExperiment> current( const std::string& ) const;
+    bool add( const std::string&, const std::string&, std::string& );
+    nlohmann::json stats() const;
+  private:
+    struct Base {
+      Base(): version(0) {};
+      std::string params;
+      std::shared_ptr<Timbl::TimblExperiment> current;
+      // only touched by the learner thread
+      std::shared_ptr<Timbl::TimblExperiment> spare;
+      // the version before 'current', if we built it, and the instances
+      // it lacks
+      std::shared_ptr<Timbl::TimblExperiment> retired;
+      std::vector<std::string> behind;
+      std::vector<std::string> history;
+      unsigned long version;
+    };
+    struct Pending {
+      std::string base;
+      std::string instance;
+      std::chrono::steady_clock::time_point added;
+    };
+    Learner( const Learner& ) = delete;
+    Learner& operator=( const Learner& ) = delete;
+    void run();
+    void apply( const std::string&, const std::vector<Pending>& );
+    Timbl::TimblExperiment *build_spare( const std::string&, const Base& );
+    bool take_retired( Base& );
+    bool all;
+    std::set<std::string> wanted;
+    size_t batch;
+    long interval_ms;
+    size_t max_queue;
+    std::string cache_dir;
+    TiCC::LogStream *log;
+    std::map<std::string,Base> bases; // fixed after setup()
+    std::vector<Pending> queue;
+    std::thread learner_thread;
+    bool stopping;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    // statistics, under mtx
+    unsigned long queued;
+    unsigned long learned;
+    unsigned long rejected;
+    unsigned long dropped;
+    unsigned long published;
+    unsigned long rebuilt;
+    double apply_s;
+    double last_publish_ms;
+    double max_publish_ms;
+    double total_lag_ms;
+    double max_lag_ms;
+    unsigned long lagged;
+  };
+
+}
+#endif // LEARNER_H
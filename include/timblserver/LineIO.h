@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef LINEIO_H
+#define LINEIO_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace TimblServer {
+
+  class LineSource {
+    // hands out the lines of a file without copying them. A regular file
+    // is mapped in memory; anything else (a pipe, standard input) is read
+    // in large blocks. A line stays valid until the next call of next()
+  public:
+    LineSource();
+    ~LineSource();
+    bool open( const std::string& );
+    bool open( int );
+    bool next( std::string_view& );
+    const std::string& getMessage() const { return mess; };
+  private:
+    LineSource( const LineSource& ) = delete;
+    LineSource& operator=( const LineSource& ) = delete;
+    bool fill();
+    int fd;
+    bool owned;
+    const char *mapped;
+    size_t mapped_size;
+    size_t pos;
+    std::vector<char> block;
+    size_t block_start;
+    size_t block_end;
+    bool at_eof;
+    std::string mess;
+  };
+
+  class AsyncWriter {
+    // collects output in large buffers, which a thread of its own writes
+    // to a file descriptor. At most a few buffers wait: a slow disk
+    // slows the producer down instead of filling the memory
+  public:
+    explicit AsyncWriter( int, size_t = 1024*1024 );
+    ~AsyncWriter();
+    void write( const char *, size_t );
+    void write( std::string_view s ){ write( s.data(), s.size() ); };
+    bool close();
+    const std::string& getMessage() const { return mess; };
+  private:
+    AsyncWriter( const AsyncWriter& ) = delete;
+    AsyncWriter& operator=( const AsyncWriter& ) = delete;
+    void hand_over();
+    void run();
+    int fd;
+    size_t buffer_size;
+    std::string current;
+    std::deque<std::string> full;   // waiting to be written
+    std::vector<std::string> spare; // written, for reuse
+    bool closing;
+    bool failed;
+    std::string mess;
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cv;
+  };
+
+}
+#endif // LINEIO_H
@@ -0,0 +1,97 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include "ticcutils/Configuration.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class PerfCounters {
+    // hardware counters (cycles, instructions, cache misses and branch
+    // misses) of the classifications, per base, using Linux perf events.
+    // Only the classifying thread itself is counted, in user space.
+    // Configured by the global settings:
+    //   perf=yes             count (default: no)
+    //   perf_sample=<num>    count 1 in <num> classifications of every
+    //                        thread (default 1: all)
+    // When perf events are unavailable (not Linux, no permission, or a
+    // container without a PMU) this is logged once, and nothing is counted
+  public:
+    enum Event { Cycles, Instructions, CacheMisses, BranchMisses,
+		 NumEvents };
+    explicit PerfCounters( const TiCC::Configuration * );
+    bool requested() const { return wanted; };
+    bool enabled() const { return wanted && available; };
+    void probe( TiCC::LogStream& );
+    nlohmann::json stats() const;
+    static std::string to_string( Event );
+  private:
+    friend class PerfScope;
+    void record( const std::string&, const double * ) const;
+    bool wanted;
+    bool available;
+    unsigned long sample;
+    unsigned int events; // bitmask of the events this machine counts
+    std::string error;
+    struct Totals {
+      unsigned long samples = 0;
+      double values[NumEvents] = { 0, 0, 0, 0 };
+    };
+    // statistics, under mtx
+    mutable std::map<std::string,Totals> totals;
+    mutable unsigned long failures;
+    mutable std::mutex mtx;
+  };
+
+  class PerfScope {
+    // counts the events between construction and destruction, for base
+    // 'name', when this call is sampled
+  public:
+    PerfScope( const PerfCounters&, const std::string& );
+    ~PerfScope();
+  private:
+    PerfScope( const PerfScope& ) = delete;
+    PerfScope& operator=( const PerfScope& ) = delete;
+    const PerfCounters& perf;
+    std::string name;
+    bool active;
+    uint64_t start[PerfCounters::NumEvents+2];
+  };
+
+}
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <mutex>
+#include "ticcutils/Configuration.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class Profiler {
+    // samples the stacks of the running server for some seconds, on
+    // request, and writes them as folded stacks (one line per stack,
+    // frames separated by ';', then the count) for flame graph tools.
+    // Every stack starts with the protocol and the base it worked for.
+    // Nothing is sampled until a profile is asked for. Configured by the
+    // global settings:
+    //   profile_dir=<dir>    where to write the profiles (no dir: no
+    //                        profiling)
+    //   profile_hz=<num>     samples per second of CPU time (default 99)
+    //   profile_max=<s>      the longest profile allowed (default 300)
+  public:
+    explicit Profiler( const TiCC::Configuration * );
+    bool enabled() const { return !directory.empty(); };
+    nlohmann::json start( double, TiCC::LogStream& );
+    nlohmann::json stats() const;
+  private:
+    Profiler( const Profiler& ) = delete;
+    Profiler& operator=( const Profiler& ) = delete;
+    void finish( double, const std::string&, TiCC::LogStream * );
+    std::string directory;
+    long hz;
+    double max_seconds;
+    // under mtx
+    bool busy;
+    std::string last_file;
+    unsigned long last_samples;
+    unsigned long last_dropped;
+    mutable std::mutex mtx;
+  };
+
+  class ProfileTag {
+    // labels the samples taken in this thread while it exists with a
+    // protocol and a base. An empty base keeps the current one
+  public:
+    explicit ProfileTag( const char *, const std::string& = "" );
+    ~ProfileTag();
+  private:
+    ProfileTag( const ProfileTag& ) = delete;
+    ProfileTag& operator=( const ProfileTag& ) = delete;
+    const char *prev_protocol;
+    const char *prev_base;
+  };
+
+}
+#endif // PROFILER_H
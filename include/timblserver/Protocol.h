@@ -0,0 +1,74 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <map>
+#include <ostream>
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  // the parsing and formatting done for every request, by the servers
+  // and by the client
+
+  // TCP protocol: the commands
+  enum CommandType { UnknownCommand, Classify, Base,
+		     Query, Set, Exit, Vocab, Multi, Learn, Async, Comment };
+  CommandType check_command( const std::string& );
+  void split_command( const std::string&, std::string&, std::string& );
+
+  // TCP protocol: the answers, as a client sees them
+  enum code_t { UnknownCode, Result, Err, OK, Echo, Skip,
+		Neighbors, EndNeighbors, Status, EndStatus, Tagged };
+  code_t toCode( const std::string& );
+  code_t extract_code( const std::string&, std::string& );
+  bool parse_result( const std::string&,
+		     std::string&,
+		     std::string&,
+		     std::string&,
+		     bool& );
+
+  // HTTP protocol
+  std::string urlDecode( const std::string& );
+  std::multimap<std::string,std::string> parse_query( const std::string&,
+						      std::ostream& );
+  std::string strip_quotes( const std::string& );
+
+  // JSON protocol
+  nlohmann::json json_error( const std::string& );
+  bool parse_json_request( const std::string&,
+			   nlohmann::json&,
+			   std::string& );
+
+}
+#endif // PROTOCOL_H
@@ -0,0 +1,127 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class Scheduler {
+    // admission control for classifications, per base (bulkheads)
+    // configured by the global settings:
+    //   workers=<num>        max. classifications running over all bases
+    //                        (default 0: unlimited)
+    //   queue_timeout=<ms>   max. time a request waits for a slot
+    // a [[bulkheads]] section with lines: basename=limit[:queue[:weight]]
+    //   limit   max. simultaneous classifications on that base
+    //   queue   max. requests waiting for that base, beyond that they are
+    //           refused at once
+    //   weight  share of the 'workers' this base gets under contention
+    // and a [[clientclasses]] section with lines: name=weight:prefix,...
+    //   connections from an address starting with one of the prefixes
+    //   belong to that class. Within a base, classes share by weight.
+    //   Clients on a Unix domain socket have the address 'local'.
+  public:
+    class Slot {
+      // a granted (or refused) place to run a classification.
+      // releases the place when it goes out of scope
+    public:
+      Slot(): sched(0), ok(false){};
+      Slot( Scheduler *s, const std::string& b ):
+	sched(s), base(b), ok(true){};
+      Slot( Slot&& other ):
+	sched(other.sched), base(other.base), ok(other.ok){
+	other.sched = 0;
+      };
+      Slot& operator=( Slot&& );
+      Slot( const Slot& ) = delete;
+      Slot& operator=( const Slot& ) = delete;
+      ~Slot(){ release(); };
+      void release();
+      explicit operator bool() const { return ok; };
+    private:
+      Scheduler *sched;
+      std::string base;
+      bool ok;
+    };
+    explicit Scheduler( const TiCC::Configuration * );
+    bool enabled() const { return _enabled; };
+    std::string client_class( int ) const;
+    Slot acquire( const std::string&, const std::string& );
+    nlohmann::json stats() const;
+  private:
+    struct ticket {
+      bool granted = false;
+    };
+    struct client_queue {
+      double weight = 1.0;
+      double vtime = 0;
+      unsigned long served = 0;
+      std::deque<ticket*> waiting;
+    };
+    struct bulkhead {
+      size_t limit = 0;
+      size_t queue = 0;
+      double weight = 1.0;
+      double vtime = 0;
+      double vclock = 0;
+      size_t active = 0;
+      size_t waiting = 0;
+      unsigned long served = 0;
+      unsigned long rejected = 0;
+      unsigned long timed_out = 0;
+      double wait_ms = 0;
+      std::map<std::string,client_queue> classes;
+    };
+    bulkhead& get_bulkhead( const std::string& );
+    void dispatch();
+    void release( const std::string& );
+    bool _enabled;
+    size_t workers;
+    size_t active;
+    double vclock;
+    int queue_timeout;
+    std::map<std::string,bulkhead> bulkheads;
+    std::map<std::string,double> class_weights;
+    std::vector<std::pair<std::string,std::string>> class_prefixes;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+  };
+
+}
+#endif // SCHEDULER_H
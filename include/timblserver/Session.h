@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <istream>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "ticcutils/Configuration.h"
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class SessionLimits {
+    // limits on the connections of the TCP and JSON protocols, so idle
+    // or greedy clients don't keep threads and clones forever. Configured
+    // by the global settings (0 or absent: no limit):
+    //   idle_release=<s>      free the working clone of a connection idle
+    //                         this long. It is made again on the next
+    //                         request, with the same options
+    //   idle_timeout=<s>      close connections idle this long
+    //   session_lifetime=<s>  close connections older than this
+    //   session_requests=<n>  close connections after this many requests
+    //   session_concurrency=<n> the requests with an id one connection
+    //                         may have in flight (default 4)
+  public:
+    enum Reason { Idle, Lifetime, Requests, NumReasons };
+    explicit SessionLimits( const TiCC::Configuration * );
+    bool watch_idle() const { return idle_release_s > 0 || idle_timeout_s > 0; };
+    size_t concurrency() const { return max_in_flight; };
+    void count_multiplexed() { ++multiplexed; };
+    nlohmann::json stats() const;
+    static std::string to_string( Reason );
+  private:
+    friend class Session;
+    double idle_release_s;
+    double idle_timeout_s;
+    double lifetime_s;
+    unsigned long max_requests;
+    size_t max_in_flight;
+    std::atomic<unsigned long> closed[NumReasons];
+    std::atomic<unsigned long> released;
+    std::atomic<unsigned long> revived;
+    std::atomic<unsigned long> multiplexed;
+  };
+
+  class Session {
+    // the limits applied to one connection. Call wait() before reading
+    // the next request: it returns false when the connection must be
+    // closed, and reason() tells which limit was reached
+  public:
+    Session( SessionLimits&, int, std::istream& );
+    bool wait( const std::function<void()>& );
+    void revived() { ++limits.revived; };
+    bool limit_reached() const { return why != SessionLimits::NumReasons; };
+    std::string reason() const { return SessionLimits::to_string( why ); };
+  private:
+    bool close( SessionLimits::Reason );
+    SessionLimits& limits;
+    int fd;
+    std::istream& is;
+    std::chrono::steady_clock::time_point born;
+    unsigned long requests;
+    SessionLimits::Reason why;
+  };
+
+}
+#endif // SESSION_H
@@ -0,0 +1,154 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <cstdint>
+#include "timblserver/UnixSocket.h"
+
+namespace TimblServer {
+
+  // A transport for clients on the same host: the bytes of a session go
+  // through a pair of ring buffers in a POSIX shared memory segment
+  // (/dev/shm) instead of through the kernel. The client creates the
+  // segment and hands its name to the server over a Unix domain socket
+  // (the 'shmsocket' setting). That connection stays open for the
+  // lifetime of the session, so either side notices when the other goes.
+  // The session speaks the JSON protocol.
+
+  struct ShmRing {
+    // single producer, single consumer. head and tail count bytes ever
+    // written and read. The *_seq words are bumped after every move and
+    // serve as futexes for a side that waits
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> reader_waiting;
+    std::atomic<uint32_t> writer_waiting;
+    char pad[32];
+  };
+
+  struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    ShmRing to_server;
+    ShmRing to_client;
+  };
+
+  class ShmChannel {
+    // one side of a mapped session segment
+  public:
+    ShmChannel();
+    ~ShmChannel();
+    bool create( const std::string&, size_t );
+    bool open( const std::string& );
+    void unlink();
+    const std::string& name() const { return _name; };
+    const std::string& getMessage() const { return mess; };
+    // as seen from the server, or the client
+    ShmRing *in_ring( bool server ) const;
+    ShmRing *out_ring( bool server ) const;
+    char *in_data( bool server ) const;
+    char *out_data( bool server ) const;
+    size_t ring_size() const { return header ? header->ring_size : 0; };
+  private:
+    ShmChannel( const ShmChannel& ) = delete;
+    ShmChannel& operator=( const ShmChannel& ) = delete;
+    ShmHeader *header;
+    size_t mapped;
+    std::string _name;
+    std::string mess;
+    bool owner;
+  };
+
+  class ShmStreamBuf : public std::streambuf {
+    // reads from one ring and writes to the other. A side that finds
+    // nothing to read (or no room to write) spins for a while, then
+    // sleeps on a futex, checking 'alive' every 100 ms. The other side
+    // can write the whole segment, so its index is checked before use:
+    // one that is more than a ring away ends the session
+  public:
+    ShmStreamBuf( ShmChannel&, bool, const std::function<bool()>& );
+  protected:
+    int_type underflow() override;
+    int_type overflow( int_type ) override;
+    int sync() override;
+  private:
+    bool write_out( const char *, size_t );
+    ShmRing *in;
+    ShmRing *out;
+    char *in_data;
+    char *out_data;
+    size_t size;
+    // our own indices, the copies in the segment are only published
+    uint64_t read_pos;
+    uint64_t write_pos;
+    bool broken;
+    std::function<bool()> alive;
+    char get_buf[4096];
+    char put_buf[4096];
+  };
+
+  class ShmStream : public std::iostream {
+  public:
+    ShmStream( ShmChannel& c, bool server, const std::function<bool()>& a ):
+      std::iostream( &buf ), buf( c, server, a ){};
+  private:
+    ShmStreamBuf buf;
+  };
+
+  bool peer_alive( int );
+
+  class ShmClient {
+    // the client side of a shared memory session with a JSON server
+  public:
+    ShmClient(): stream(0){};
+    ~ShmClient();
+    bool connect( const std::string&, size_t = 1024*1024 );
+    const std::string& greeting() const { return _greeting; };
+    bool request( const std::string&, std::string& );
+    const std::string& getMessage() const { return mess; };
+  private:
+    UnixClientSocket control;
+    ShmChannel channel;
+    ShmStream *stream;
+    std::string _greeting;
+    std::string mess;
+  };
+
+}
+#endif // SHMTRANSPORT_H
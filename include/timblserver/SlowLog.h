@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include "ticcutils/Configuration.h"
+#include "timblserver/AllocTracker.h"
+
+namespace TimblServer {
+
+  class StageTimer {
+    // measures where the time of one request goes. mark() books the time
+    // since the previous mark on a stage, so stages may be visited more
+    // than once (e.g. an HTTP request with several instances). When the
+    // AllocTracker is active, the allocations are booked likewise
+  public:
+    enum Stage { Read, Parse, Queue, Classify, Write, NumStages };
+    StageTimer(){ reset(); };
+    void reset();
+    void mark( Stage );
+    double ms( Stage s ) const { return spent[s]; };
+    double service_ms() const;
+    const AllocCounts& allocs( Stage s ) const { return allocated[s]; };
+  private:
+    std::chrono::steady_clock::time_point last;
+    double spent[NumStages];
+    AllocMeter meter;
+    AllocCounts allocated[NumStages];
+  };
+
+  class SlowLog {
+    // writes requests that took longer than a threshold to a file
+    // configured by the global settings:
+    //   slowlog=<file>        where to log (no file: no slow log)
+    //   slowlog_ms=<ms>       the threshold, on the time spent parsing,
+    //                         queueing, classifying and writing (def. 100)
+    //   slowlog_rate=<num>    max. entries per second (default 10). The
+    //                         number of entries dropped is logged too
+  public:
+    explicit SlowLog( const TiCC::Configuration * );
+    bool enabled() const { return threshold >= 0; };
+    bool is_slow( const StageTimer& t ) const {
+      return enabled() && t.service_ms() >= threshold;
+    };
+    void check( const std::string&,
+		const std::string&,
+		const std::string&,
+		const std::string&,
+		const StageTimer& );
+  private:
+    double threshold;
+    double rate;
+    double tokens;
+    unsigned long suppressed;
+    std::chrono::steady_clock::time_point last_fill;
+    std::ofstream log_file;
+    std::mutex mtx;
+  };
+
+}
+#endif // SLOWLOG_H
@@ -29,56 +29,224 @@
 #ifndef TIMBLSERVER_H
 #define TIMBLSERVER_H
 
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "timbl/TimblAPI.h"
 #include "ticcutils/LogStream.h"
 #include "ticcutils/SocketBasics.h"
 #include "ticcutils/json.hpp"
+#include "timblserver/Affinity.h"
+#include "timblserver/Scheduler.h"
+#include "timblserver/Vocabulary.h"
+#include "timblserver/SlowLog.h"
+#include "timblserver/Capture.h"
+#include "timblserver/AsyncLog.h"
+#include "timblserver/Learner.h"
+#include "timblserver/Session.h"
+#include "timblserver/Fallback.h"
+#include "timblserver/Batcher.h"
+#include "timblserver/PerfCounters.h"
+#include "timblserver/Profiler.h"
 
 namespace TimblServer {
 
   class TimblThread {
   public:
-    TimblThread( Timbl::TimblExperiment *,
+    TimblThread( const std::shared_ptr<Timbl::TimblExperiment>&,
 		 TiCCServer::childArgs *,
 		 bool = false );
     ~TimblThread(){ delete _exp; };
     bool setOptions( const std::string& param );
+    void refresh( const std::shared_ptr<Timbl::TimblExperiment>& );
+    // the name of the base; _exp is renamed after the connection
+    const std::string& base() const { return source->ExpName(); };
     Timbl::TimblExperiment *_exp;
+    std::string options; // the options set by this client, each once
     TiCC::LogStream& myLog;
     bool doDebug;
     std::ostream& os;
     std::istream& is;
+  private:
+    void attach( const std::shared_ptr<Timbl::TimblExperiment>& );
+    std::shared_ptr<Timbl::TimblExperiment> source; // what _exp is a clone of
+    // per option the last value set, in the order they were first set
+    std::vector<std::pair<std::string,std::string>> option_set;
+    bool json;
+    int sock_id;
+  };
+
+  class ServerCommon {
+    // the experiments and the bookkeeping shared by all protocols
+  public:
+    explicit ServerCommon( const TiCC::Configuration *c ):
+      affinity( c ), scheduler( c ), slowlog( c ), capture( c ),
+      async_log( c ), learner( c ), sessions( c ), fallbacks( c ),
+      batcher( c ), perf( c ), profiler( c ), ready( false ){};
+    std::shared_ptr<Timbl::TimblExperiment>
+      find_experiment( const std::string&, int = 0 ) const;
+    void refresh( TimblThread *, const std::string& ) const;
+    void load_vocabularies( const TiCC::Configuration *, TiCC::LogStream& );
+    const Vocabulary *find_vocabulary( const std::string& ) const;
+    void warm_up( const TiCC::Configuration *, TiCC::LogStream& );
+    void set_ready( bool b ) { ready = b; };
+    bool is_ready() const { return ready; };
+    nlohmann::json health_to_json() const;
+    nlohmann::json stats_to_json() const;
+    bool profile_request( const std::string&,
+			  TiCC::LogStream&,
+			  nlohmann::json& );
+    std::map<std::string, Timbl::TimblExperiment*> experiments;
+    // per base a copy of the experiment for every NUMA node
+    std::map<std::string, std::vector<Timbl::TimblExperiment*>> replicas;
+    Affinity affinity;
+    Scheduler scheduler;
+    SlowLog slowlog;
+    Capture capture;
+    AsyncLog async_log;
+    Learner learner;
+    SessionLimits sessions;
+    Fallbacks fallbacks;
+    Batcher batcher;
+    PerfCounters perf;
+    Profiler profiler;
+  private:
+    std::map<std::string, Vocabulary> vocabularies;
+    std::atomic<bool> ready;
+    nlohmann::json warmup_info;
   };
 
-  class TcpServer : public TiCCServer::TcpServerBase {
+  class FanOut {
+    // classifies an instance with several bases at once, each in a thread
+    // of its own. Belongs to one connection, and keeps a clone of every
+    // base it used for the life of that connection
+  public:
+    FanOut( ServerCommon *, TiCCServer::childArgs *,
+	    int, const std::string&, bool = false );
+    ~FanOut();
+    void release();
+    bool parse_bases( const std::string&,
+		      std::vector<std::string>&,
+		      std::string& ) const;
+    std::vector<std::string> run( const std::vector<std::string>&,
+				  const std::string&,
+				  const std::function<void(size_t,
+							   TimblThread*)>& );
+    TimblThread *client( const std::string&,
+			 const std::string&,
+			 std::string& );
+  private:
+    bool prepare( const std::string&,
+		  TimblThread*&,
+		  const std::string&,
+		  std::string& ) const;
+    FanOut( const FanOut& ) = delete;
+    FanOut& operator=( const FanOut& ) = delete;
+    ServerCommon *server;
+    TiCCServer::childArgs *args;
+    int node;
+    std::string client_class;
+    bool json;
+    std::map<std::string,TimblThread*> clients;
+  };
+
+  class Multiplexer {
+    // runs the requests of one connection which carry an id on a few
+    // workers of its own, so a slow request doesn't hold up the ones
+    // behind it. Each worker has its own clones. At most
+    // 'session_concurrency' requests are in flight; submit() waits for
+    // a free place. The answers are written in the order they are ready,
+    // so everything else written to the connection must go through write()
+  public:
+    typedef std::function<void( FanOut& )> Job;
+    Multiplexer( ServerCommon *, TiCCServer::childArgs *,
+		 int, const std::string&, bool, std::ostream& );
+    ~Multiplexer();
+    void submit( const Job& );
+    void write( const std::string& );
+    void drain();
+    void release();
+  private:
+    Multiplexer( const Multiplexer& ) = delete;
+    Multiplexer& operator=( const Multiplexer& ) = delete;
+    void worker();
+    ServerCommon *server;
+    TiCCServer::childArgs *args;
+    int node;
+    std::string client_class;
+    bool json;
+    std::ostream& os;
+    size_t max_in_flight;
+    size_t in_flight; // queued or running
+    size_t idle;      // workers waiting for a job
+    std::deque<Job> queue;
+    std::vector<std::thread> workers;
+    bool stopping;
+    std::mutex mtx;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    std::mutex write_mtx;
+  };
+
+  class TcpServer : public TiCCServer::TcpServerBase, public ServerCommon {
   public:
     explicit TcpServer( const TiCC::Configuration *c ):
-      TcpServerBase( c, &experiments ){};
+      TcpServerBase( c, &experiments ), ServerCommon( c ){};
     void callback( TiCCServer::childArgs* );
-    bool classifyLine( TimblThread *, const std::string& ) const;
-  private:
-    std::map<std::string, Timbl::TimblExperiment*> experiments;
+    bool classifyLine( TimblThread *, const std::string&,
+		       StageTimer * = 0, std::ostream * = 0,
+		       const std::string& = "" ) const;
+    bool classifyBatched( const std::string&,
+			  const std::string&,
+			  const std::string&,
+			  std::ostream&,
+			  const std::string& );
+    bool classifyTagged( FanOut&,
+			 const std::string&,
+			 const std::string&,
+			 const std::string&,
+			 const std::string&,
+			 std::ostream&,
+			 StageTimer& );
+    bool decode_instance( const std::string&,
+			  std::string&,
+			  std::string& ) const;
   };
 
-  class HttpServer : public TiCCServer::HttpServerBase {
+  class HttpServer : public TiCCServer::HttpServerBase, public ServerCommon {
   public:
     explicit HttpServer( const TiCC::Configuration *c ):
-      HttpServerBase( c, &experiments ){};
+      HttpServerBase( c, &experiments ), ServerCommon( c ){};
     void callback( TiCCServer::childArgs* );
-  private:
-    std::map<std::string, Timbl::TimblExperiment*> experiments;
+    size_t fan_out_request( TiCCServer::childArgs *,
+			    const std::string&,
+			    const std::string&,
+			    const std::string&,
+			    int,
+			    const std::string&,
+			    StageTimer& );
   };
 
-  class JsonServer : public TiCCServer::TcpServerBase {
+  class JsonServer : public TiCCServer::TcpServerBase, public ServerCommon {
   public:
     explicit JsonServer( const TiCC::Configuration *c ):
-      TcpServerBase( c, &experiments ){};
+      TcpServerBase( c, &experiments ), ServerCommon( c ){};
     void callback( TiCCServer::childArgs* );
-    bool read_json( std::istream&, nlohmann::json& );
+    void serve( TiCCServer::childArgs*, std::istream&, std::ostream& );
+    void shm_callback( TiCCServer::childArgs* );
+    bool read_json( std::istream&, nlohmann::json&, StageTimer * = 0 );
     nlohmann::json classify_to_json( TimblThread *,
 				     const std::vector<std::string>& ) const;
-  private:
-    std::map<std::string, Timbl::TimblExperiment*> experiments;
+    nlohmann::json classify_tagged( FanOut&,
+				    const std::string&,
+				    const std::string&,
+				    const std::string&,
+				    const std::vector<std::string>&,
+				    StageTimer& );
   };
 
   std::string Version();
@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#ifndef UNIXSOCKET_H
+#define UNIXSOCKET_H
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include "ticcutils/SocketBasics.h"
+
+namespace TiCCServer {
+  class ServerBase;
+  class childArgs;
+}
+
+namespace TimblServer {
+
+  class UnixServerSocket : public Sockets::ServerSocket {
+    // wraps an accepted Unix domain connection, so it can be handed to
+    // the protocol callbacks like a TCP connection
+  public:
+    explicit UnixServerSocket( int );
+  };
+
+  class UnixClientSocket : public Sockets::ClientSocket {
+    // a ClientSocket which can also connect to a Unix domain socket
+  public:
+    bool connect_path( const std::string& );
+  };
+
+  class UnixListener {
+    // accepts connections on a Unix domain socket and runs the callback
+    // of the server on them (or another handler), each in a thread of
+    // its own
+  public:
+    UnixListener( TiCCServer::ServerBase *, const std::string&,
+		  const std::function<void(TiCCServer::childArgs*)>& = 0 );
+    ~UnixListener();
+    bool open();
+    void start();
+    void run();
+    const std::string& getMessage() const { return mess; };
+  private:
+    TiCCServer::ServerBase *server;
+    std::function<void(TiCCServer::childArgs*)> handler;
+    std::string path;
+    std::string mess;
+    int sock;
+    unsigned int maxconn;
+    std::atomic<unsigned int> connections;
+  };
+
+}
+#endif // UNIXSOCKET_H
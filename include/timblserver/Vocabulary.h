@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include <string>
+#include <vector>
+#include "ticcutils/json.hpp"
+
+namespace TimblServer {
+
+  class Vocabulary {
+    // the values of every feature in a datafile, numbered in order of
+    // appearance. Clients can fetch it and send instances as codes.
+    // Only C4.5 (comma separated) and Columns/Tabbed data are supported
+  public:
+    Vocabulary(): separator(','){};
+    bool fill( const std::string&, std::string& );
+    const std::string& version() const { return _version; };
+    size_t num_features() const { return values.size(); };
+    bool decode( const nlohmann::json&, std::string&, std::string& ) const;
+    bool decode( const std::vector<std::string>&,
+		 std::string&, std::string& ) const;
+    nlohmann::json to_json() const;
+  private:
+    void add_value( size_t, const std::string&, std::string& ) const;
+    char separator;
+    std::string _version;
+    std::vector<std::vector<std::string>> values;
+  };
+
+}
+#endif // VOCABULARY_H
@@ -0,0 +1,351 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Affinity.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  vector<int> parse_cpulist( const string& value ){
+    // parse a list like "0-3,8,10-11" as used in /sys and by taskset
+    vector<int> result;
+    vector<string> parts = TiCC::split_at( TiCC::trim(value), "," );
+    for ( const auto& part : parts ){
+      vector<string> range = TiCC::split_at( part, "-" );
+      int first = 0;
+      int last = 0;
+      if ( range.size() == 1 ){
+	if ( !TiCC::stringTo( range[0], first ) ){
+	  return vector<int>();
+	}
+	last = first;
+      }
+      else if ( range.size() == 2 ){
+	if ( !TiCC::stringTo( range[0], first )
+	     || !TiCC::stringTo( range[1], last ) ){
+	  return vector<int>();
+	}
+      }
+      else {
+	return vector<int>();
+      }
+      if ( first < 0 || last < first || last >= CPU_SETSIZE ){
+	return vector<int>();
+      }
+      for ( int cpu = first; cpu <= last; ++cpu ){
+	result.push_back( cpu );
+      }
+    }
+    return result;
+  }
+
+  string cpulist_to_string( const vector<int>& cpus ){
+    string result;
+    size_t i = 0;
+    while ( i < cpus.size() ){
+      size_t j = i;
+      while ( j+1 < cpus.size() && cpus[j+1] == cpus[j]+1 ){
+	++j;
+      }
+      if ( !result.empty() ){
+	result += ",";
+      }
+      result += to_string( cpus[i] );
+      if ( j > i ){
+	result += "-" + to_string( cpus[j] );
+      }
+      i = j+1;
+    }
+    return result;
+  }
+
+  static vector<int> intersect( const vector<int>& l1,
+				const vector<int>& l2 ){
+    vector<int> result;
+    for ( const auto cpu : l1 ){
+      for ( const auto other : l2 ){
+	if ( cpu == other ){
+	  result.push_back( cpu );
+	  break;
+	}
+      }
+    }
+    return result;
+  }
+
+  static vector<int> allowed_cpus(){
+    // the CPUs the process may use: those of the main thread, as the
+    // caller may be pinned already
+    vector<int> result;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if ( sched_getaffinity( getpid(), sizeof(set), &set ) == 0 ){
+      for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ){
+	if ( CPU_ISSET( cpu, &set ) ){
+	  result.push_back( cpu );
+	}
+      }
+    }
+    return result;
+  }
+
+  // the placement of the connection of the calling thread, restored when
+  // it switches to a base without an [[affinity]] entry
+  struct Placement {
+    bool saved = false;
+    bool narrowed = false;
+    cpu_set_t set;
+  };
+  static thread_local Placement placement;
+
+  Affinity::Affinity( const TiCC::Configuration *config ):
+    _numa(false),
+    _replicate(false),
+    spread(false),
+    next_node(0),
+    next_cpu(0)
+  {
+    string value = config->lookUp( "cpus" );
+    if ( !value.empty() ){
+      cpus = parse_cpulist( value );
+      if ( cpus.empty() ){
+	throw runtime_error( "invalid value for 'cpus': " + value );
+      }
+    }
+    value = config->lookUp( "pinning" );
+    if ( value == "spread" ){
+      spread = true;
+    }
+    else if ( !value.empty() && value != "none" ){
+      throw runtime_error( "invalid value for 'pinning': " + value
+			   + " (use none or spread)" );
+    }
+    value = config->lookUp( "numa" );
+    if ( value == "replicate" ){
+      _numa = true;
+      _replicate = true;
+    }
+    else if ( value == "yes" || value == "true" ){
+      _numa = true;
+    }
+    else if ( !value.empty() && value != "no" && value != "false" ){
+      throw runtime_error( "invalid value for 'numa': " + value
+			   + " (use no, yes or replicate)" );
+    }
+    if ( _numa ){
+      for ( int node = 0; node < CPU_SETSIZE; ++node ){
+	ifstream is( "/sys/devices/system/node/node" + to_string( node )
+		     + "/cpulist" );
+	if ( !is ){
+	  break;
+	}
+	string line;
+	getline( is, line );
+	vector<int> list = parse_cpulist( line );
+	if ( !cpus.empty() ){
+	  list = intersect( list, cpus );
+	}
+	if ( !list.empty() ){
+	  node_cpus.push_back( list );
+	  node_ids.push_back( node );
+	}
+      }
+      if ( node_cpus.size() < 2 ){
+	// no (usable) NUMA topology, e.g. inside a container
+	_numa = false;
+	_replicate = false;
+	node_cpus.clear();
+	node_ids.clear();
+      }
+    }
+    if ( node_cpus.empty() ){
+      node_cpus.push_back( cpus );
+      node_ids.push_back( 0 );
+    }
+    if ( config->hasSection( "affinity" ) ){
+      for ( const auto& it : config->lookUpAll( "affinity" ) ){
+	vector<int> list = parse_cpulist( it.second );
+	if ( list.empty() ){
+	  throw runtime_error( "invalid cpu list for base '" + it.first
+			       + "' in [[affinity]]: " + it.second );
+	}
+	exp_cpus[it.first] = list;
+      }
+    }
+    vector<node_stats> tmp( node_cpus.size() );
+    counters.swap( tmp );
+  }
+
+  bool Affinity::bind( const vector<int>& cpu_list ) const {
+    vector<int> list = cpu_list;
+    if ( list.empty() ){
+      if ( !spread ){
+	// nothing to narrow down to
+	return true;
+      }
+      // no cpus= given: spread over all CPUs we may use
+      list = allowed_cpus();
+      if ( list.empty() ){
+	return false;
+      }
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if ( spread ){
+      CPU_SET( list[next_cpu++ % list.size()], &set );
+    }
+    else {
+      for ( const auto cpu : list ){
+	CPU_SET( cpu, &set );
+      }
+    }
+    return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+  }
+
+  bool Affinity::bind_to_node( size_t node ) const {
+    // bind the calling thread to all CPUs of a node. Used for loading
+    // replicas, so the first-touch policy places them on that node
+    if ( node >= node_cpus.size() || node_cpus[node].empty() ){
+      return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for ( const auto cpu : node_cpus[node] ){
+      CPU_SET( cpu, &set );
+    }
+    return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+  }
+
+  bool Affinity::pin_to_cpu( size_t index ) const {
+    // pin the calling thread to one CPU: number 'index' (modulo) of the
+    // CPUs we may use. Used for threads which serve all connections
+    vector<int> list = cpus;
+    if ( list.empty() ){
+      list = allowed_cpus();
+    }
+    if ( list.empty() ){
+      return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( list[index % list.size()], &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+  }
+
+  int Affinity::bind_connection(){
+    // place a new connection thread. returns the index of the node
+    // the thread is bound to (always 0 when NUMA placement is off)
+    int node = 0;
+    if ( node_cpus.size() > 1 ){
+      node = next_node++ % node_cpus.size();
+    }
+    bind( node_cpus[node] );
+    placement.narrowed = false;
+    placement.saved = pthread_getaffinity_np( pthread_self(),
+					      sizeof(placement.set),
+					      &placement.set ) == 0;
+    ++counters[node].connections;
+    return node;
+  }
+
+  bool Affinity::bind_experiment( const string& name, int node ){
+    // narrow the calling thread down to the CPUs configured for 'name'
+    // within its node. A base without them gets the CPUs of the
+    // connection back. Call it before cloning the base, so the clone is
+    // allocated where it will be used
+    auto it = exp_cpus.find( name );
+    if ( it == exp_cpus.end() ){
+      if ( !placement.narrowed ){
+	return true;
+      }
+      placement.narrowed = false;
+      if ( placement.saved ){
+	return pthread_setaffinity_np( pthread_self(),
+				       sizeof(placement.set),
+				       &placement.set ) == 0;
+      }
+      if ( node >= 0 && size_t(node) < node_cpus.size()
+	   && !node_cpus[node].empty() ){
+	return bind_to_node( node );
+      }
+      vector<int> all = allowed_cpus();
+      cpu_set_t set;
+      CPU_ZERO( &set );
+      for ( const auto cpu : all ){
+	CPU_SET( cpu, &set );
+      }
+      return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+    }
+    placement.narrowed = true;
+    vector<int> list = it->second;
+    if ( _numa ){
+      vector<int> on_node = intersect( list, node_cpus[node] );
+      if ( !on_node.empty() ){
+	list = on_node;
+      }
+    }
+    return bind( list );
+  }
+
+  void Affinity::count( int node, size_t instances ){
+    if ( node >= 0 && (size_t)node < counters.size() ){
+      counters[node].instances += instances;
+    }
+  }
+
+  json Affinity::stats() const {
+    json result;
+    result["numa"] = _numa;
+    result["replicate"] = _replicate;
+    result["pinning"] = spread?"spread":"none";
+    json arr = json::array();
+    for ( size_t i=0; i < node_cpus.size(); ++i ){
+      json node;
+      node["node"] = node_ids[i];
+      node["cpus"] = cpulist_to_string( node_cpus[i] );
+      node["connections"] = counters[i].connections.load();
+      node["instances"] = counters[i].instances.load();
+      arr.push_back( node );
+    }
+    result["nodes"] = arr;
+    return result;
+  }
+
+}
@@ -0,0 +1,152 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+// replaces operator new and delete, to count the allocations of the
+// server. Only linked into timblserver when configured with
+// --enable-alloc-stats
+
+#include <new>
+#include <cstdlib>
+#include <malloc.h>
+
+#include "timblserver/AllocTracker.h"
+
+using TimblServer::AllocTracker;
+
+static const bool hooked = ( AllocTracker::set_active(), true );
+
+static void *allocate( size_t size, size_t alignment = 0 ){
+  // as the standard operator new: on failure, call the new_handler and
+  // try again, or throw bad_alloc when there is none
+  if ( size == 0 ){
+    size = 1;
+  }
+  while ( true ){
+    void *p = 0;
+    if ( alignment == 0 ){
+      p = malloc( size );
+    }
+    else if ( posix_memalign( &p, alignment, size ) != 0 ){
+      p = 0;
+    }
+    if ( p ){
+      AllocTracker::note_alloc( malloc_usable_size( p ) );
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if ( !handler ){
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *operator new( size_t size ){
+  return allocate( size );
+}
+
+void *operator new[]( size_t size ){
+  return allocate( size );
+}
+
+void *operator new( size_t size, const std::nothrow_t& ) noexcept {
+  try {
+    return allocate( size );
+  }
+  catch ( ... ){
+    return 0;
+  }
+}
+
+void *operator new[]( size_t size, const std::nothrow_t& nt ) noexcept {
+  return operator new( size, nt );
+}
+
+void *operator new( size_t size, std::align_val_t al ){
+  return allocate( size, static_cast<size_t>( al ) );
+}
+
+void *operator new[]( size_t size, std::align_val_t al ){
+  return allocate( size, static_cast<size_t>( al ) );
+}
+
+void *operator new( size_t size,
+		    std::align_val_t al,
+		    const std::nothrow_t& ) noexcept {
+  try {
+    return allocate( size, static_cast<size_t>( al ) );
+  }
+  catch ( ... ){
+    return 0;
+  }
+}
+
+void *operator new[]( size_t size,
+		      std::align_val_t al,
+		      const std::nothrow_t& nt ) noexcept {
+  return operator new( size, al, nt );
+}
+
+void operator delete( void *p ) noexcept {
+  if ( p ){
+    AllocTracker::note_free( malloc_usable_size( p ) );
+    free( p );
+  }
+}
+
+void operator delete[]( void *p ) noexcept {
+  operator delete( p );
+}
+
+void operator delete( void *p, size_t ) noexcept {
+  operator delete( p );
+}
+
+void operator delete[]( void *p, size_t ) noexcept {
+  operator delete( p );
+}
+
+// posix_memalign memory is freed by free() too
+
+void operator delete( void *p, std::align_val_t ) noexcept {
+  operator delete( p );
+}
+
+void operator delete[]( void *p, std::align_val_t ) noexcept {
+  operator delete( p );
+}
+
+void operator delete( void *p, size_t, std::align_val_t ) noexcept {
+  operator delete( p );
+}
+
+void operator delete[]( void *p, size_t, std::align_val_t ) noexcept {
+  operator delete( p );
+}
@@ -0,0 +1,253 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+#include "timblserver/SlowLog.h"
+#include "timblserver/AllocTracker.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  static_assert( AllocTotals::NumPhases == 1 + StageTimer::NumStages,
+		 "a phase for the setup and every stage" );
+
+  struct ThreadCounts {
+    unsigned long allocs;
+    unsigned long frees;
+    uint64_t bytes;
+    uint64_t freed;
+    int64_t live;
+    int64_t peak;
+    // booked by an AllocScope, so no AllocMeter counts them again
+    unsigned long claimed_allocs;
+    unsigned long claimed_frees;
+    uint64_t claimed_bytes;
+    uint64_t claimed_freed;
+  };
+
+  // initial-exec TLS is never allocated lazily, so operator new may use it
+  static thread_local ThreadCounts counts
+  __attribute__((tls_model("initial-exec")));
+  static thread_local AllocConnection *connection
+  __attribute__((tls_model("initial-exec"))) = 0;
+
+  bool AllocTracker::hooked = false;
+
+  static mutex totals_mutex;
+  static map<string,AllocTotals> totals; // per protocol+TAB+base
+
+  void AllocCounts::add( const AllocCounts& other ){
+    allocs += other.allocs;
+    frees += other.frees;
+    bytes += other.bytes;
+    freed += other.freed;
+    peak = max( peak, other.peak );
+  }
+
+  json AllocCounts::to_json() const {
+    json result;
+    result["allocs"] = allocs;
+    result["frees"] = frees;
+    result["bytes"] = bytes;
+    result["freed_bytes"] = freed;
+    result["peak_bytes"] = peak;
+    return result;
+  }
+
+  const char *AllocTotals::phase_name( int p ){
+    static const char *names[] = { "setup", "read", "parse", "queue",
+				   "classify", "write" };
+    return names[p];
+  }
+
+  void AllocTotals::clear(){
+    requests = 0;
+    for ( auto& p : phases ){
+      p.clear();
+    }
+  }
+
+  json AllocTotals::to_json() const {
+    json result;
+    result["requests"] = requests;
+    unsigned long allocs = 0;
+    json list;
+    for ( int p=0; p < NumPhases; ++p ){
+      list[phase_name( p )] = phases[p].to_json();
+      if ( p > 0 ){
+	allocs += phases[p].allocs;
+      }
+    }
+    result["phases"] = list;
+    if ( requests > 0 ){
+      result["allocs_per_request"] = double(allocs) / requests;
+    }
+    return result;
+  }
+
+  void AllocMeter::restart(){
+    // the peak is restarted too: meters that overlap in time see the
+    // peak since the most recent start of any of them
+    allocs = counts.allocs - counts.claimed_allocs;
+    frees = counts.frees - counts.claimed_frees;
+    bytes = counts.bytes - counts.claimed_bytes;
+    freed = counts.freed - counts.claimed_freed;
+    live = counts.live;
+    counts.peak = counts.live;
+  }
+
+  AllocCounts AllocMeter::lap(){
+    AllocCounts result;
+    result.allocs = counts.allocs - counts.claimed_allocs - allocs;
+    result.frees = counts.frees - counts.claimed_frees - frees;
+    result.bytes = counts.bytes - counts.claimed_bytes - bytes;
+    result.freed = counts.freed - counts.claimed_freed - freed;
+    result.peak = max( int64_t(0), counts.peak - live );
+    restart();
+    return result;
+  }
+
+  void AllocTracker::note_alloc( size_t size ){
+    // called for every allocation: keep it short
+    ++counts.allocs;
+    counts.bytes += size;
+    counts.live += size;
+    if ( counts.live > counts.peak ){
+      counts.peak = counts.live;
+    }
+  }
+
+  void AllocTracker::note_free( size_t size ){
+    ++counts.frees;
+    counts.freed += size;
+    counts.live -= size;
+  }
+
+  static void book( const string& protocol,
+		    const string& base,
+		    const AllocTotals& t ){
+    lock_guard<mutex> lock( totals_mutex );
+    auto it = totals.find( protocol + "\t" + base );
+    if ( it == totals.end() ){
+      it = totals.insert( make_pair( protocol + "\t" + base,
+				     AllocTotals() ) ).first;
+      it->second.clear();
+    }
+    it->second.requests += t.requests;
+    for ( int p=0; p < AllocTotals::NumPhases; ++p ){
+      it->second.phases[p].add( t.phases[p] );
+    }
+  }
+
+  void AllocTracker::record( const string& protocol,
+			     const string& base,
+			     const StageTimer& timer ){
+    // book the allocations of a finished request
+    if ( !active() ){
+      return;
+    }
+    AllocTotals t;
+    t.clear();
+    t.requests = 1;
+    for ( int s=0; s < StageTimer::NumStages; ++s ){
+      t.phases[1+s] = timer.allocs( StageTimer::Stage(s) );
+    }
+    book( protocol, base, t );
+    if ( connection ){
+      connection->totals.requests += 1;
+      for ( int p=1; p < AllocTotals::NumPhases; ++p ){
+	connection->totals.phases[p].add( t.phases[p] );
+      }
+    }
+  }
+
+  json AllocTracker::stats(){
+    json result = json::object();
+    lock_guard<mutex> lock( totals_mutex );
+    for ( const auto& it : totals ){
+      string::size_type pos = it.first.find( "\t" );
+      result[it.first.substr( 0, pos )][it.first.substr( pos+1 )]
+	= it.second.to_json();
+    }
+    return result;
+  }
+
+  AllocScope::AllocScope( const string& n ):
+    name( n )
+  {
+    meter.restart();
+  }
+
+  AllocScope::~AllocScope(){
+    if ( !AllocTracker::active() ){
+      return;
+    }
+    AllocCounts c = meter.lap();
+    counts.claimed_allocs += c.allocs;
+    counts.claimed_frees += c.frees;
+    counts.claimed_bytes += c.bytes;
+    counts.claimed_freed += c.freed;
+    AllocTotals t;
+    t.clear();
+    t.phases[0] = c;
+    if ( connection ){
+      connection->totals.phases[0].add( c );
+    }
+    book( connection ? connection->protocol : "-", name, t );
+  }
+
+  AllocConnection::AllocConnection( const char *p,
+				    int i,
+				    TiCC::LogStream& l ):
+    protocol( p ),
+    id( i ),
+    log( l ),
+    prev( connection )
+  {
+    totals.clear();
+    connection = this;
+  }
+
+  AllocConnection::~AllocConnection(){
+    connection = prev;
+    if ( AllocTracker::active()
+	 && ( totals.requests > 0 || totals.phases[0].allocs > 0 ) ){
+      log << protocol << " connection " << id << " allocations: "
+	  << totals.to_json().dump() << endl;
+    }
+  }
+
+}
@@ -0,0 +1,249 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/AsyncLog.h"
+
+using namespace std;
+
+namespace TimblServer {
+
+  struct RingHandle {
+    // the ring of the current thread. When the thread ends, the ring is
+    // marked, and the writer recycles it once it is empty
+    const void *owner = 0;
+    void *ring = 0;
+    atomic<bool> *retired = 0;
+    ~RingHandle(){
+      if ( retired ){
+	retired->store( true, memory_order_release );
+      }
+    }
+  };
+
+  static thread_local RingHandle my_handle;
+
+  AsyncLog::AsyncLog( const TiCC::Configuration *config ):
+    wanted(false),
+    ring_size(64*1024),
+    target(0),
+    stopping(false)
+  {
+    string value = config->lookUp( "asynclog" );
+    if ( value.empty() ){
+      return;
+    }
+    value = TiCC::lowercase( value );
+    if ( value == "yes" || value == "true" ){
+      wanted = true;
+    }
+    else if ( value != "no" && value != "false" ){
+      throw runtime_error( "invalid value for 'asynclog': " + value );
+    }
+    value = config->lookUp( "asynclog_buffer" );
+    if ( !value.empty() ){
+      size_t kb = 0;
+      if ( !TiCC::stringTo( value, kb ) || kb == 0 ){
+	throw runtime_error( "invalid value for 'asynclog_buffer': "
+			     + value );
+      }
+      ring_size = kb * 1024;
+    }
+  }
+
+  AsyncLog::~AsyncLog(){
+    if ( writer_thread.joinable() ){
+      stopping = true;
+      cv.notify_all();
+      writer_thread.join();
+    }
+    for ( const auto r : rings ){
+      if ( r->retired ){
+	delete r;
+      }
+      // rings of threads still running are leaked on purpose: their
+      // handles still point at them
+    }
+    for ( const auto r : spare ){
+      delete r;
+    }
+  }
+
+  void AsyncLog::start( TiCC::LogStream& ls ){
+    // the writer thread itself is started by the first line logged. By
+    // then the server has daemonized, and a thread started before the
+    // fork would be lost
+    if ( wanted ){
+      target = &ls;
+    }
+  }
+
+  AsyncLog::Ring *AsyncLog::my_ring() const {
+    if ( my_handle.owner == this ){
+      return static_cast<Ring*>( my_handle.ring );
+    }
+    lock_guard<mutex> lock( mtx );
+    Ring *r;
+    if ( spare.empty() ){
+      r = new Ring( ring_size );
+    }
+    else {
+      r = spare.back();
+      spare.pop_back();
+    }
+    rings.push_back( r );
+    my_handle.owner = this;
+    my_handle.ring = r;
+    my_handle.retired = &r->retired;
+    if ( !writer_thread.joinable() ){
+      AsyncLog *self = const_cast<AsyncLog*>( this );
+      writer_thread = thread( &AsyncLog::writer, self );
+    }
+    return r;
+  }
+
+  void AsyncLog::push( const string& line ) const {
+    Ring *r = my_ring();
+    size_t size = r->data.size();
+    size_t head = r->head.load( memory_order_relaxed );
+    size_t tail = r->tail.load( memory_order_acquire );
+    if ( line.size() > size - ( head - tail ) ){
+      r->dropped.fetch_add( 1, memory_order_relaxed );
+      return;
+    }
+    size_t pos = head % size;
+    size_t first = min( line.size(), size - pos );
+    memcpy( &r->data[pos], line.data(), first );
+    memcpy( &r->data[0], line.data() + first, line.size() - first );
+    r->head.store( head + line.size(), memory_order_release );
+  }
+
+  void AsyncLog::drain(){
+    string text;
+    unsigned long dropped = 0;
+    {
+      lock_guard<mutex> lock( mtx );
+      auto it = rings.begin();
+      while ( it != rings.end() ){
+	Ring *r = *it;
+	// check 'retired' first: if it is set, no more lines will follow
+	bool done = r->retired.load( memory_order_acquire );
+	size_t size = r->data.size();
+	size_t head = r->head.load( memory_order_acquire );
+	size_t tail = r->tail.load( memory_order_relaxed );
+	while ( tail < head ){
+	  size_t pos = tail % size;
+	  size_t len = min( head - tail, size - pos );
+	  text.append( &r->data[pos], len );
+	  tail += len;
+	}
+	r->tail.store( tail, memory_order_release );
+	dropped += r->dropped.exchange( 0, memory_order_relaxed );
+	if ( done ){
+	  r->head = 0;
+	  r->tail = 0;
+	  r->retired = false;
+	  spare.push_back( r );
+	  it = rings.erase( it );
+	}
+	else {
+	  ++it;
+	}
+      }
+    }
+    if ( text.empty() && dropped == 0 ){
+      return;
+    }
+    TiCC::Log log( *target );
+    *log << text;
+    if ( dropped > 0 ){
+      *log << "asynclog: " << dropped << " lines dropped, buffer full"
+	   << endl;
+    }
+    *log << flush;
+  }
+
+  void AsyncLog::writer(){
+    // the producers don't signal, they only store. Poll them
+    while ( !stopping ){
+      {
+	unique_lock<mutex> lock( mtx );
+	cv.wait_for( lock, chrono::milliseconds( 10 ) );
+      }
+      drain();
+    }
+    drain();
+  }
+
+  LogLine::LogLine( const AsyncLog& s,
+		    TiCC::LogStream& ls,
+		    bool debug ):
+    sink(s)
+  {
+    if ( !sink.enabled() ){
+      if ( debug ){
+	dbg.emplace( ls );
+      }
+      else {
+	log.emplace( ls );
+      }
+    }
+  }
+
+  LogLine::~LogLine(){
+    if ( sink.enabled() ){
+      string line = buffer.str();
+      if ( line.empty() ){
+	return;
+      }
+      if ( line.back() != '\n' ){
+	line += '\n';
+      }
+      sink.push( line );
+    }
+  }
+
+  ostream& LogLine::stream(){
+    if ( log ){
+      return **log;
+    }
+    if ( dbg ){
+      return **dbg;
+    }
+    return buffer;
+  }
+
+}
@@ -0,0 +1,301 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "ticcutils/StringOps.h"
+#include "timbl/TimblAPI.h"
+#include "timbl/GetOptClass.h"
+#include "timblserver/Batcher.h"
+
+using namespace std;
+using namespace Timbl;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  using Clock = chrono::steady_clock;
+
+  Batcher::Batcher( const TiCC::Configuration *config ):
+    wanted(false),
+    max_batch(16),
+    wait_us(500),
+    num_workers(0),
+    max_clones(8),
+    affinity(0),
+    stopping(false),
+    batches(0),
+    jobs(0),
+    largest(0),
+    total_wait_us(0),
+    max_wait_us(0)
+  {
+    string value = config->lookUp( "batching" );
+    if ( value.empty() ){
+      return;
+    }
+    value = TiCC::lowercase( value );
+    if ( value == "yes" || value == "true" ){
+      wanted = true;
+    }
+    else if ( value != "no" && value != "false" ){
+      throw runtime_error( "invalid value for 'batching': " + value );
+    }
+    value = config->lookUp( "batch_size" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, max_batch ) || max_batch == 0 ){
+	throw runtime_error( "invalid value for 'batch_size': " + value );
+      }
+    }
+    value = config->lookUp( "batch_wait" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, wait_us ) || wait_us < 0 ){
+	throw runtime_error( "invalid value for 'batch_wait': " + value );
+      }
+    }
+    value = config->lookUp( "batch_workers" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, num_workers ) || num_workers == 0 ){
+	throw runtime_error( "invalid value for 'batch_workers': " + value );
+      }
+    }
+    if ( num_workers == 0 ){
+      num_workers = max( 1u, thread::hardware_concurrency() );
+    }
+  }
+
+  Batcher::~Batcher(){
+    {
+      lock_guard<mutex> lock( mtx );
+      stopping = true;
+    }
+    cv.notify_all();
+    for ( auto& w : workers ){
+      w.join();
+    }
+  }
+
+  void Batcher::setup( const Lookup& l, const Affinity *a ){
+    // the workers are started by the first run(): threads started before
+    // the server forks would be lost
+    lookup = l;
+    affinity = a;
+  }
+
+  bool Batcher::run( const string& base,
+		     const string& options,
+		     const Work& work,
+		     string& error ){
+    // call work() with a clone of base with 'options' set, on one of
+    // the workers, and wait for it
+    Job job;
+    job.work = &work;
+    future<void> finished = job.finished.get_future();
+    {
+      lock_guard<mutex> lock( mtx );
+      if ( workers.empty() ){
+	for ( size_t i = 0; i < num_workers; ++i ){
+	  workers.push_back( thread( &Batcher::worker, this, i ) );
+	}
+      }
+      job.queued = Clock::now();
+      queues[base + "\t" + options].push_back( &job );
+    }
+    cv.notify_one();
+    finished.wait();
+    if ( !job.error.empty() ){
+      error = job.error;
+      return false;
+    }
+    return true;
+  }
+
+  TimblExperiment *Batcher::clone_for( map<string,Clone>& clones,
+				       const string& key,
+				       ostream& null_stream,
+				       string& error ){
+    // the clone of this worker for base+options 'key', made again when
+    // the base has a new version
+    string::size_type pos = key.find( '\t' );
+    string base = key.substr( 0, pos );
+    string options = key.substr( pos+1 );
+    shared_ptr<TimblExperiment> source = lookup( base );
+    if ( !source ){
+      error = "unknown base '" + base + "'";
+      return 0;
+    }
+    Clone& c = clones[key];
+    c.used = Clock::now();
+    if ( c.exp && c.source == source ){
+      return c.exp;
+    }
+    if ( !c.exp && clones.size() > max_clones ){
+      // every clone holds a copy of the settings and keeps its version
+      // of the base alive: drop the one used longest ago
+      auto oldest = clones.end();
+      for ( auto it = clones.begin(); it != clones.end(); ++it ){
+	if ( it->first != key
+	     && ( oldest == clones.end()
+		  || it->second.used < oldest->second.used ) ){
+	  oldest = it;
+	}
+      }
+      delete oldest->second.exp;
+      clones.erase( oldest );
+    }
+    delete c.exp;
+    c.exp = source->clone();
+    *c.exp = *source;
+    c.exp->connectToSocket( &null_stream );
+    if ( source->getOptParams() ){
+      c.exp->setOptParams( source->getOptParams()->Clone( &null_stream ) );
+    }
+    c.source = source;
+    if ( !options.empty()
+	 && !( c.exp->SetOptions( options ) && c.exp->ConfirmOptions() ) ){
+      error = "set options failed: " + options;
+      delete c.exp;
+      clones.erase( key );
+      return 0;
+    }
+    return c.exp;
+  }
+
+  void Batcher::worker( size_t index ){
+    if ( affinity ){
+      affinity->pin_to_cpu( index );
+    }
+    ostream null_stream( 0 );
+    map<string,Clone> clones;
+    unique_lock<mutex> lock( mtx );
+    while ( !stopping ){
+      // the queue with the oldest job
+      auto oldest = queues.end();
+      for ( auto it = queues.begin(); it != queues.end(); ++it ){
+	if ( !it->second.empty()
+	     && ( oldest == queues.end()
+		  || it->second.front()->queued
+		  < oldest->second.front()->queued ) ){
+	  oldest = it;
+	}
+      }
+      if ( oldest == queues.end() ){
+	cv.wait( lock );
+	continue;
+      }
+      Clock::time_point due = oldest->second.front()->queued
+	+ chrono::microseconds( wait_us );
+      Clock::time_point now = Clock::now();
+      if ( oldest->second.size() < max_batch && now < due ){
+	// wait a little for more of the same
+	cv.wait_until( lock, due );
+	continue;
+      }
+      string key = oldest->first;
+      deque<Job*>& queue = oldest->second;
+      size_t num = min( max_batch, queue.size() );
+      vector<Job*> batch( queue.begin(), queue.begin() + num );
+      queue.erase( queue.begin(), queue.begin() + num );
+      if ( queue.empty() ){
+	queues.erase( oldest );
+      }
+      ++batches;
+      jobs += num;
+      largest = max( largest, num );
+      size_t bucket = 0;
+      while ( (size_t(2) << bucket) <= num ){
+	++bucket;
+      }
+      if ( sizes.size() <= bucket ){
+	sizes.resize( bucket + 1, 0 );
+      }
+      ++sizes[bucket];
+      for ( const auto job : batch ){
+	double waited = chrono::duration<double,micro>( now - job->queued ).count();
+	total_wait_us += waited;
+	max_wait_us = max( max_wait_us, waited );
+      }
+      if ( !queues.empty() ){
+	// there is more for the other workers
+	cv.notify_one();
+      }
+      lock.unlock();
+      string error;
+      TimblExperiment *exp = clone_for( clones, key, null_stream, error );
+      for ( const auto job : batch ){
+	if ( exp ){
+	  try {
+	    (*job->work)( exp );
+	  }
+	  catch ( const exception& e ){
+	    job->error = e.what();
+	  }
+	}
+	else {
+	  job->error = error;
+	}
+	job->finished.set_value();
+      }
+      lock.lock();
+    }
+    for ( const auto& it : clones ){
+      delete it.second.exp;
+    }
+  }
+
+  json Batcher::stats() const {
+    json result;
+    lock_guard<mutex> lock( mtx );
+    result["workers"] = num_workers;
+    result["batch_size"] = max_batch;
+    result["batch_wait_us"] = wait_us;
+    result["batches"] = batches;
+    result["instances"] = jobs;
+    result["avg_batch"] = batches > 0 ? double(jobs) / batches : 0.0;
+    result["max_batch"] = largest;
+    result["avg_wait_us"] = jobs > 0 ? total_wait_us / jobs : 0.0;
+    result["max_wait_us"] = max_wait_us;
+    json histogram = json::object();
+    for ( size_t i=0; i < sizes.size(); ++i ){
+      size_t low = size_t(1) << i;
+      string label = to_string( low );
+      if ( low > 1 ){
+	label += "-" + to_string( 2*low - 1 );
+      }
+      histogram[label] = sizes[i];
+    }
+    result["batch_sizes"] = histogram;
+    return result;
+  }
+
+}
@@ -0,0 +1,117 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <stdexcept>
+#include <cmath>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Capture.h"
+
+using namespace std;
+
+namespace TimblServer {
+
+  Capture::Capture( const TiCC::Configuration *config ):
+    sample(0),
+    seen(0),
+    last_id(0)
+  {
+    string file_name = config->lookUp( "capture" );
+    if ( file_name.empty() ){
+      return;
+    }
+    sample = 1;
+    string value = config->lookUp( "capture_sample" );
+    if ( !value.empty()
+	 && ( !TiCC::stringTo( value, sample )
+	      || sample <= 0 || sample > 1 ) ){
+      throw runtime_error( "invalid value for 'capture_sample': " + value );
+    }
+    // the times and connection numbers start again with every run, so
+    // appending to the capture of an earlier run would mix them up
+    capture_file.open( file_name, ios::trunc );
+    if ( !capture_file ){
+      throw runtime_error( "unable to open capture file: " + file_name );
+    }
+    start = chrono::steady_clock::now();
+  }
+
+  unsigned long Capture::open( const string& protocol ){
+    // returns the id of the connection in the capture, or 0 when the
+    // connection isn't sampled
+    if ( !enabled() ){
+      return 0;
+    }
+    unsigned long id = 0;
+    {
+      lock_guard<mutex> lock( mtx );
+      // deterministic sampling: take a connection whenever the running
+      // total of 'sample' passes a whole number. This spreads the sampled
+      // connections evenly, which a random pick doesn't do for short runs
+      ++seen;
+      if ( floor( seen * sample ) == floor( (seen-1) * sample ) ){
+	return 0;
+      }
+      id = ++last_id;
+    }
+    write( id, 'O', protocol );
+    return id;
+  }
+
+  void Capture::record( unsigned long id, const string& request ){
+    if ( id == 0 ){
+      return;
+    }
+    write( id, 'R', request );
+  }
+
+  void Capture::close( unsigned long id ){
+    if ( id == 0 ){
+      return;
+    }
+    write( id, 'C', "" );
+    lock_guard<mutex> lock( mtx );
+    capture_file.flush();
+  }
+
+  void Capture::write( unsigned long id, char type, const string& data ){
+    auto now = chrono::steady_clock::now();
+    long long usec
+      = chrono::duration_cast<chrono::microseconds>( now - start ).count();
+    lock_guard<mutex> lock( mtx );
+    capture_file << usec << '\t' << id << '\t' << type;
+    if ( !data.empty() ){
+      capture_file << '\t' << data;
+    }
+    capture_file << '\n';
+  }
+
+}
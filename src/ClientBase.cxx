@@ -32,6 +32,7 @@
 #include <csignal>
 #include "ticcutils/StringOps.h"
 #include "timblserver/ClientBase.h"
+#include "timblserver/Protocol.h"
 
 using namespace std;
 
@@ -39,9 +40,6 @@ namespace TimblServer {
 
   const string TimblEntree = "Welcome to the Timbl server.";
 
-  enum code_t { UnknownCode, Result, Err, OK, Echo, Skip,
-		Neighbors, EndNeighbors, Status, EndStatus };
-
   ClientClass::ClientClass() {
     serverPort = -1;
   }
@@ -66,34 +64,53 @@ namespace TimblServer {
     return false;
   }
 
+  bool ClientClass::handshake(){
+    string line;
+    if ( client.read( line ) ){
+      //	cout << "read line " << line << endl;
+      if ( line == TimblEntree ){
+	client.setNonBlocking();
+	if ( client.read( line, 1 ) ){
+	  // see if the server spits out information about available bases
+	  // assume that these will come within a second
+	  //	    cout << "next line = " << line << endl;
+	  client.setBlocking();
+	  if ( extractBases( line ) )
+	    return true;
+	}
+	else {
+	  client.setBlocking();
+	  return true;
+	}
+      }
+    }
+    else {
+      cerr << client.getMessage() << endl;
+    }
+    return false;
+  }
+
   bool ClientClass::connect( const string& node,  const string& port ){
     cout << "Starting Client on node:" << node << ", port:"
 	 << port << endl;
     if ( client.connect( node, port) ){
       serverPort = TiCC::stringTo<int>( port );
       serverName = node;
-      string line;
-      if ( client.read( line ) ){
-	//	cout << "read line " << line << endl;
-	if ( line == TimblEntree ){
-	  client.setNonBlocking();
-	  if ( client.read( line, 1 ) ){
-	    // see if the server spits out information about available bases
-	    // assume that these will come within a second
-	    //	    cout << "next line = " << line << endl;
-	    client.setBlocking();
-	    if ( extractBases( line ) )
-	      return true;
-	  }
-	  else {
-	    client.setBlocking();
-	    return true;
-	  }
-	}
-      }
-      else {
-	cerr << client.getMessage() << endl;
-      }
+      return handshake();
+    }
+    else {
+      cerr << client.getMessage() << endl;
+    }
+    return false;
+  }
+
+  bool ClientClass::connect( const string& path ){
+    // connect to a server listening on a Unix domain socket
+    cout << "Starting Client on socket:" << path << endl;
+    if ( client.connect_path( path ) ){
+      serverPort = -1;
+      serverName = path;
+      return handshake();
     }
     else {
       cerr << client.getMessage() << endl;
@@ -125,119 +142,52 @@ namespace TimblServer {
     return false;
   }
 
-  code_t toCode( const string& command ){
-    string com = TiCC::uppercase( command );
-    code_t result = UnknownCode;
-    if ( com == "CATEGORY" )
-      result = Result;
-    else if ( com == "ERROR" )
-      result = Err;
-    else if ( com == "OK" )
-      result = OK;
-    else if ( com == "AVAILABLE" )
-      result = Echo;
-    else if ( com == "SELECTED" )
-      result = Echo;
-    else if ( com == "SKIP" )
-      result = Skip;
-    else if ( com == "NEIGHBORS" )
-      result = Neighbors;
-    else if ( com == "ENDNEIGHBORS" )
-      result = EndNeighbors;
-    else if ( com == "STATUS" )
-      result = Status;
-    else if ( com == "ENDSTATUS" )
-      result = EndStatus;
-    return result;
-  }
-
-  code_t extract_code( const string& line, string& rest ){
-    string code;
-    rest.clear();
-    vector<string> parts = TiCC::split( line, 2 );
-    if ( !parts.empty() ){
-      code = parts[0];
-      if ( parts.size() == 2 ){
-	rest = parts[1];
-      }
-    }
-    return toCode( code );
-  }
-
   bool ClientClass::extractResult( const string& line ){
-    string cls;
-    string dist;
-    string db;
-    string::size_type pos1 = line.find( "{" );
-    if ( pos1 != string::npos ) {
-      string::size_type pos2 = line.find( "}", pos1 );
-      if ( pos2 != string::npos ){
-	cls = line.substr( pos1+1, pos2 - pos1 -1 );
-	pos1 = line.find( "DISTRIBUTION" );
-	if ( pos1 != string::npos ) {
-	  pos1 = line.find( "{", pos1 + 13 );
-	  if ( pos1 != string::npos ) {
-	    pos2 = line.find( "}", pos1 );
-	    if ( pos2 != string::npos ){
-	      db = line.substr( pos1, pos2 - pos1 + 1 );
-	    }
-	    else
-	      return false;
-	  }
-	  else
-	    return false;
-	}
-	pos1 = line.find( "DISTANCE" );
-	if ( pos1 != string::npos ) {
-	  pos1 = line.find( "{", pos1 + 9 );
-	  if ( pos1 != string::npos ) {
-	    pos2 = line.find( "}", pos1 );
-	    if ( pos2 != string::npos ){
-	      dist = line.substr( pos1+1, pos2 - pos1-1 );
-	    }
-	    else
-	      return false;
-	  }
-	  else
-	    return false;
-	}
-	pos1 = line.find( "NEIGHBORS" );
-	if ( pos1 != string::npos ) {
-	  string answer;
-	  while ( client.read( answer ) ){
-	    string rest;
-	    code_t code = extract_code( answer, rest );
-	    if ( code != EndNeighbors ){
-	      neighbors.push_back( answer );
-	    }
-	    else
-	      break;
-	  }
+    // parse straight into the members, which keep their capacity from
+    // one instance to the next
+    bool has_neighbors = false;
+    if ( !parse_result( line, Class, distribution, distance,
+			has_neighbors ) ){
+      Class.clear();
+      distribution.clear();
+      distance.clear();
+      return false;
+    }
+    if ( has_neighbors ) {
+      string answer;
+      while ( client.read( answer ) ){
+	string rest;
+	code_t code = extract_code( answer, rest );
+	if ( code != EndNeighbors ){
+	  neighbors.push_back( answer );
 	}
-	Class = cls;
-	distribution = db;
-	distance = dist;
-	return true;
+	else
+	  break;
       }
     }
-    return false;
+    return true;
   }
 
   bool ClientClass::classify( const string& line ){
+    return classifyLine( line );
+  }
+
+  bool ClientClass::classifyLine( string_view line ){
+    // the request and response buffers are members, so a run of
+    // classifications doesn't allocate them anew for every line
     Class.clear();
     distribution.clear();
     distance.clear();
     neighbors.clear();
     if ( client.isValid() ) {
-      string request;
-      request = "classify " + line + "\n";
+      request.assign( "classify " );
+      request.append( line );
+      request += '\n';
       if ( client.write( request ) ){
-	string response;
 	while ( client.read( response ) ){
 	  //	  cerr << "result line " << response << endl;
 	  if ( response.empty() )
 	    continue;
-	  string rest;
 	  code_t code = extract_code( response, rest );
 	  switch( code ){
 	  case Result:
@@ -284,6 +234,53 @@ namespace TimblServer {
     }
   }
 
+  bool ClientClass::classifyFile( LineSource& is, AsyncWriter& os ){
+    // the batch variant: lines come straight out of the input buffer and
+    // the output is collected in large blocks, written by a thread of its
+    // own, instead of flushed after every line
+    if ( client.isValid() ) {
+      string_view line;
+      while( is.next( line ) ){
+	if ( classifyLine( line ) ){
+	  os.write( line );
+	  os.write( " --> CATEGORY {" );
+	  os.write( Class );
+	  os.write( "}" );
+	  if ( !distribution.empty() ){
+	    os.write( " DISTRIBUTION " );
+	    os.write( distribution );
+	  }
+	  if ( !distance.empty() ){
+	    os.write( " DISTANCE {" );
+	    os.write( distance );
+	    os.write( "}" );
+	  }
+	  if ( neighbors.size() > 0 ){
+	    os.write( " NEIGHBORS \n" );
+	    for ( const auto& n : neighbors ){
+	      os.write( n );
+	      os.write( "\n" );
+	    }
+	    os.write( "ENDNEIGHBORS " );
+	  }
+	  os.write( "\n" );
+	}
+	else {
+	  os.write( line );
+	  os.write( " ==> ERROR\n" );
+	}
+      }
+      if ( !is.getMessage().empty() ){
+	cerr << is.getMessage() << endl;
+	return false;
+      }
+      return true;
+    }
+    else {
+      return false;
+    }
+  }
+
   bool ClientClass::runScript( istream& is, ostream& os ){
     if ( client.isValid() ) {
       string request;
@@ -325,6 +322,19 @@ namespace TimblServer {
 		}
 	      break;
 	    }
+	    case Tagged: {
+	      // the answer to an ASYNC request
+	      bool also_neighbors = (response.find( "NEIGHBORS" ) != string::npos );
+	      os << response << endl;
+	      if ( also_neighbors )
+		while ( client.read( response ) ){
+		  code = extract_code( response, rest );
+		  os << response << endl;
+		  if ( code == EndNeighbors )
+		    break;
+		}
+	      break;
+	    }
 	    case Status:
 	      os << response << endl;
 	      while ( client.read( response ) ){
@@ -0,0 +1,204 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <stdexcept>
+
+#include "ticcutils/StringOps.h"
+#include "timbl/TimblAPI.h"
+#include "timblserver/Experiments.h"
+#include "timblserver/Engine.h"
+
+using namespace std;
+using namespace Timbl;
+
+namespace TimblServer {
+
+  Engine::Engine( const TiCC::Configuration *config ):
+    e_log( cerr, "timblengine" )
+  {
+    load( config );
+  }
+
+  Engine::Engine( const string& config_file ):
+    e_log( cerr, "timblengine" )
+  {
+    TiCC::Configuration config;
+    if ( !config.fill( config_file ) ){
+      throw runtime_error( "Engine: unable to read configuration from '"
+			   + config_file + "'" );
+    }
+    load( &config );
+  }
+
+  Engine::~Engine(){
+    for ( const auto& w : workers ){
+      delete w->exp;
+      delete w;
+    }
+    for ( const auto& it : experiments ){
+      delete it.second;
+    }
+  }
+
+  void Engine::load( const TiCC::Configuration *config ){
+    // the same definitions and cache as startExperiments() uses
+    string cache_dir = cache_directory( config, e_log );
+    map<string,string> allvals = experiment_definitions( config );
+    for ( const auto& it : allvals ){
+      TimblExperiment *exp = create_experiment( it.first, it.second, e_log,
+						cache_dir );
+      if ( exp ){
+	experiments[it.first] = exp;
+      }
+    }
+    if ( experiments.empty() ){
+      throw runtime_error( "Engine: no valid Timbls could be instantiated" );
+    }
+  }
+
+  vector<string> Engine::bases() const {
+    vector<string> result;
+    for ( const auto& it : experiments ){
+      result.push_back( it.first );
+    }
+    return result;
+  }
+
+  bool Engine::has_base( const string& base ) const {
+    return experiments.find( base ) != experiments.end();
+  }
+
+  Engine::Worker *Engine::acquire( const string& base,
+				   const string& options,
+				   string& error ){
+    // take an idle clone of base with these options, or make a new one.
+    // The experiments themselves are only read, so cloning needs no lock
+    auto it = experiments.find( base );
+    if ( it == experiments.end() ){
+      error = "unknown base '" + base + "'";
+      return 0;
+    }
+    string key = base + "\t" + options;
+    {
+      lock_guard<mutex> lock( mtx );
+      vector<Worker*>& pool = idle[key];
+      if ( !pool.empty() ){
+	Worker *w = pool.back();
+	pool.pop_back();
+	return w;
+      }
+    }
+    TimblExperiment *exp = it->second;
+    Worker *w = new Worker();
+    w->exp = exp->clone();
+    *w->exp = *exp;
+    w->exp->connectToSocket( &w->null_stream );
+    if ( exp->getOptParams() ){
+      w->exp->setOptParams( exp->getOptParams()->Clone( &w->null_stream ) );
+    }
+    if ( !options.empty()
+	 && !( w->exp->SetOptions( options )
+	       && w->exp->ConfirmOptions() ) ){
+      error = "invalid options '" + options + "' for base '" + base + "'";
+      delete w->exp;
+      delete w;
+      return 0;
+    }
+    lock_guard<mutex> lock( mtx );
+    workers.push_back( w );
+    return w;
+  }
+
+  void Engine::release( const string& base,
+			const string& options,
+			Worker *w ){
+    lock_guard<mutex> lock( mtx );
+    idle[base + "\t" + options].push_back( w );
+  }
+
+  void Engine::classify_one( Worker *w,
+			     const string& instance,
+			     EngineResult& result ){
+    try {
+      result.ok = w->exp->Classify( instance,
+				    result.category,
+				    result.distribution,
+				    result.distance );
+    }
+    catch ( const exception& e ){
+      result.ok = false;
+      result.error = e.what();
+      return;
+    }
+    if ( result.ok ){
+      result.confidence = w->exp->confidence();
+      result.match_depth = w->exp->matchDepth();
+    }
+    else {
+      result.error = "classification failed on '" + instance + "'";
+    }
+  }
+
+  EngineResult Engine::classify( const string& base,
+				 const string& instance,
+				 const string& options ){
+    EngineResult result;
+    Worker *w = acquire( base, options, result.error );
+    if ( w ){
+      classify_one( w, TiCC::trim( instance ), result );
+      release( base, options, w );
+    }
+    return result;
+  }
+
+  vector<EngineResult> Engine::classifyBatch( const string& base,
+					      const vector<string>& instances,
+					      const string& options ){
+    // one clone for the whole batch
+    vector<EngineResult> results( instances.size() );
+    string error;
+    Worker *w = acquire( base, options, error );
+    if ( !w ){
+      for ( auto& r : results ){
+	r.error = error;
+      }
+      return results;
+    }
+    for ( size_t i = 0; i < instances.size(); ++i ){
+      classify_one( w, TiCC::trim( instances[i] ), results[i] );
+    }
+    release( base, options, w );
+    return results;
+  }
+
+}
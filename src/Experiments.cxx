@@ -0,0 +1,337 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/FileUtils.h"
+#include "ticcutils/ServerBase.h"
+#include "timbl/TimblAPI.h"
+#include "timblserver/Experiments.h"
+
+using namespace std;
+using namespace Timbl;
+using namespace TiCCServer;
+
+namespace TimblServer {
+
+  static string cache_key( const string& exp_name,
+			   const string& trainName,
+			   const string& params ){
+    // a key which changes when the training file, the options or the
+    // Timbl version change. We use size and modification time of the file,
+    // like make, not its contents, which may be huge.
+    struct stat st;
+    if ( stat( trainName.c_str(), &st ) != 0 ){
+      return "";
+    }
+    string id = trainName + "\n" + to_string( st.st_size )
+      + "\n" + to_string( st.st_mtime )
+      + "\n" + params + "\n" + Timbl::VersionName();
+    // 64 bits FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for ( const auto c : id ){
+      hash ^= (unsigned char)c;
+      hash *= 1099511628211ULL;
+    }
+    ostringstream os;
+    os << exp_name << "-" << hex << setw(16) << setfill('0') << hash;
+    return os.str();
+  }
+
+  static void prune_cache( const string& cache_dir,
+			   const string& exp_name,
+			   const string& key ){
+    // remove the entries of exp_name with another key. They are stale
+    DIR *dir = opendir( cache_dir.c_str() );
+    if ( !dir ){
+      return;
+    }
+    string prefix = exp_name + "-";
+    while ( dirent *entry = readdir( dir ) ){
+      string name = entry->d_name;
+      if ( name.compare( 0, prefix.size(), prefix ) != 0
+	   || name.compare( 0, key.size(), key ) == 0 ){
+	continue;
+      }
+      // only exp_name-<16 hex digits>.<ext>, not another base "exp_name-x"
+      string rest = name.substr( prefix.size() );
+      if ( rest.size() > 17
+	   && rest[16] == '.'
+	   && rest.find_first_not_of( "0123456789abcdef" ) == 16 ){
+	string ext = rest.substr( 17 );
+	if ( ext == "ib" || ext == "wgt" || ext == "arr" ){
+	  unlink( (cache_dir + "/" + name).c_str() );
+	}
+      }
+    }
+    closedir( dir );
+  }
+
+  static bool write_cache( TimblAPI *run,
+			   const string& cache_dir,
+			   const string& key,
+			   bool with_arrays ){
+    // write to temporary files first, so a crash or a concurrent server
+    // never leaves half an entry behind
+    string base = cache_dir + "/" + key;
+    string tmp = "." + to_string( getpid() ) + ".tmp";
+    bool ok = run->WriteInstanceBase( base + ".ib" + tmp )
+      && run->SaveWeights( base + ".wgt" + tmp )
+      && ( !with_arrays || run->WriteArrays( base + ".arr" + tmp ) );
+    if ( ok ){
+      // the .ib file goes last: its presence marks a complete entry
+      ok = ( rename( (base + ".wgt" + tmp).c_str(),
+		     (base + ".wgt").c_str() ) == 0 )
+	&& ( !with_arrays || rename( (base + ".arr" + tmp).c_str(),
+				     (base + ".arr").c_str() ) == 0 )
+	&& ( rename( (base + ".ib" + tmp).c_str(),
+		     (base + ".ib").c_str() ) == 0 );
+    }
+    unlink( (base + ".ib" + tmp).c_str() );
+    unlink( (base + ".wgt" + tmp).c_str() );
+    unlink( (base + ".arr" + tmp).c_str() );
+    return ok;
+  }
+
+  TimblExperiment *create_experiment( const string& exp_name,
+				      const string& params,
+				      TiCC::LogStream& s_log,
+				      const string& cache_dir ){
+    TiCC::CL_Options opts;
+    opts.add_short_options( timbl_short_opts );
+    opts.add_short_options( serv_short_opts );
+    opts.add_long_options( timbl_long_opts );
+    opts.add_long_options( serv_long_opts );
+    opts.init( params );
+    string treeName;
+    string trainName;
+    string MatrixInFile = "";
+    string WgtInFile = "";
+    Weighting WgtType = GR;
+    Algorithm algorithm = IB1;
+    string ProbInFile = "";
+    string value;
+    if ( opts.is_present( 'a', value ) ){
+      // the user gave an algorithm
+      if ( !string_to( value, algorithm ) ){
+	string mess = exp_name + ":start(): illegal -a value: " + value;
+	throw runtime_error( mess );
+      }
+    }
+    if ( !opts.extract( 'f', trainName ) ){
+      opts.extract( 'i', treeName );
+    }
+    if ( opts.extract( 'u', ProbInFile ) ){
+      if ( algorithm == IGTREE ){
+	string mess = exp_name + ":start(): -u option is useless for IGtree";
+	throw runtime_error( mess );
+      }
+    }
+    if ( opts.extract( 'w', value ) ){
+      Weighting W;
+      if ( string_to( value, W ) ){
+	// needed to read back cached weights
+	WgtType = W;
+      }
+      else {
+	// No valid weighting, so assume it also has a filename
+	vector<string> parts = TiCC::split_at( value, ":" );
+	size_t num = parts.size();
+	if ( num == 2 ){
+	  if ( !string_to( parts[1], W ) ){
+	    string mess = exp_name + ":start(): invalid weighting option:"
+	      + value;
+	    throw runtime_error( mess );
+	  }
+	  WgtInFile = parts[0];
+	  WgtType = W;
+	}
+	else if ( num == 1 ){
+	  WgtInFile = value;
+	}
+	else {
+	  string mess = exp_name + ":start(): invalid weighting option:"
+	    + value;
+	  throw runtime_error( mess );
+	}
+      }
+    }
+    opts.extract( "matrixin", MatrixInFile );
+    if ( treeName.empty()
+	 && trainName.empty() ) {
+      // we need to learn from trainName
+      // OR read a tree from treeName
+      s_log << "missing '-i' or '-f' option in serverconfig entry: '"
+	    << exp_name << "=" << params << "'" << endl;
+      return 0;
+    }
+    // let's start
+    TimblAPI *run = new TimblAPI( opts, exp_name );
+    bool result = false;
+    if ( run && run->Valid() ){
+      string key;
+      if ( !cache_dir.empty() && !trainName.empty() ){
+	key = cache_key( exp_name, trainName, params );
+      }
+      string cached = cache_dir + "/" + key;
+      if ( !key.empty() && TiCC::isFile( cached + ".ib" ) ){
+	s_log << "trainName = " << trainName << ", using cached "
+	      << cached << ".ib" << endl;
+	result = run->GetInstanceBase( cached + ".ib" );
+	if ( result && WgtInFile.empty() ){
+	  result = run->GetWeights( cached + ".wgt", WgtType );
+	}
+	if ( result && ProbInFile.empty() && algorithm != IGTREE ){
+	  result = run->GetArrays( cached + ".arr" );
+	}
+	if ( !result ){
+	  // a damaged entry. Start afresh
+	  s_log << "unable to use the cache for " << exp_name
+		<< ", learning from " << trainName << endl;
+	  delete run;
+	  run = new TimblAPI( opts, exp_name );
+	  result = run->Valid() && run->Learn( trainName );
+	  unlink( (cached + ".ib").c_str() );
+	}
+      }
+      else if ( treeName.empty() ){
+	s_log << "trainName = " << trainName << endl;
+	result = run->Learn( trainName );
+	if ( result && !key.empty() ){
+	  if ( write_cache( run, cache_dir, key, algorithm != IGTREE ) ){
+	    s_log << "stored " << exp_name << " in cache: " << cached
+		  << ".ib" << endl;
+	    prune_cache( cache_dir, exp_name, key );
+	  }
+	  else {
+	    s_log << "unable to store " << exp_name << " in cache "
+		  << cache_dir << endl;
+	  }
+	}
+      }
+      else {
+	s_log << "treeName = " << treeName << endl;
+	result = run->GetInstanceBase( treeName );
+      }
+      if ( result && WgtInFile != "" ) {
+	result = run->GetWeights( WgtInFile, WgtType );
+      }
+      if ( result && ProbInFile != "" ){
+	result = run->GetArrays( ProbInFile );
+      }
+      if ( result && MatrixInFile != "" ) {
+	result = run->GetMatrices( MatrixInFile );
+      }
+    }
+    TimblExperiment *exp = 0;
+    if ( result ){
+      run->initExperiment();
+      exp = run->grabAndDisconnectExp();
+      s_log << "started experiment " << exp_name
+	    << " with parameters: " << params << endl;
+    }
+    else {
+      s_log << "FAILED to start experiment " << exp_name
+	    << " with parameters: " << params << endl;
+    }
+    delete run;
+    return exp;
+  }
+
+  // the global settings which are NOT old style experiment definitions
+  const set<string> server_settings = { "port", "protocol", "logfile",
+					"debug", "pidfile", "daemonize",
+					"configDir", "maxconn",
+					"cpus", "pinning", "numa",
+					"workers", "queue_timeout",
+					"unixsocket", "readyfile",
+					"warmup_threads", "cachedir",
+					"slowlog", "slowlog_ms",
+					"slowlog_rate", "capture",
+					"capture_sample", "asynclog",
+					"asynclog_buffer", "shmsocket",
+					"learn", "learn_batch",
+					"learn_interval", "learn_queue",
+					"idle_release", "idle_timeout",
+					"session_lifetime",
+					"session_requests",
+					"session_concurrency",
+					"batching",
+					"batch_size", "batch_wait",
+					"batch_workers", "perf",
+					"perf_sample", "profile_dir",
+					"profile_hz", "profile_max" };
+
+  map<string,string> experiment_definitions( const TiCC::Configuration *config ){
+    map<string,string> result;
+    if ( config->hasSection("experiments") ){
+      result = config->lookUpAll("experiments");
+    }
+    else {
+      result = config->lookUpAll("global");
+      // old style, everything is global
+      // remove all already processed stuff
+      auto it = result.begin();
+      while ( it != result.end() ){
+	if ( server_settings.find( it->first ) != server_settings.end() ){
+	  result.erase(it++);
+	}
+	else {
+	  ++it;
+	}
+      }
+    }
+    return result;
+  }
+
+  string cache_directory( const TiCC::Configuration *config,
+			  TiCC::LogStream& s_log ){
+    string cache_dir = config->lookUp( "cachedir" );
+    if ( !cache_dir.empty() && !TiCC::createPath( cache_dir + "/" ) ){
+      s_log << "unable to use cache directory " << cache_dir << endl;
+      cache_dir.clear();
+    }
+    return cache_dir;
+  }
+
+}
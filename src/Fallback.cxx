@@ -0,0 +1,208 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Fallback.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  using Clock = chrono::steady_clock;
+
+  const chrono::milliseconds probe_interval( 100 );
+
+  Fallbacks::Route::Route( Route&& other ):
+    owner(other.owner),
+    primary(other.primary),
+    _base(other._base),
+    is_fallback(other.is_fallback),
+    start(other.start)
+  {
+    other.owner = 0;
+  }
+
+  Fallbacks::Route& Fallbacks::Route::operator=( Route&& other ){
+    if ( this != &other ){
+      if ( owner ){
+	owner->finish( *this );
+      }
+      owner = other.owner;
+      primary = other.primary;
+      _base = other._base;
+      is_fallback = other.is_fallback;
+      start = other.start;
+      other.owner = 0;
+    }
+    return *this;
+  }
+
+  Fallbacks::Route::~Route(){
+    if ( owner ){
+      owner->finish( *this );
+    }
+  }
+
+  Fallbacks::Fallbacks( const TiCC::Configuration *config ):
+    log(0)
+  {
+    if ( !config->hasSection( "fallback" ) ){
+      return;
+    }
+    for ( const auto& it : config->lookUpAll( "fallback" ) ){
+      vector<string> parts = TiCC::split_at( it.second, ":" );
+      state st;
+      bool ok = parts.size() >= 2 && parts.size() <= 3;
+      if ( ok ){
+	st.fallback = parts[0];
+	ok = TiCC::stringTo( parts[1], st.latency_ms ) && st.latency_ms >= 0;
+      }
+      if ( ok && parts.size() == 3 ){
+	ok = TiCC::stringTo( parts[2], st.depth );
+      }
+      if ( !ok || ( st.latency_ms == 0 && st.depth == 0 ) ){
+	throw runtime_error( "invalid [[fallback]] entry: " + it.first
+			     + "=" + it.second );
+      }
+      states[it.first] = st;
+    }
+  }
+
+  void Fallbacks::check( const map<string,Timbl::TimblExperiment*>& exps,
+			 TiCC::LogStream& s_log ){
+    // drop the entries for unknown bases
+    log = &s_log;
+    auto it = states.begin();
+    while ( it != states.end() ){
+      if ( exps.find( it->first ) == exps.end()
+	   || exps.find( it->second.fallback ) == exps.end() ){
+	s_log << "fallback: unknown base in " << it->first << "="
+	      << it->second.fallback << ", skipped" << endl;
+	it = states.erase( it );
+      }
+      else {
+	s_log << "fallback: " << it->first << " falls back to "
+	      << it->second.fallback << endl;
+	++it;
+      }
+    }
+  }
+
+  Fallbacks::Route Fallbacks::route( const string& base ){
+    // decide which base serves the next request for 'base'
+    Route result;
+    result.primary = base;
+    result._base = base;
+    auto it = states.find( base );
+    if ( it == states.end() ){
+      return result;
+    }
+    Clock::time_point now = Clock::now();
+    bool switched = false;
+    bool recovered = false;
+    {
+      lock_guard<mutex> lock( mtx );
+      state& st = it->second;
+      if ( !st.active ){
+	if ( ( st.latency_ms > 0 && st.recent_ms > st.latency_ms )
+	     || ( st.depth > 0 && st.in_progress >= st.depth ) ){
+	  st.active = true;
+	  st.last_probe = now;
+	  ++st.switches;
+	  switched = true;
+	}
+      }
+      else if ( ( st.latency_ms == 0 || st.recent_ms < 0.8 * st.latency_ms )
+		&& ( st.depth == 0 || st.in_progress <= st.depth / 2 ) ){
+	st.active = false;
+	recovered = true;
+      }
+      bool use_fallback = st.active;
+      if ( use_fallback && now - st.last_probe >= probe_interval ){
+	// let this one through, to see if the load dropped
+	st.last_probe = now;
+	use_fallback = false;
+      }
+      if ( use_fallback ){
+	++st.fallback_served;
+	result._base = st.fallback;
+	result.is_fallback = true;
+      }
+      else {
+	++st.primary_served;
+	++st.in_progress;
+	result.owner = this;
+	result.start = now;
+      }
+    }
+    if ( switched && log ){
+      *TiCC::Log( *log ) << "fallback: " << base << " is overloaded, "
+			 << "using " << it->second.fallback << endl;
+    }
+    else if ( recovered && log ){
+      *TiCC::Log( *log ) << "fallback: back to " << base << endl;
+    }
+    return result;
+  }
+
+  void Fallbacks::finish( const Route& r ){
+    double ms = chrono::duration<double,milli>( Clock::now()
+						- r.start ).count();
+    lock_guard<mutex> lock( mtx );
+    state& st = states.find( r.primary )->second;
+    --st.in_progress;
+    // an exponential moving average, of the last 5 or so requests
+    st.recent_ms = st.recent_ms == 0 ? ms : 0.8 * st.recent_ms + 0.2 * ms;
+  }
+
+  json Fallbacks::stats() const {
+    json result = json::object();
+    lock_guard<mutex> lock( mtx );
+    for ( const auto& it : states ){
+      const state& st = it.second;
+      json entry;
+      entry["fallback"] = st.fallback;
+      entry["active"] = st.active;
+      entry["recent_ms"] = st.recent_ms;
+      entry["in_progress"] = st.in_progress;
+      entry["switches"] = st.switches;
+      entry["primary_served"] = st.primary_served;
+      entry["fallback_served"] = st.fallback_served;
+      result[it.first] = entry;
+    }
+    return result;
+  }
+
+}
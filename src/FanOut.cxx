@@ -0,0 +1,206 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <system_error>
+#include <stdexcept>
+
+#include "ticcutils/StringOps.h"
+#include "timbl/TimblAPI.h"
+#include "ticcutils/ServerBase.h"
+#include "timblserver/TimblServer.h"
+
+using namespace std;
+using namespace Timbl;
+using namespace TiCCServer;
+
+namespace TimblServer {
+
+  FanOut::FanOut( ServerCommon *s,
+		  childArgs *a,
+		  int n,
+		  const string& cls,
+		  bool j ):
+    server(s),
+    args(a),
+    node(n),
+    client_class(cls),
+    json(j)
+  {}
+
+  FanOut::~FanOut(){
+    release();
+  }
+
+  void FanOut::release(){
+    // free the clones. run() makes them again when needed
+    for ( const auto& it : clients ){
+      delete it.second;
+    }
+    clients.clear();
+  }
+
+  bool FanOut::parse_bases( const string& value,
+			    vector<string>& bases,
+			    string& error ) const {
+    // a comma separated list of known and distinct basenames
+    bases = TiCC::split_at( value, "," );
+    set<string> seen;
+    for ( auto& base : bases ){
+      base = TiCC::trim( base );
+      if ( server->experiments.find( base ) == server->experiments.end() ){
+	error = "unknown basename: '" + base + "'";
+	return false;
+      }
+      if ( !seen.insert( base ).second ){
+	error = "basename '" + base + "' mentioned twice";
+	return false;
+      }
+    }
+    if ( bases.empty() ){
+      error = "no basenames given";
+      return false;
+    }
+    return true;
+  }
+
+  bool FanOut::prepare( const string& base,
+			TimblThread*& client,
+			const string& options,
+			string& error ) const {
+    // make sure client is an up to date clone of base, with 'options' set
+    try {
+      if ( !client ){
+	client = new TimblThread( server->find_experiment( base, node ),
+				  args, json );
+      }
+      else {
+	server->refresh( client, base );
+      }
+    }
+    catch ( const exception& e ){
+      error = e.what();
+      return false;
+    }
+    if ( client->options != options ){
+      // options set on the connection since this clone was last used
+      if ( !options.empty() && !client->setOptions( options ) ){
+	error = "set options failed: " + options;
+	return false;
+      }
+    }
+    return true;
+  }
+
+  TimblThread *FanOut::client( const string& base,
+			       const string& options,
+			       string& error ){
+    // the clone of base for this connection, with 'options' set
+    TimblThread *result = 0;
+    auto it = clients.find( base );
+    if ( it != clients.end() ){
+      result = it->second;
+    }
+    if ( !prepare( base, result, options, error ) ){
+      if ( result && it == clients.end() ){
+	delete result;
+      }
+      return 0;
+    }
+    clients[base] = result;
+    return result;
+  }
+
+  vector<string> FanOut::run( const vector<string>& bases,
+			      const string& options,
+			      const function<void(size_t,TimblThread*)>& work ){
+    // calls 'work' for every base, with a clone of that base which has
+    // 'options' set. Every base takes its own scheduler slot, so one
+    // base being busy doesn't hold up the others. Returns an error
+    // message per base, empty for the bases that were run
+    vector<string> errors( bases.size() );
+    vector<TimblThread*> todo( bases.size(), 0 );
+    for ( size_t i=0; i < bases.size(); ++i ){
+      auto it = clients.find( bases[i] );
+      if ( it != clients.end() ){
+	todo[i] = it->second;
+      }
+    }
+    auto task = [&]( size_t i ){
+      // an exception must not leave the thread: it would end the server
+      try {
+	if ( !prepare( bases[i], todo[i], options, errors[i] ) ){
+	  return;
+	}
+	Scheduler::Slot slot = server->scheduler.acquire( bases[i],
+							  client_class );
+	if ( !slot ){
+	  errors[i] = "server busy: base '" + bases[i] + "' is overloaded";
+	  return;
+	}
+	work( i, todo[i] );
+      }
+      catch ( const exception& e ){
+	errors[i] = e.what();
+      }
+      catch ( ... ){
+	errors[i] = "classification failed";
+      }
+    };
+    vector<thread> threads;
+    for ( size_t i=1; i < bases.size(); ++i ){
+      try {
+	threads.push_back( thread( [&,i](){
+	      server->affinity.bind_to_node( node );
+	      server->affinity.bind_experiment( bases[i], node );
+	      task( i );
+	    } ) );
+      }
+      catch ( const system_error& ){
+	// out of threads: do it ourselves
+	task( i );
+      }
+    }
+    task( 0 );
+    for ( auto& t : threads ){
+      t.join();
+    }
+    for ( size_t i=0; i < bases.size(); ++i ){
+      if ( todo[i] ){
+	clients[bases[i]] = todo[i];
+      }
+    }
+    return errors;
+  }
+
+}
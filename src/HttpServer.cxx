@@ -30,12 +30,15 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <map>
+#include <sstream>
 
 #include "ticcutils/CommandLine.h"
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/ServerBase.h"
 #include "timbl/TimblAPI.h"
 #include "timblserver/TimblServer.h"
+#include "timblserver/Protocol.h"
 
 using namespace std;
 using namespace Timbl;
@@ -44,38 +47,253 @@ using namespace TiCCServer;
 
 using TiCC::operator<<;
 
-#define LOG *TiCC::Log(logstream())
-#define DBG *TiCC::Dbg(logstream())
+#define LOG ASYNC_LOG( async_log, logstream() )
+#define DBG ASYNC_DBG( async_log, logstream() )
 
-#define IS_DIGIT(x) (((x) >= '0') && ((x) <= '9'))
-#define IS_HEX(x) ((IS_DIGIT(x)) || (((x) >= 'a') && ((x) <= 'f')) || \
-            (((x) >= 'A') && ((x) <= 'F')))
+class ChunkedXml {
+  // sends an XML document as a chunked HTTP/1.1 response, one child of
+  // the root at a time. Every child is freed as soon as it is sent, so a
+  // client sees each result when it is ready and the server doesn't keep
+  // the whole answer in memory
+public:
+  ChunkedXml( ostream& o, xmlNode *r ): os(o), root(r), started(false){};
+  bool start();
+  bool send( xmlNode * );
+  bool finish();
+private:
+  bool chunk( const string& );
+  ostream& os;
+  xmlNode *root;
+  bool started;
+};
 
+string node_to_string( xmlNode *node ){
+  xmlBuffer *buf = xmlBufferCreate();
+  xmlNodeDump( buf, node->doc, node, 0, 0 );
+  string result = (const char*)xmlBufferContent( buf );
+  xmlBufferFree( buf );
+  return result;
+}
+
+bool ChunkedXml::chunk( const string& data ){
+  if ( data.empty() ){
+    return os.good();
+  }
+  os << hex << data.size() << dec << "\r\n" << data << "\r\n" << flush;
+  return os.good();
+}
+
+bool ChunkedXml::start(){
+  // the headers, and the root with what was added to it so far
+  started = true;
+  os << "HTTP/1.1 200 OK\r\n"
+     << "Content-Type: application/xml\r\n"
+     << "Transfer-Encoding: chunked\r\n"
+     << "Connection: close\r\n\r\n";
+  vector<xmlNode*> children;
+  for ( xmlNode *n = root->children; n; n = n->next ){
+    children.push_back( n );
+  }
+  for ( const auto& n : children ){
+    xmlUnlinkNode( n );
+  }
+  // an empty root serializes as <TiMblResult .../>, make it an open tag
+  string open_tag = node_to_string( root );
+  open_tag = open_tag.substr( 0, open_tag.size() - 2 ) + ">\n";
+  bool ok = chunk( "<?xml version=\"1.0\"?>\n" + open_tag );
+  for ( const auto& n : children ){
+    ok = chunk( node_to_string( n ) + "\n" ) && ok;
+    xmlFreeNode( n );
+  }
+  return ok;
+}
+
+bool ChunkedXml::send( xmlNode *node ){
+  if ( !started ){
+    return true;
+  }
+  xmlUnlinkNode( node );
+  bool ok = chunk( node_to_string( node ) + "\n" );
+  xmlFreeNode( node );
+  return ok;
+}
+
+bool ChunkedXml::finish(){
+  if ( !started ){
+    return true;
+  }
+  string close_tag = "</" + string( (const char*)root->name ) + ">\n";
+  bool ok = chunk( close_tag );
+  os << "0\r\n\r\n" << flush;
+  return ok && os.good();
+}
+
+bool want_streaming( const multimap<string,string>& acts,
+		     const string& request_line ){
+  // chunked encoding needs HTTP/1.1, older clients get the whole document
+  auto it = acts.find( "stream" );
+  return it != acts.end()
+    && ( it->second == "yes" || it->second == "true" || it->second == "1" )
+    && request_line.find( "HTTP/1.1" ) != string::npos;
+}
+
+void classification_to_xml( xmlNode *cl,
+			    TimblExperiment *exp,
+			    const string& params,
+			    const string& answer,
+			    const string& distrib,
+			    double distance ){
+  TiCC::XmlNewTextChild( cl, "input", params );
+  TiCC::XmlNewTextChild( cl, "category", answer );
+  if ( exp->Verbosity(DISTRIB) ){
+    TiCC::XmlNewTextChild( cl, "distribution", distrib );
+  }
+  if ( exp->Verbosity(DISTANCE) ){
+    TiCC::XmlNewTextChild( cl, "distance",
+			   TiCC::toString<double>(distance) );
+  }
+  if ( exp->Verbosity(CONFIDENCE) ){
+    TiCC::XmlNewTextChild( cl, "confidence",
+			   TiCC::toString<double>( exp->confidence() ) );
+  }
+  if ( exp->Verbosity(MATCH_DEPTH) ){
+    TiCC::XmlNewTextChild( cl, "match_depth",
+			   TiCC::toString<double>( exp->matchDepth()) );
+  }
+  if ( exp->Verbosity(NEAR_N) ){
+    xmlNode *nb = exp->bestNeighborsToXML();
+    xmlAddChild( cl, nb );
+  }
+}
 
-string urlDecode( const string& s ) {
-  string result;
-  size_t len=s.size();
-  for ( size_t i=0; i<len ; ++i ) {
-    int cc=s[i];
-    if (cc == '+') {
-      result += ' ';
+size_t HttpServer::fan_out_request( childArgs *args,
+				    const string& bases_string,
+				    const string& qstring,
+				    const string& request_line,
+				    int numa_node,
+				    const string& client_class,
+				    StageTimer& timer ){
+  // GET /base1,base2,...?classify=...: every instance is classified by
+  // all bases, in parallel
+  FanOut fan_out( this, args, numa_node, client_class );
+  vector<string> bases;
+  string error;
+  if ( !fan_out.parse_bases( bases_string, bases, error ) ){
+    DBG << "HttpServer::invalid BASES! '" << bases_string << "'" << endl;
+    args->os() << error << endl;
+    return 0;
+  }
+  size_t classified = 0;
+  xmlDoc *doc = xmlNewDoc( TiCC::to_xmlChar("1.0") );
+  xmlNode *root = xmlNewDocNode( doc,
+				 0,
+				 TiCC::to_xmlChar("TiMblResult" ),
+				 0 );
+  xmlDocSetRootElement( doc, root );
+  TiCC::XmlSetAttribute( root, "bases", bases_string );
+  ostringstream query_log;
+  multimap<string,string> acts = parse_query( qstring, query_log );
+  if ( !query_log.str().empty() ){
+    LOG << query_log.str();
+  }
+  string options;
+  auto range = acts.equal_range( "set" );
+  for ( auto it = range.first; it != range.second; ++it ){
+    string opt = it->second;
+    if ( !opt.empty() && opt[0] != '-' && opt[0] != '+' ){
+      opt = string("-") + opt;
+    }
+    if ( !options.empty() ){
+      options += " ";
+    }
+    options += opt;
+  }
+  range = acts.equal_range( "show" );
+  for ( auto it = range.first; it != range.second; ++it ){
+    nlohmann::json profile_json;
+    if ( it->second == "stats" ){
+      TiCC::XmlNewTextChild( root, "stats", stats_to_json().dump() );
     }
-    else if ( cc == '%' &&
-	      ( i < len-2 &&
-		( IS_HEX(s[i+1]) ) &&
-		( IS_HEX(s[i+2]) ) ) ){
-      std::istringstream ss( "0x"+s.substr(i+1,2) );
-      int tmp;
-      ss >> std::showbase >> std::hex;
-      ss >> tmp;
-      result = result + (char)tmp;
-      i += 2;
+    else if ( profile_request( it->second, logstream(), profile_json ) ){
+      TiCC::XmlNewTextChild( root, "profile", profile_json.dump() );
     }
     else {
-      result += cc;
+      LOG << "don't know how to SHOW: " << it->second
+	  << " for several bases" << endl;
     }
   }
-  return result;
+  string first_instance;
+  size_t num_instances = 0;
+  ChunkedXml chunked( args->os(), root );
+  bool stream = want_streaming( acts, request_line );
+  if ( stream ){
+    args->socket()->setBlocking();
+    stream = chunked.start();
+  }
+  range = acts.equal_range( "classify" );
+  for ( auto it = range.first; it != range.second; ++it ){
+    string params = strip_quotes( urlDecode( it->second ) );
+    if ( num_instances++ == 0 ){
+      first_instance = params;
+    }
+    timer.mark( StageTimer::Parse );
+    vector<TimblThread*> workers( bases.size(), 0 );
+    vector<int> ok( bases.size(), 0 );
+    vector<string> answers( bases.size() );
+    vector<string> distribs( bases.size() );
+    vector<double> distances( bases.size(), 0.0 );
+    vector<string> errors
+      = fan_out.run( bases,
+		     options,
+		     [&]( size_t i, TimblThread *worker ){
+		       workers[i] = worker;
+		       ProfileTag tag( "http", bases[i] );
+		       PerfScope counted( perf, bases[i] );
+		       ok[i] = worker->_exp->Classify( params,
+						       answers[i],
+						       distribs[i],
+						       distances[i] );
+		     } );
+    timer.mark( StageTimer::Classify );
+    for ( size_t i=0; i < bases.size(); ++i ){
+      xmlNode *cl = TiCC::XmlNewChild( root, "classification" );
+      TiCC::XmlSetAttribute( cl, "base", bases[i] );
+      if ( !errors[i].empty() ){
+	TiCC::XmlNewTextChild( cl, "input", params );
+	TiCC::XmlNewTextChild( cl, "error", errors[i] );
+      }
+      else if ( !ok[i] ){
+	TiCC::XmlNewTextChild( cl, "input", params );
+	TiCC::XmlNewTextChild( cl, "error", "classification failed" );
+      }
+      else {
+	++classified;
+	classification_to_xml( cl, workers[i]->_exp, params,
+			       answers[i], distribs[i], distances[i] );
+      }
+      if ( stream ){
+	chunked.send( cl );
+      }
+    }
+    timer.mark( StageTimer::Write );
+  }
+  if ( num_instances > 1 ){
+    first_instance += " (+" + to_string( num_instances-1 ) + " more)";
+  }
+  if ( stream ){
+    chunked.finish();
+  }
+  else {
+    string out_line = TiCC::serialize(*doc);
+    int timeout = 10;
+    nb_putline( args->os(), out_line , timeout );
+    args->os() << endl;
+  }
+  xmlFreeDoc( doc );
+  timer.mark( StageTimer::Write );
+  slowlog.check( "http", bases_string, options, first_instance, timer );
+  AllocTracker::record( "http", bases_string, timer );
+  return classified;
 }
 
 void HttpServer::callback( childArgs *args ){
@@ -83,10 +301,18 @@ void HttpServer::callback( childArgs *args ){
   // report connection to the server terminal
   //
   args->socket()->setNonBlocking();
+  ProfileTag profile_tag( "http" );
+  AllocConnection alloc_connection( "http", args->id(), logstream() );
   string logLine = "Thread " + to_string( (uintptr_t)pthread_self() )
     + " on Socket " + to_string( args->id() );
   LOG << logLine << " started." << endl;
+  int numa_node = affinity.bind_connection();
+  string client_class = scheduler.client_class( args->id() );
+  size_t classified = 0;
+  StageTimer timer;
   string Line;
+  bool streamed = false;
+  unsigned long capture_id = 0;
   int timeout = 1;
   if ( nb_getline( args->is(), Line, timeout ) ){
     DBG << "HttpServer::FirstLine='" << Line << "'" << endl;
@@ -97,11 +323,26 @@ void HttpServer::callback( childArgs *args ){
       while ( ( nb_getline( args->is(), tmp, timeout ), !tmp.empty()) ){
 	//	    cerr << "skip: read:'" << tmp << "'" << endl;;
       }
+      timer.mark( StageTimer::Read );
+      capture_id = capture.open( "http" );
+      capture.record( capture_id, TiCC::trim( Line ) );
       string::size_type spos = Line.find( "GET" );
       if ( spos != string::npos ){
 	string::size_type epos = Line.find( " HTTP" );
 	string line = Line.substr( spos+3, epos - spos - 3 );
 	DBG << "HttpServer::Line='" << line << "'" << endl;
+	if ( TiCC::trim( line ) == "/health" ){
+	  // for load balancers: a real HTTP status, 503 until we are ready
+	  string body = health_to_json().dump() + "\n";
+	  args->os() << "HTTP/1.0 "
+		     << ( is_ready() ? "200 OK" : "503 Service Unavailable" )
+		     << "\r\nContent-Type: application/json\r\n"
+		     << "Content-Length: " << body.size() << "\r\n\r\n"
+		     << body << flush;
+	  capture.close( capture_id );
+	  affinity.count( numa_node, classified );
+	  return;
+	}
 	epos = line.find( "?" );
 	string basename;
 	if ( epos != string::npos ){
@@ -111,8 +352,18 @@ void HttpServer::callback( childArgs *args ){
 	  if ( epos != string::npos ){
 	    basename = basename.substr( epos+1 );
 	    auto exp_it = experiments.find(basename);
-	    if ( exp_it != experiments.end() ){
-	      TimblThread *client = new TimblThread( exp_it->second, args );
+	    if ( urlDecode( basename ).find( "," ) != string::npos ){
+	      classified += fan_out_request( args, urlDecode( basename ),
+					     qstring, Line, numa_node,
+					     client_class, timer );
+	      streamed = true; // fan_out_request finished the answer
+	    }
+	    else if ( exp_it != experiments.end() ){
+	      affinity.bind_experiment( basename, numa_node );
+	      Fallbacks::Route route = fallbacks.route( basename );
+	      TimblThread *client
+		= new TimblThread( find_experiment( route.base(), numa_node ),
+				   args );
 	      if ( client ){
 		TiCC::LogStream LS( &logstream() );
 		TiCC::LogStream DS( &logstream() );
@@ -128,19 +379,15 @@ void HttpServer::callback( childArgs *args ){
 		xmlDocSetRootElement( doc, root );
 		TiCC::XmlSetAttribute( root, "algorithm",
 				       TiCC::toString(client->_exp->Algorithm()) );
-		vector<string> avs = TiCC::split_at( qstring, "&" );
-		if ( !avs.empty() ){
-		  multimap<string,string> acts;
-		  for ( const auto& av : avs ){
-		    vector<string> parts = TiCC::split_at( av, "=", 2 );
-		    if ( parts.size() == 2 ){
-		      acts.insert( make_pair(parts[0], parts[1]) );
-		    }
-		    else {
-		      LS << "unknown word in query "
-			 << av << endl;
-		    }
-		  }
+		if ( fallbacks.has_fallback( basename ) ){
+		  // the base that really answers
+		  TiCC::XmlSetAttribute( root, "engine", route.base() );
+		}
+		string first_instance;
+		multimap<string,string> acts = parse_query( qstring, LS );
+		ChunkedXml chunked( args->os(), root );
+		bool stream = want_streaming( acts, Line );
+		if ( !acts.empty() ){
 		  auto range = acts.equal_range( "set" );
 		  auto it = range.first;
 		  while ( it != range.second ){
@@ -154,13 +401,22 @@ void HttpServer::callback( childArgs *args ){
 		    if ( !client->setOptions( opt ) ){
 		      LS << ": Don't understand set='"
 			 << opt << "'" << endl;
-		      args->os() << ": Don't understand set='"
-			 << it->second << "'" << endl;
+		      if ( stream ){
+			// nothing may precede the HTTP headers
+			TiCC::XmlNewTextChild( root, "error",
+					       "Don't understand set='"
+					       + it->second + "'" );
+		      }
+		      else {
+			args->os() << ": Don't understand set='"
+				   << it->second << "'" << endl;
+		      }
 		    }
 		    ++it;
 		  }
 		  range = acts.equal_range( "show" );
 		  it = range.first;
+		  nlohmann::json profile_json;
 		  while ( it != range.second ){
 		    if ( it->second == "settings" ){
 		      xmlNode *node = client->_exp->settingsToXML();
@@ -170,31 +426,48 @@ void HttpServer::callback( childArgs *args ){
 		      xmlNode *node = client->_exp->weightsToXML();
 		      xmlAddChild( root, node );
 		    }
+		    else if ( it->second == "stats" ){
+		      TiCC::XmlNewTextChild( root, "stats",
+					     stats_to_json().dump() );
+		    }
+		    else if ( profile_request( it->second, logstream(),
+					       profile_json ) ){
+		      TiCC::XmlNewTextChild( root, "profile",
+					     profile_json.dump() );
+		    }
 		    else
 		      LS << "don't know how to SHOW: "
 			 << it->second << endl;
 
 		    ++it;
 		  }
+		  range = acts.equal_range( "learn" );
+		  it = range.first;
+		  while ( it != range.second ){
+		    string instance = strip_quotes( urlDecode( it->second ) );
+		    string error;
+		    xmlNode *node = TiCC::XmlNewChild( root, "learn" );
+		    TiCC::XmlNewTextChild( node, "input", instance );
+		    if ( learner.add( basename, instance, error ) ){
+		      TiCC::XmlSetAttribute( node, "status", "queued" );
+		    }
+		    else {
+		      TiCC::XmlNewTextChild( node, "error", error );
+		    }
+		    ++it;
+		  }
+		  if ( stream ){
+		    args->socket()->setBlocking();
+		    stream = chunked.start();
+		  }
 		  range = acts.equal_range( "classify" );
 		  it = range.first;
+		  size_t num_instances = 0;
 		  while ( it != range.second ){
 		    string params = it->second;
 		    params = urlDecode(params);
-		    int len = params.length();
-		    if ( len > 2 ){
-		      DS << "params=" << params << endl
-			 << "params[0]='"
-			 << params[0] << "'" << endl
-			 << "params[len-1]='"
-			 << params[len-1] << "'"
-			 << endl;
-
-		      if ( ( params[0] == '"' && params[len-1] == '"' )
-			   || ( params[0] == '\'' && params[len-1] == '\'' ) ){
-			params = params.substr( 1, len-2 );
-		      }
-		    }
+		    DS << "params=" << params << endl;
+		    params = strip_quotes( params );
 		    DS << "base='" << basename << "'"
 		       << endl
 		       << "command='classify'"
@@ -204,7 +477,30 @@ void HttpServer::callback( childArgs *args ){
 		    if ( doDebug() ){
 		      LS << "Classify(" << params << ")" << endl;
 		    }
-		    if ( client->_exp->Classify( params, answer, distrib, distance ) ){
+		    if ( num_instances++ == 0 ){
+		      first_instance = params;
+		    }
+		    timer.mark( StageTimer::Parse );
+		    Scheduler::Slot slot = scheduler.acquire( route.base(),
+							      client_class );
+		    timer.mark( StageTimer::Queue );
+		    bool ok = false;
+		    if ( slot ){
+		      {
+			ProfileTag tag( "http", route.base() );
+			PerfScope counted( perf, route.base() );
+			ok = client->_exp->Classify( params, answer,
+						     distrib, distance );
+		      }
+		      timer.mark( StageTimer::Classify );
+		    }
+		    xmlNode *cl = 0;
+		    if ( !slot ){
+		      cl = TiCC::XmlNewChild( root, "classification" );
+		      TiCC::XmlNewTextChild( cl, "input", params );
+		      TiCC::XmlNewTextChild( cl, "error", "server busy" );
+		    }
+		    else if ( ok ){
 
 		      if ( doDebug() ){
 			LS << "resultaat: " << answer
@@ -212,38 +508,39 @@ void HttpServer::callback( childArgs *args ){
 			   << ", distance " << distance
 			   << endl;
 		      }
-		      xmlNode *cl = TiCC::XmlNewChild( root, "classification" );
-		      TiCC::XmlNewTextChild( cl, "input", params );
-		      TiCC::XmlNewTextChild( cl, "category", answer );
-		      if ( client->_exp->Verbosity(DISTRIB) ){
-			TiCC::XmlNewTextChild( cl, "distribution", distrib );
-		      }
-		      if ( client->_exp->Verbosity(DISTANCE) ){
-			TiCC::XmlNewTextChild( cl, "distance",
-					       TiCC::toString<double>(distance) );
-		      }
-		      if ( client->_exp->Verbosity(CONFIDENCE) ){
-		       	TiCC::XmlNewTextChild( cl, "confidence",
-		       			       TiCC::toString<double>( client->_exp->confidence() ) );
-		      }
-		      if ( client->_exp->Verbosity(MATCH_DEPTH) ){
-			TiCC::XmlNewTextChild( cl, "match_depth",
-					       TiCC::toString<double>( client->_exp->matchDepth()) );
-		      }
-		      if ( client->_exp->Verbosity(NEAR_N) ){
-			xmlNode *nb = client->_exp->bestNeighborsToXML();
-			xmlAddChild( cl, nb );
-		      }
+		      ++classified;
+		      cl = TiCC::XmlNewChild( root, "classification" );
+		      classification_to_xml( cl, client->_exp, params,
+					     answer, distrib, distance );
 		    }
 		    else {
 		      DS << "classification failed" << endl;
 		    }
+		    if ( cl && stream ){
+		      chunked.send( cl );
+		    }
+		    timer.mark( StageTimer::Write );
 		    ++it;
 		  }
+		  if ( num_instances > 1 ){
+		    first_instance += " (+" + to_string( num_instances-1 )
+		      + " more)";
+		  }
+		}
+		if ( stream ){
+		  chunked.finish();
+		  streamed = true;
 		}
-		string out_line = TiCC::serialize(*doc);
-		timeout=10;
-		nb_putline( args->os(), out_line , timeout );
+		else {
+		  string out_line = TiCC::serialize(*doc);
+		  timeout=10;
+		  nb_putline( args->os(), out_line , timeout );
+		}
+		xmlFreeDoc( doc );
+		timer.mark( StageTimer::Write );
+		slowlog.check( "http", basename, client->options,
+			       first_instance, timer );
+		AllocTracker::record( "http", basename, timer );
 		delete client;
 	      }
 	    }
@@ -252,10 +549,14 @@ void HttpServer::callback( childArgs *args ){
 			  << "'" << endl;
 	      args->os() << "invalid basename: '" << basename << "'" << endl;
 	    }
-	    args->os() << endl;
+	    if ( !streamed ){
+	      args->os() << endl;
+	    }
 	  }
 	}
       }
     }
   }
+  capture.close( capture_id );
+  affinity.count( numa_node, classified );
 }
@@ -28,6 +28,7 @@
 
 #include <exception>
 #include <vector>
+#include <sstream>
 #include <string>
 #include <cstdlib>
 
@@ -37,6 +38,8 @@
 #include "ticcutils/json.hpp"
 #include "ticcutils/ServerBase.h"
 #include "timblserver/TimblServer.h"
+#include "timblserver/Protocol.h"
+#include "timblserver/ShmTransport.h"
 
 using namespace std;
 using namespace Timbl;
@@ -46,24 +49,19 @@ using namespace nlohmann;
 
 using TiCC::operator<<;
 
-#define LOG *TiCC::Log(logstream())
-#define DBG *TiCC::Dbg(logstream())
+#define LOG ASYNC_LOG( async_log, logstream() )
+#define DBG ASYNC_DBG( async_log, logstream() )
 
-#define SDBG *TiCC::Dbg(client->myLog)
+#define SDBG ASYNC_DBG( async_log, client->myLog )
 
 
-json json_error( const string& message ){
-  json result;
-  result["status"] = "error";
-  result["message"] = message;
-  return result;
-}
-
 json JsonServer::classify_to_json( TimblThread *client,
 				   const vector<string>& params ) const {
   SDBG << "classify_to_json(" << params << ")" << endl;
   TimblExperiment *_exp = client->_exp;
   json result;
+  ProfileTag tag( "json", client->base() );
+  PerfScope counted( perf, client->base() );
   if ( params.size() > 1 ){
     result = _exp->classify_to_JSON( params );
   }
@@ -75,16 +73,24 @@ json JsonServer::classify_to_json( TimblThread *client,
 }
 
 bool JsonServer::read_json( istream& is,
-			    json& the_json ){
+			    json& the_json,
+			    StageTimer *timer ){
   the_json.clear();
   string json_line;
+  if ( timer ){
+    timer->reset();
+  }
   if ( getline( is, json_line ) ){
-    try {
-      the_json = json::parse( json_line );
+    if ( timer ){
+      timer->mark( StageTimer::Read );
     }
-    catch ( const exception& e ){
+    string error;
+    if ( !parse_json_request( json_line, the_json, error ) ){
       cerr << "json parsing failed on '" << json_line + "':"
-	  << e.what() << endl;
+	  << error << endl;
+    }
+    if ( timer ){
+      timer->mark( StageTimer::Parse );
     }
     DBG << "Read JSON: " << the_json << endl;
     return true;
@@ -92,18 +98,131 @@ bool JsonServer::read_json( istream& is,
   return false;
 }
 
+json JsonServer::classify_tagged( FanOut& clones,
+				  const string& base,
+				  const string& options,
+				  const string& client_class,
+				  const vector<string>& params,
+				  StageTimer& timer ){
+  // classify the instances of a multiplexed request, on a worker of
+  // the Multiplexer of the connection, with its clones
+  Fallbacks::Route route = fallbacks.route( base );
+  string error;
+  TimblThread *worker = 0;
+  if ( !batcher.enabled() ){
+    worker = clones.client( route.base(), options, error );
+    if ( !worker ){
+      return json_error( error );
+    }
+  }
+  Scheduler::Slot slot = scheduler.acquire( route.base(), client_class );
+  timer.mark( StageTimer::Queue );
+  if ( !slot ){
+    return json_error( "server busy: base '" + route.base()
+		       + "' is overloaded" );
+  }
+  json result;
+  if ( batcher.enabled() ){
+    Batcher::Work work = [&]( TimblExperiment *exp ){
+      ProfileTag tag( "json", route.base() );
+      PerfScope counted( perf, route.base() );
+      if ( params.size() > 1 ){
+	result = exp->classify_to_JSON( params );
+      }
+      else {
+	result = exp->classify_to_JSON( params[0] );
+      }
+    };
+    if ( !batcher.run( route.base(), options, work, error ) ){
+      return json_error( error );
+    }
+  }
+  else {
+    result = classify_to_json( worker, params );
+  }
+  if ( fallbacks.has_fallback( base ) ){
+    // tell which base really answered
+    if ( result.is_array() ){
+      for ( auto& answer : result ){
+	answer["engine"] = route.base();
+      }
+    }
+    else {
+      result["engine"] = route.base();
+    }
+  }
+  timer.mark( StageTimer::Classify );
+  return result;
+}
+
 void JsonServer::callback( childArgs *args ){
-  JsonServer *theServer = dynamic_cast<JsonServer*>( args->mother() );
+  serve( args, args->is(), args->os() );
+}
+
+void JsonServer::shm_callback( childArgs *args ){
+  // a shared memory session. The client sends the name of the segment it
+  // created on this control connection, and keeps it open as long as the
+  // session lasts
+  string name;
+  if ( !getline( args->is(), name ) ){
+    return;
+  }
+  name = TiCC::trim( name );
+  if ( name.compare( 0, 7, "/timbl-" ) != 0
+       || name.find( '/', 1 ) != string::npos ){
+    args->os() << "ERROR invalid segment name: " << name << endl;
+    return;
+  }
+  ShmChannel channel;
+  if ( !channel.open( name ) ){
+    args->os() << "ERROR " << channel.getMessage() << endl;
+    return;
+  }
+  args->os() << "OK" << endl;
+  LOG << args->id() << " shared memory session on " << name << endl;
+  int fd = args->id();
+  ShmStream stream( channel, true, [fd](){ return peer_alive( fd ); } );
+  serve( args, stream, stream );
+}
+
+void JsonServer::serve( childArgs *args, istream& is, ostream& os ){
+  // one session: requests are read from 'is' and answered on 'os'. For a
+  // socket these are the streams of 'args', other transports bring their own
+  ProfileTag profile_tag( "json" );
   int sockId = args->id();
+  AllocConnection alloc_connection( "json", sockId, logstream() );
   TimblThread *client = 0;
   int result = 0;
+  int numa_node = affinity.bind_connection();
+  string client_class = scheduler.client_class( sockId );
+  string base_name;
+  FanOut fan_out( this, args, numa_node, client_class, true );
+  atomic<int> multiplexed_result( 0 );
+  Multiplexer multiplexer( this, args, numa_node, client_class, true, os );
+  unsigned long capture_id = capture.open( "json" );
+  // other transports than the socket can't be watched for idleness
+  Session session( sessions, &is == &args->is() ? sockId : -1, is );
+  string released_options;
+  auto release = [&](){
+    // idle: free our clones until the next request
+    if ( client ){
+      released_options = client->options;
+      delete client;
+      client = 0;
+    }
+    fan_out.release();
+    multiplexer.release();
+    DBG << sockId << " idle, clones released" << endl;
+  };
   json out_json;
   out_json["status"] = "ok";
   if ( experiments.size() == 1
        && experiments.find("default") != experiments.end() ){
     DBG << "Before Create Default Client " << endl;
-    TimblExperiment *exp = experiments["default"];
+    shared_ptr<TimblExperiment> exp = find_experiment( "default", numa_node );
+    affinity.bind_experiment( "default", numa_node );
     client = new TimblThread( exp, args, true );
+    base_name = "default";
     DBG << "After Create Client " << endl;
     // report connection to the server terminal
     //
@@ -116,14 +235,39 @@ void JsonServer::callback( childArgs *args ){
     out_json["available_bases"] = arr;
   }
   DBG << "send JSON: " << out_json.dump(2) << endl;
-  args->os() << out_json << endl;
+  os << out_json << endl;
 
   json in_json;
   bool go_on = true;
-  while ( go_on && theServer->read_json( args->is(), in_json ) ){
+  // answers are put together here, and written in one go: the workers of
+  // the multiplexer may write theirs in between, but not halfway
+  ostringstream reply;
+  auto send_reply = [&](){
+    if ( reply.tellp() > 0 ){
+      multiplexer.write( reply.str() );
+      reply.str( "" );
+    }
+  };
+  StageTimer timer;
+  while ( go_on && session.wait( release ) && read_json( is, in_json, &timer ) ){
     if ( in_json.empty() ){
       continue;
     }
+    if ( !client && !base_name.empty() ){
+      // released while idle
+      client = new TimblThread( find_experiment( base_name, numa_node ),
+				args, true );
+      if ( !released_options.empty() ){
+	client->setOptions( released_options );
+      }
+      session.revived();
+    }
+    if ( capture_id ){
+      // the request as parsed, so it is guaranteed to be on one line
+      capture.record( capture_id,
+		      in_json.dump( -1, ' ', false,
+				    json::error_handler_t::replace ) );
+    }
     DBG << "handling JSON: " << in_json.dump(2) << endl;
     DBG << "running FromSocket: " << sockId << endl;
     string command;
@@ -131,18 +275,72 @@ void JsonServer::callback( childArgs *args ){
     if ( in_json.find("command") != in_json.end() ){
       command = in_json["command"];
     }
+    // a classify request with an id is answered as soon as it is ready,
+    // perhaps before requests read earlier. It may name its own base
+    bool multiplexed = command == "classify"
+      && in_json.find("id") != in_json.end();
+    string request_base = base_name;
+    if ( multiplexed
+	 && in_json.find("base") != in_json.end()
+	 && in_json["base"].is_string() ){
+      request_base = in_json["base"];
+    }
+    if ( command == "exit" ){
+      multiplexer.drain();
+    }
     if ( command.empty() ){
       DBG << sockId << " Don't understand '" << in_json << "'" << endl;
       json err_json = json_error( "Illegal instruction:'"
 				  + in_json.dump() + "'" );
-      args->os() << err_json << endl;
+      reply << err_json << endl;
     }
     else {
       vector<string> params;
+      string code_error;
+      if ( command == "classify"
+	   && in_json.find("codes") != in_json.end() ){
+	// instances coded with the vocabulary of the base
+	const Vocabulary *vocab = find_vocabulary( request_base );
+	string version;
+	if ( in_json.find("version") != in_json.end()
+	     && in_json["version"].is_string() ){
+	  version = in_json["version"];
+	}
+	json codes = in_json["codes"];
+	if ( in_json.find("param") != in_json.end()
+	     || in_json.find("params") != in_json.end() ){
+	  code_error = "'codes' can't be used with 'param' or 'params'";
+	}
+	else if ( !vocab ){
+	  code_error = "no vocabulary for base '" + request_base + "'";
+	}
+	else if ( version != vocab->version() ){
+	  code_error = "stale vocabulary version: '" + version
+	    + "', current is '" + vocab->version() + "'";
+	}
+	else if ( !codes.is_array() || codes.empty() ){
+	  code_error = "'codes' must be a non-empty array";
+	}
+	else {
+	  if ( !codes[0].is_array() ){
+	    // just one instance
+	    codes = json::array( { codes } );
+	  }
+	  for ( const auto& instance : codes ){
+	    string line;
+	    if ( !vocab->decode( instance, line, code_error ) ){
+	      params.clear();
+	      break;
+	    }
+	    params.push_back( line );
+	  }
+	}
+      }
       if ( in_json.find("param") != in_json.end() ){
 	param = in_json["param"];
       }
-      else if ( in_json.find("params") != in_json.end() ){
+      else if ( params.empty()
+		&& in_json.find("params") != in_json.end() ){
 	json pars = in_json["params"];
 	if ( pars.is_array() ){
 	  for ( auto const& par : pars ){
@@ -160,7 +358,7 @@ void JsonServer::callback( childArgs *args ){
       if ( command == "base" ){
 	if ( param.empty() ){
 	  json err_json = json_error( "missing 'param' for base command " );
-	  args->os() << err_json << endl;
+	  reply << err_json << endl;
 	}
 	else {
 	  auto it = experiments.find(param);
@@ -170,7 +368,10 @@ void JsonServer::callback( childArgs *args ){
 	      delete client;
 	    }
 	    DBG << sockId << " before Create Default Client " << endl;
-	    client = new TimblThread( it->second, args, true );
+	    affinity.bind_experiment( param, numa_node );
+	    client = new TimblThread( find_experiment( param, numa_node ),
+				      args, true );
+	    base_name = param;
 	    DBG << sockId << " after Create Client " << endl;
 	    // report connection to the server terminal
 	    //
@@ -178,48 +379,59 @@ void JsonServer::callback( childArgs *args ){
 		<< " on Socket " << sockId << " started." << endl;
 	    out_json.clear();
 	    out_json["base"] = param;
-	    args->os() << out_json << endl;
+	    reply << out_json << endl;
 	  }
 	  else {
 	    json err_json = json_error( "Unknown basename: '" + param + "'" );
-	    args->os() << err_json << endl;
+	    reply << err_json << endl;
 	  }
 	}
       }
       else if ( command == "set" ){
 	if ( !client ){
 	  json err_json = json_error( "'set' failed: you haven't selected a base yet!" );
-	  args->os() << err_json << endl;
+	  reply << err_json << endl;
 	}
 	else {
 	  if ( param.empty() ){
 	    json err_json = json_error( "missing 'param' for set command " );
-	    args->os() << err_json << endl;
+	    reply << err_json << endl;
 	  }
 	  else {
 	    out_json.clear();
 	    if ( client->setOptions( param ) ){
 	      DBG << sockId << " setOptions: " << param << endl;
 	      out_json["status"] = "ok";
-	      args->os() << out_json << endl;
+	      reply << out_json << endl;
 	    }
 	    else {
 	      DBG << sockId<< " Don't understand set(" << param << ")" << endl;
 	      json err_json = json_error("set( " + param + ") failed" );
-	      args->os() << err_json << endl;
+	      reply << err_json << endl;
 	    }
 	  }
 	}
       }
       else if ( command == "query"
 		|| command == "show" ){
-	if ( !client ){
+	if ( param == "stats" ){
+	  out_json = stats_to_json();
+	  reply << out_json << endl;
+	}
+	else if ( param == "health" ){
+	  out_json = health_to_json();
+	  reply << out_json << endl;
+	}
+	else if ( profile_request( param, logstream(), out_json ) ){
+	  reply << out_json << endl;
+	}
+	else if ( !client ){
 	  json err_json = json_error( "'show' failed: no base selected" );
-	  args->os() << err_json << endl;
+	  reply << err_json << endl;
 	}
 	else if ( param.empty() ){
 	  json err_json = json_error( "missing 'param' for " + command + " command " );
-	  args->os() << err_json << endl;
+	  reply << err_json << endl;
 	}
 	else {
 	  out_json.clear();
@@ -233,25 +445,221 @@ void JsonServer::callback( childArgs *args ){
 	    out_json = json_error( "'show' failed, unknown parameter: "
 				   + param );
 	  }
-	  args->os() << out_json << endl;
+	  reply << out_json << endl;
+	}
+      }
+      else if ( command == "vocabulary" ){
+	const Vocabulary *vocab = find_vocabulary( base_name );
+	if ( !client ){
+	  json err_json = json_error( "'vocabulary' failed: no base selected" );
+	  reply << err_json << endl;
+	}
+	else if ( !vocab ){
+	  json err_json = json_error( "no vocabulary for base '"
+				      + base_name + "'" );
+	  reply << err_json << endl;
+	}
+	else {
+	  out_json = vocab->to_json();
+	  out_json["base"] = base_name;
+	  reply << out_json << endl;
+	}
+      }
+      else if ( command == "learn" ){
+	// add labelled instance(s) to the selected base
+	string error;
+	if ( !param.empty() ){
+	  params.push_back( param );
+	}
+	if ( !client ){
+	  error = "'learn' failed: you haven't selected a base yet!";
+	}
+	else if ( in_json.find("codes") != in_json.end() ){
+	  // decoded instances carry no class to learn
+	  error = "'codes' can't be used with 'learn'";
+	}
+	else if ( params.empty() ){
+	  error = "missing 'param' or 'params' for 'learn'";
+	}
+	size_t added = 0;
+	for ( const auto& instance : params ){
+	  if ( !error.empty() || !learner.add( base_name, instance, error ) ){
+	    break;
+	  }
+	  ++added;
+	}
+	if ( error.empty() ){
+	  out_json.clear();
+	  out_json["status"] = "ok";
+	  out_json["queued"] = added;
+	}
+	else {
+	  out_json = json_error( error );
+	  out_json["queued"] = added;
 	}
+	reply << out_json << endl;
       }
       else if ( command == "exit" ){
 	out_json.clear();
 	out_json["status"] = "closed";
-	args->os() << out_json << endl;
+	reply << out_json << endl;
 	go_on = false;
       }
+      else if ( multiplexed ){
+	json id = in_json["id"];
+	string error;
+	if ( !code_error.empty() ){
+	  error = code_error;
+	}
+	else if ( !param.empty() && !params.empty() ){
+	  error = "both 'param' and 'params' found";
+	}
+	else if ( request_base.empty() ){
+	  error = "'classify' failed: you haven't selected a base yet!";
+	}
+	else if ( experiments.find( request_base ) == experiments.end() ){
+	  error = "Unknown basename: '" + request_base + "'";
+	}
+	else if ( in_json.find("bases") != in_json.end() ){
+	  error = "'bases' can't be used with 'id'";
+	}
+	else if ( params.empty() && param.empty() ){
+	  error = "missing 'param' or 'params' for 'classify'";
+	}
+	if ( !error.empty() ){
+	  json err_json = json_error( error );
+	  err_json["id"] = id;
+	  multiplexer.write( err_json.dump() + "\n" );
+	}
+	else {
+	  if ( !param.empty() ){
+	    params.push_back( param );
+	  }
+	  string options = client ? client->options : "";
+	  multiplexer.submit( [this,id,request_base,options,params,
+			       client_class,&multiplexer,
+			       &multiplexed_result]( FanOut& clones ){
+	      StageTimer job_timer;
+	      json answer;
+	      try {
+		answer = classify_tagged( clones, request_base, options,
+					  client_class, params, job_timer );
+	      }
+	      catch ( const exception& e ){
+		// the client waits for an answer with this id
+		answer = json_error( e.what() );
+	      }
+	      json tagged;
+	      if ( answer.is_array() ){
+		tagged["id"] = id;
+		tagged["results"] = answer;
+	      }
+	      else {
+		tagged = answer;
+		tagged["id"] = id;
+	      }
+	      if ( !answer.is_object()
+		   || answer.find("error") == answer.end() ){
+		multiplexed_result += params.size();
+	      }
+	      DBG << "JsonServer::sending JSON:" << endl << tagged << endl;
+	      multiplexer.write( tagged.dump() + "\n" );
+	      job_timer.mark( StageTimer::Write );
+	      if ( slowlog.is_slow( job_timer ) ){
+		string instance = params[0];
+		if ( params.size() > 1 ){
+		  instance += " (+" + to_string( params.size()-1 ) + " more)";
+		}
+		slowlog.check( "json", request_base, options,
+			       instance, job_timer );
+	      }
+	      AllocTracker::record( "json", request_base, job_timer );
+	    } );
+	}
+      }
+      else if ( command == "classify"
+		&& in_json.find("bases") != in_json.end() ){
+	// the same instance(s) for several bases, in parallel
+	string bases_string;
+	if ( in_json["bases"].is_array() ){
+	  for ( const auto& b : in_json["bases"] ){
+	    if ( b.is_string() ){
+	      bases_string += b.get<string>() + ",";
+	    }
+	  }
+	}
+	else if ( in_json["bases"].is_string() ){
+	  bases_string = in_json["bases"];
+	}
+	vector<string> bases;
+	string error;
+	if ( !param.empty() ){
+	  params.push_back( param );
+	}
+	if ( in_json.find("codes") != in_json.end() ){
+	  error = "'codes' can't be used with 'bases'";
+	}
+	else if ( params.empty() ){
+	  error = "missing 'param' or 'params' for 'classify'";
+	}
+	else {
+	  fan_out.parse_bases( bases_string, bases, error );
+	}
+	if ( !error.empty() ){
+	  json err_json = json_error( error );
+	  reply << err_json << endl;
+	}
+	else {
+	  timer.mark( StageTimer::Parse );
+	  vector<json> answers( bases.size() );
+	  vector<string> errors
+	    = fan_out.run( bases,
+			   client ? client->options : "",
+			   [&]( size_t i, TimblThread *worker ){
+			     answers[i] = classify_to_json( worker, params );
+			   } );
+	  timer.mark( StageTimer::Classify );
+	  out_json = json::object();
+	  for ( size_t i=0; i < bases.size(); ++i ){
+	    if ( errors[i].empty() ){
+	      out_json[bases[i]] = answers[i];
+	      result += params.size();
+	    }
+	    else {
+	      out_json[bases[i]] = json_error( errors[i] );
+	    }
+	  }
+	  json answer;
+	  answer["bases"] = out_json;
+	  DBG << "JsonServer::sending JSON:" << endl << answer << endl;
+	  reply << answer << endl;
+	  send_reply();
+	  timer.mark( StageTimer::Write );
+	  if ( slowlog.is_slow( timer ) ){
+	    string instance = params[0];
+	    if ( params.size() > 1 ){
+	      instance += " (+" + to_string( params.size()-1 ) + " more)";
+	    }
+	    slowlog.check( "json", bases_string,
+			   client ? client->options : "", instance, timer );
+	  }
+	  AllocTracker::record( "json", bases_string, timer );
+	}
+      }
       else if ( command == "classify" ){
 	if ( !client ){
 	  json err_json = json_error( "'classify' failed: you haven't selected a base yet!" );
-	  args->os() << err_json << endl;
+	  reply << err_json << endl;
+	}
+	else if ( !code_error.empty() ){
+	  json err_json = json_error( code_error );
+	  reply << err_json << endl;
 	}
 	else {
 	  if ( params.empty() ){
 	    if ( param.empty() ){
 	      json err_json = json_error( "missing 'param' or 'params' for 'classify'" );
-	      args->os() << err_json << endl;
+	      reply << err_json << endl;
 	    }
 	    else {
 	      params.push_back( param );
@@ -259,12 +667,80 @@ void JsonServer::callback( childArgs *args ){
 	  }
 	  else if ( !param.empty() ){
 	    json err_json = json_error( "both 'param' and 'params' found" );
-	    args->os() << err_json << endl;
+	    reply << err_json << endl;
+	    params.clear();
+	  }
+	  Scheduler::Slot slot;
+	  Fallbacks::Route route;
+	  TimblThread *worker = client;
+	  if ( !params.empty() ){
+	    refresh( client, base_name );
+	    timer.mark( StageTimer::Parse );
+	    route = fallbacks.route( base_name );
+	    string error;
+	    if ( route.fallback() && !batcher.enabled() ){
+	      worker = fan_out.client( route.base(), client->options, error );
+	    }
+	    slot = scheduler.acquire( route.base(), client_class );
+	    timer.mark( StageTimer::Queue );
+	    if ( !worker ){
+	      json err_json = json_error( error );
+	      reply << err_json << endl;
+	      params.clear();
+	    }
+	    else if ( !slot ){
+	      json err_json = json_error( "server busy: base '" + route.base()
+					  + "' is overloaded" );
+	      reply << err_json << endl;
+	      params.clear();
+	    }
+	  }
+	  if ( !params.empty() && batcher.enabled() ){
+	    // classify on a worker of the batcher
+	    string error;
+	    Batcher::Work work = [&]( TimblExperiment *exp ){
+	      ProfileTag tag( "json", route.base() );
+	      PerfScope counted( perf, route.base() );
+	      if ( params.size() > 1 ){
+		out_json = exp->classify_to_JSON( params );
+	      }
+	      else {
+		out_json = exp->classify_to_JSON( params[0] );
+	      }
+	    };
+	    if ( !batcher.run( route.base(), client->options, work, error ) ){
+	      out_json = json_error( error );
+	    }
+	  }
+	  else if ( !params.empty() ){
+	    out_json = classify_to_json( worker, params );
 	  }
 	  if ( !params.empty() ){
-	    out_json = classify_to_json( client, params );
+	    if ( fallbacks.has_fallback( base_name ) ){
+	      // tell which base really answered
+	      if ( out_json.is_array() ){
+		for ( auto& answer : out_json ){
+		  answer["engine"] = route.base();
+		}
+	      }
+	      else {
+		out_json["engine"] = route.base();
+	      }
+	    }
+	    timer.mark( StageTimer::Classify );
 	    DBG << "JsonServer::sending JSON:" << endl << out_json << endl;
-	    args->os() << out_json << endl;
+	    reply << out_json << endl;
+	    send_reply();
+	    timer.mark( StageTimer::Write );
+	    if ( slowlog.is_slow( timer ) ){
+	      string instance = params[0];
+	      if ( params.size() > 1 ){
+		instance += " (+" + to_string( params.size()-1 ) + " more)";
+	      }
+	      slowlog.check( "json", base_name, client->options,
+			     instance, timer );
+	    }
+	    AllocTracker::record( "json", base_name, timer );
 	    if ( out_json.find("error") == out_json.end() ){
 	      result += out_json.size();
 	    }
@@ -273,11 +749,24 @@ void JsonServer::callback( childArgs *args ){
       }
       else {
 	json err_json = json_error( "Unknown command: '" + command + "'" );
-	args->os() << err_json << endl;
+	reply << err_json << endl;
       }
     }
+    send_reply();
+  }
+  multiplexer.drain();
+  result += multiplexed_result;
+  if ( session.limit_reached() ){
+    out_json.clear();
+    out_json["status"] = "closed";
+    out_json["reason"] = session.reason() + " limit reached";
+    os << out_json << endl;
+    LOG << sockId << " connection closed, " << session.reason()
+	<< " limit reached" << endl;
   }
   delete client;
+  capture.close( capture_id );
+  affinity.count( numa_node, result );
   LOG << sockId << " Thread " << (uintptr_t)pthread_self()
 	      << " terminated, " << result
 	      << " instances processed " << endl;
@@ -0,0 +1,355 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <algorithm>
+
+#include "ticcutils/StringOps.h"
+#include "ticcutils/Unicode.h"
+#include "timbl/TimblAPI.h"
+#include "timblserver/Experiments.h"
+#include "timblserver/Learner.h"
+
+using namespace std;
+using namespace Timbl;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  using Clock = chrono::steady_clock;
+
+  static double ms_between( Clock::time_point from, Clock::time_point to ){
+    return chrono::duration<double,milli>( to - from ).count();
+  }
+
+  static size_t positive_setting( const TiCC::Configuration *config,
+				  const string& key,
+				  size_t def ){
+    string value = config->lookUp( key );
+    if ( value.empty() ){
+      return def;
+    }
+    size_t result = 0;
+    if ( !TiCC::stringTo( value, result ) || result == 0 ){
+      throw runtime_error( "invalid value for '" + key + "': " + value );
+    }
+    return result;
+  }
+
+  Learner::Learner( const TiCC::Configuration *config ):
+    all(false),
+    batch(100),
+    interval_ms(1000),
+    max_queue(100000),
+    log(0),
+    stopping(false),
+    queued(0),
+    learned(0),
+    rejected(0),
+    dropped(0),
+    published(0),
+    rebuilt(0),
+    apply_s(0),
+    last_publish_ms(0),
+    max_publish_ms(0),
+    total_lag_ms(0),
+    max_lag_ms(0),
+    lagged(0)
+  {
+    string value = config->lookUp( "learn" );
+    if ( value.empty() ){
+      return;
+    }
+    string lvalue = TiCC::lowercase( value );
+    if ( lvalue == "yes" || lvalue == "true" ){
+      all = true;
+    }
+    else if ( lvalue != "no" && lvalue != "false" ){
+      for ( const auto& b : TiCC::split_at( value, "," ) ){
+	wanted.insert( TiCC::trim( b ) );
+      }
+    }
+    batch = positive_setting( config, "learn_batch", batch );
+    interval_ms = positive_setting( config, "learn_interval", interval_ms );
+    max_queue = positive_setting( config, "learn_queue", max_queue );
+  }
+
+  Learner::~Learner(){
+    if ( learner_thread.joinable() ){
+      {
+	lock_guard<mutex> lock( mtx );
+	stopping = true;
+      }
+      cv.notify_all();
+      learner_thread.join();
+    }
+  }
+
+  void Learner::setup( const map<string,TimblExperiment*>& experiments,
+		       const TiCC::Configuration *config,
+		       TiCC::LogStream& s_log ){
+    // take over the loaded bases which may learn, and make a private
+    // copy of each of them
+    if ( !enabled() ){
+      return;
+    }
+    log = &s_log;
+    cache_dir = cache_directory( config, s_log );
+    map<string,string> definitions = experiment_definitions( config );
+    for ( const auto& name : wanted ){
+      if ( experiments.find( name ) == experiments.end() ){
+	s_log << "learn: unknown base '" << name << "' skipped" << endl;
+      }
+    }
+    for ( const auto& it : experiments ){
+      if ( !all && wanted.find( it.first ) == wanted.end() ){
+	continue;
+      }
+      Base& b = bases[it.first];
+      b.params = definitions[it.first];
+      // the loaded base is version 0. It is owned by the server
+      b.current = shared_ptr<TimblExperiment>( it.second,
+					       []( TimblExperiment* ){} );
+      b.spare.reset( build_spare( it.first, b ) );
+      if ( !b.spare ){
+	throw runtime_error( "learn: unable to copy base " + it.first );
+      }
+      s_log << "learn: base " << it.first << " accepts new instances"
+	    << endl;
+    }
+  }
+
+  shared_ptr<TimblExperiment> Learner::current( const string& name ) const {
+    // the published version of base 'name'. Empty if it doesn't learn
+    auto it = bases.find( name );
+    if ( it == bases.end() ){
+      return shared_ptr<TimblExperiment>();
+    }
+    return atomic_load( &it->second.current );
+  }
+
+  bool Learner::add( const string& name,
+		     const string& instance,
+		     string& error ){
+    // queue an instance for base 'name'
+    if ( !learns( name ) ){
+      error = "base '" + name + "' doesn't learn";
+      return false;
+    }
+    if ( instance.empty() ){
+      error = "no instance to learn";
+      return false;
+    }
+    size_t waiting;
+    {
+      lock_guard<mutex> lock( mtx );
+      if ( queue.size() >= max_queue ){
+	++dropped;
+	error = "learn queue is full";
+	return false;
+      }
+      queue.push_back( Pending{ name, instance, Clock::now() } );
+      ++queued;
+      waiting = queue.size();
+      if ( !learner_thread.joinable() ){
+	// started here, not in setup(): a thread started before the
+	// server forks would be lost
+	learner_thread = thread( &Learner::run, this );
+      }
+    }
+    if ( waiting == 1 || waiting >= batch ){
+      cv.notify_one();
+    }
+    return true;
+  }
+
+  void Learner::run(){
+    unique_lock<mutex> lock( mtx );
+    while ( !stopping ){
+      if ( queue.empty() ){
+	cv.wait( lock );
+	continue;
+      }
+      Clock::time_point due = queue.front().added
+	+ chrono::milliseconds( interval_ms );
+      if ( queue.size() < batch && Clock::now() < due ){
+	cv.wait_until( lock, due );
+	continue;
+      }
+      vector<Pending> todo;
+      todo.swap( queue );
+      lock.unlock();
+      // per base, in the order of arrival
+      map<string,vector<Pending>> per_base;
+      for ( auto& p : todo ){
+	per_base[p.base].push_back( std::move( p ) );
+      }
+      for ( const auto& it : per_base ){
+	apply( it.first, it.second );
+      }
+      lock.lock();
+    }
+  }
+
+  TimblExperiment *Learner::build_spare( const string& name,
+					 const Base& b ){
+    // a fresh copy of the original base, with all instances learned.
+    // Expensive: the base is loaded again and the whole history replayed
+    TimblExperiment *exp = create_experiment( name, b.params, *log,
+					      cache_dir );
+    if ( !exp ){
+      return 0;
+    }
+    for ( const auto& instance : b.history ){
+      exp->Increment( TiCC::UnicodeFromUTF8( instance ) );
+    }
+    return exp;
+  }
+
+  bool Learner::take_retired( Base& b ){
+    // use the previous version as the next private copy, when no clone
+    // uses it anymore. It only lacks the batch published after it
+    if ( !b.retired || b.retired.use_count() > 1 ){
+      return false;
+    }
+    // the last clone is gone: see everything it did before it let go
+    atomic_thread_fence( memory_order_acquire );
+    b.spare = std::move( b.retired );
+    for ( const auto& instance : b.behind ){
+      try {
+	b.spare->Increment( TiCC::UnicodeFromUTF8( instance ) );
+      }
+      catch ( const exception& ){
+	// it was accepted before, so it can't fail now
+      }
+    }
+    b.behind.clear();
+    return true;
+  }
+
+  void Learner::apply( const string& name,
+		       const vector<Pending>& todo ){
+    Base& b = bases.find( name )->second;
+    Clock::time_point start = Clock::now();
+    bool rebuild = false;
+    if ( !b.spare && !take_retired( b ) ){
+      // a clone still uses the previous version (or there is none)
+      b.spare.reset( build_spare( name, b ) );
+      b.retired.reset();
+      b.behind.clear();
+      rebuild = true;
+      if ( !b.spare ){
+	*TiCC::Log( *log ) << "learn: unable to copy base " << name
+			   << endl;
+      }
+    }
+    size_t ok = 0;
+    if ( b.spare ){
+      for ( const auto& p : todo ){
+	bool good = false;
+	try {
+	  good = b.spare->Increment( TiCC::UnicodeFromUTF8( p.instance ) );
+	}
+	catch ( const exception& ){
+	  good = false;
+	}
+	if ( good ){
+	  b.history.push_back( p.instance );
+	  b.behind.push_back( p.instance );
+	  ++ok;
+	}
+      }
+    }
+    Clock::time_point done = start;
+    if ( ok > 0 ){
+      // publish. Clones made from the previous version keep it alive.
+      // The loaded base (version 0) belongs to the server, it is never
+      // used as a copy
+      shared_ptr<TimblExperiment> previous
+	= atomic_exchange( &b.current, b.spare );
+      b.retired = b.version > 0 ? previous : shared_ptr<TimblExperiment>();
+      b.spare.reset();
+      done = Clock::now();
+    }
+    {
+      lock_guard<mutex> lock( mtx );
+      learned += ok;
+      rejected += todo.size() - ok;
+      if ( rebuild ){
+	++rebuilt;
+      }
+      if ( ok > 0 ){
+	++b.version;
+	++published;
+	apply_s += ms_between( start, done ) / 1000.0;
+	last_publish_ms = ms_between( start, done );
+	max_publish_ms = max( max_publish_ms, last_publish_ms );
+	for ( const auto& p : todo ){
+	  double lag = ms_between( p.added, done );
+	  total_lag_ms += lag;
+	  ++lagged;
+	  max_lag_ms = max( max_lag_ms, lag );
+	}
+      }
+    }
+  }
+
+  json Learner::stats() const {
+    json result = json::object();
+    if ( !enabled() ){
+      return result;
+    }
+    lock_guard<mutex> lock( mtx );
+    result["queued"] = queued;
+    result["learned"] = learned;
+    result["rejected"] = rejected;
+    result["dropped"] = dropped;
+    result["waiting"] = queue.size();
+    result["published"] = published;
+    // the copies built again, because a clone held the previous version
+    result["rebuilt"] = rebuilt;
+    result["learned_per_s"] = apply_s > 0 ? learned / apply_s : 0.0;
+    result["last_publish_ms"] = last_publish_ms;
+    result["max_publish_ms"] = max_publish_ms;
+    // from the 'learn' request until the instance can be used
+    result["avg_lag_ms"] = lagged > 0 ? total_lag_ms / lagged : 0.0;
+    result["max_lag_ms"] = max_lag_ms;
+    json versions = json::object();
+    for ( const auto& it : bases ){
+      versions[it.first] = it.second.version;
+    }
+    result["versions"] = versions;
+    return result;
+  }
+
+}
@@ -0,0 +1,268 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timblserver/LineIO.h"
+
+using namespace std;
+
+namespace TimblServer {
+
+  const size_t BLOCK_SIZE = 1024*1024;
+  const size_t MAX_WAITING = 4;
+
+  LineSource::LineSource():
+    fd(-1),
+    owned(false),
+    mapped(0),
+    mapped_size(0),
+    pos(0),
+    block_start(0),
+    block_end(0),
+    at_eof(false)
+  {}
+
+  LineSource::~LineSource(){
+    if ( mapped ){
+      munmap( const_cast<char*>(mapped), mapped_size );
+    }
+    if ( owned && fd >= 0 ){
+      ::close( fd );
+    }
+  }
+
+  bool LineSource::open( const string& name ){
+    int f = ::open( name.c_str(), O_RDONLY );
+    if ( f < 0 ){
+      mess = "unable to open " + name + ": " + strerror(errno);
+      return false;
+    }
+    if ( !open( f ) ){
+      ::close( f );
+      return false;
+    }
+    owned = true;
+    return true;
+  }
+
+  bool LineSource::open( int f ){
+    fd = f;
+    struct stat st;
+    if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 ){
+      void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if ( p != MAP_FAILED ){
+	madvise( p, st.st_size, MADV_SEQUENTIAL );
+	mapped = static_cast<const char*>( p );
+	mapped_size = st.st_size;
+	return true;
+      }
+    }
+    // not mappable: read it in blocks
+    block.resize( BLOCK_SIZE );
+    return true;
+  }
+
+  bool LineSource::fill(){
+    // read more after the data still in the block, moving that to the
+    // front, and growing the block for lines longer than it is
+    if ( at_eof ){
+      return false;
+    }
+    if ( block_start > 0 ){
+      memmove( block.data(), block.data() + block_start,
+	       block_end - block_start );
+      block_end -= block_start;
+      block_start = 0;
+    }
+    if ( block_end == block.size() ){
+      block.resize( 2 * block.size() );
+    }
+    while ( true ){
+      ssize_t n = ::read( fd, block.data() + block_end,
+			  block.size() - block_end );
+      if ( n > 0 ){
+	block_end += n;
+	return true;
+      }
+      if ( n < 0 && errno == EINTR ){
+	continue;
+      }
+      if ( n < 0 ){
+	mess = string("read failed: ") + strerror(errno);
+      }
+      at_eof = true;
+      return false;
+    }
+  }
+
+  static void strip_cr( string_view& line ){
+    if ( !line.empty() && line.back() == '\r' ){
+      line.remove_suffix( 1 );
+    }
+  }
+
+  bool LineSource::next( string_view& line ){
+    if ( mapped ){
+      if ( pos >= mapped_size ){
+	return false;
+      }
+      const char *start = mapped + pos;
+      const char *nl = static_cast<const char*>( memchr( start, '\n',
+							 mapped_size - pos ) );
+      size_t len = nl ? size_t( nl - start ) : mapped_size - pos;
+      line = string_view( start, len );
+      pos += len + 1;
+      strip_cr( line );
+      return true;
+    }
+    if ( fd < 0 ){
+      return false;
+    }
+    size_t searched = block_start;
+    while ( true ){
+      const char *nl = static_cast<const char*>( memchr( block.data() + searched,
+							 '\n',
+							 block_end - searched ) );
+      if ( nl ){
+	const char *start = block.data() + block_start;
+	line = string_view( start, nl - start );
+	block_start = nl - block.data() + 1;
+	strip_cr( line );
+	return true;
+      }
+      searched = block_end - block_start;
+      if ( !fill() ){
+	// the last line need not end in a newline
+	if ( block_end > block_start ){
+	  line = string_view( block.data() + block_start,
+			      block_end - block_start );
+	  block_start = block_end;
+	  strip_cr( line );
+	  return true;
+	}
+	return false;
+      }
+    }
+  }
+
+  AsyncWriter::AsyncWriter( int f, size_t size ):
+    fd(f),
+    buffer_size(size),
+    closing(false),
+    failed(false)
+  {
+    current.reserve( buffer_size );
+    writer = thread( &AsyncWriter::run, this );
+  }
+
+  AsyncWriter::~AsyncWriter(){
+    close();
+  }
+
+  void AsyncWriter::hand_over(){
+    // queue the current buffer and continue in a spare one
+    unique_lock<mutex> lock( mtx );
+    cv.wait( lock, [this]{ return full.size() < MAX_WAITING || failed; } );
+    full.push_back( move( current ) );
+    if ( spare.empty() ){
+      current = string();
+      current.reserve( buffer_size );
+    }
+    else {
+      current = move( spare.back() );
+      spare.pop_back();
+    }
+    cv.notify_all();
+  }
+
+  void AsyncWriter::write( const char *data, size_t len ){
+    if ( current.size() + len > buffer_size && !current.empty() ){
+      hand_over();
+    }
+    current.append( data, len );
+  }
+
+  void AsyncWriter::run(){
+    unique_lock<mutex> lock( mtx );
+    while ( true ){
+      cv.wait( lock, [this]{ return !full.empty() || closing; } );
+      if ( full.empty() ){
+	return;
+      }
+      string buf = move( full.front() );
+      full.pop_front();
+      lock.unlock();
+      size_t done = 0;
+      while ( done < buf.size() && !failed ){
+	ssize_t n = ::write( fd, buf.data() + done, buf.size() - done );
+	if ( n < 0 && errno == EINTR ){
+	  continue;
+	}
+	if ( n <= 0 ){
+	  lock.lock();
+	  failed = true;
+	  mess = string("write failed: ") + strerror(errno);
+	  lock.unlock();
+	  break;
+	}
+	done += n;
+      }
+      buf.clear();
+      lock.lock();
+      spare.push_back( move( buf ) );
+      cv.notify_all();
+    }
+  }
+
+  bool AsyncWriter::close(){
+    // write everything, and stop the writer
+    if ( writer.joinable() ){
+      if ( !current.empty() ){
+	hand_over();
+      }
+      {
+	lock_guard<mutex> lock( mtx );
+	closing = true;
+      }
+      cv.notify_all();
+      writer.join();
+    }
+    return !failed;
+  }
+
+}
@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <thread>
+#include <system_error>
+#include <stdexcept>
+
+#include "timbl/TimblAPI.h"
+#include "ticcutils/ServerBase.h"
+#include "timblserver/TimblServer.h"
+
+using namespace std;
+using namespace TiCCServer;
+
+#define LOG ASYNC_LOG( server->async_log, args->logstream() )
+
+namespace TimblServer {
+
+  Multiplexer::Multiplexer( ServerCommon *s,
+			    childArgs *a,
+			    int n,
+			    const string& cls,
+			    bool j,
+			    ostream& o ):
+    server(s),
+    args(a),
+    node(n),
+    client_class(cls),
+    json(j),
+    os(o),
+    max_in_flight( s->sessions.concurrency() ),
+    in_flight(0),
+    idle(0),
+    stopping(false)
+  {}
+
+  Multiplexer::~Multiplexer(){
+    release();
+  }
+
+  void Multiplexer::submit( const Job& job ){
+    // queue job for a worker, starting one when all are busy. The
+    // workers are started on demand: most connections never need them
+    unique_lock<mutex> lock( mtx );
+    done_cv.wait( lock, [this]{ return in_flight < max_in_flight; } );
+    server->sessions.count_multiplexed();
+    if ( queue.size() >= idle && workers.size() < max_in_flight ){
+      try {
+	workers.push_back( thread( &Multiplexer::worker, this ) );
+      }
+      catch ( const system_error& ){
+	if ( workers.empty() ){
+	  // out of threads: do it ourselves
+	  lock.unlock();
+	  FanOut clones( server, args, node, client_class, json );
+	  job( clones );
+	  return;
+	}
+      }
+    }
+    ++in_flight;
+    queue.push_back( job );
+    work_cv.notify_one();
+  }
+
+  void Multiplexer::worker(){
+    ProfileTag profile_tag( json ? "json" : "tcp" );
+    server->affinity.bind_to_node( node );
+    FanOut clones( server, args, node, client_class, json );
+    unique_lock<mutex> lock( mtx );
+    while ( true ){
+      ++idle;
+      work_cv.wait( lock, [this]{ return !queue.empty() || stopping; } );
+      --idle;
+      if ( queue.empty() ){
+	break;
+      }
+      Job job = move( queue.front() );
+      queue.pop_front();
+      lock.unlock();
+      try {
+	job( clones );
+      }
+      catch ( const exception& e ){
+	LOG << args->id() << " multiplexed request failed: " << e.what()
+	    << endl;
+      }
+      lock.lock();
+      --in_flight;
+      done_cv.notify_all();
+    }
+  }
+
+  void Multiplexer::write( const string& answer ){
+    // one complete answer, not mixed with anything else
+    lock_guard<mutex> lock( write_mtx );
+    os << answer << flush;
+  }
+
+  void Multiplexer::drain(){
+    // wait until every submitted request is answered
+    unique_lock<mutex> lock( mtx );
+    done_cv.wait( lock, [this]{ return in_flight == 0; } );
+  }
+
+  void Multiplexer::release(){
+    // finish the work, and stop the workers and free their clones.
+    // submit() starts them again when needed
+    {
+      lock_guard<mutex> lock( mtx );
+      stopping = true;
+    }
+    work_cv.notify_all();
+    for ( auto& w : workers ){
+      w.join();
+    }
+    workers.clear();
+    stopping = false;
+  }
+
+}
@@ -0,0 +1,338 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/PerfCounters.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  class CounterGroup {
+    // the perf events of one thread, read together
+  public:
+    CounterGroup(): tried(false) {};
+    ~CounterGroup(){ close(); };
+    bool open( unsigned int, string& );
+    bool is_open() const { return !fds.empty(); };
+    void close();
+    bool read( uint64_t * ) const;
+    unsigned int counted() const;
+    bool tried;
+  private:
+    vector<int> fds;
+    vector<PerfCounters::Event> order;
+  };
+
+#ifdef __linux__
+  static int open_event( PerfCounters::Event e, int leader ){
+    static const uint64_t configs[] = { PERF_COUNT_HW_CPU_CYCLES,
+					PERF_COUNT_HW_INSTRUCTIONS,
+					PERF_COUNT_HW_CACHE_MISSES,
+					PERF_COUNT_HW_BRANCH_MISSES };
+    perf_event_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[e];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP
+      | PERF_FORMAT_TOTAL_TIME_ENABLED
+      | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // this thread, on any CPU. The counters keep running: a scope reads
+    // them twice, which is cheaper than resetting and enabling them
+    return syscall( SYS_perf_event_open, &attr, 0, -1, leader,
+		    PERF_FLAG_FD_CLOEXEC );
+  }
+#endif
+
+  bool CounterGroup::open( unsigned int wanted, string& error ){
+    // open the events in 'wanted' (a bitmask), the first one that works
+    // leading the group. Fails when none could be opened
+    tried = true;
+#ifdef __linux__
+    int leader = -1;
+    for ( int e=0; e < PerfCounters::NumEvents; ++e ){
+      if ( !( wanted & ( 1u << e ) ) ){
+	continue;
+      }
+      int fd = open_event( PerfCounters::Event(e), leader );
+      if ( fd < 0 ){
+	if ( error.empty() ){
+	  error = PerfCounters::to_string( PerfCounters::Event(e) ) + ": "
+	    + strerror(errno);
+	}
+	continue;
+      }
+      if ( leader < 0 ){
+	leader = fd;
+      }
+      fds.push_back( fd );
+      order.push_back( PerfCounters::Event(e) );
+    }
+    return is_open();
+#else
+    (void)wanted;
+    error = "perf events are only supported on Linux";
+    return false;
+#endif
+  }
+
+  void CounterGroup::close(){
+    for ( const auto fd : fds ){
+      ::close( fd );
+    }
+    fds.clear();
+    order.clear();
+  }
+
+  unsigned int CounterGroup::counted() const {
+    unsigned int result = 0;
+    for ( const auto e : order ){
+      result |= 1u << e;
+    }
+    return result;
+  }
+
+  bool CounterGroup::read( uint64_t *out ) const {
+    // out[0] and out[1]: the time enabled and running, then the value of
+    // every event (0 for the events not counted)
+    if ( fds.empty() ){
+      return false;
+    }
+    uint64_t buf[3+PerfCounters::NumEvents];
+    ssize_t len = ::read( fds[0], buf, sizeof(buf) );
+    if ( len < ssize_t( ( 3 + order.size() ) * sizeof(uint64_t) )
+	 || buf[0] != order.size() ){
+      return false;
+    }
+    out[0] = buf[1];
+    out[1] = buf[2];
+    for ( int e=0; e < PerfCounters::NumEvents; ++e ){
+      out[2+e] = 0;
+    }
+    for ( size_t i=0; i < order.size(); ++i ){
+      out[2+order[i]] = buf[3+i];
+    }
+    return true;
+  }
+
+  static thread_local CounterGroup thread_group;
+  static thread_local unsigned long thread_calls = 0;
+
+  PerfCounters::PerfCounters( const TiCC::Configuration *config ):
+    wanted(false),
+    available(false),
+    sample(1),
+    events(0),
+    failures(0)
+  {
+    string value = config->lookUp( "perf" );
+    if ( value.empty() ){
+      return;
+    }
+    value = TiCC::lowercase( value );
+    if ( value == "yes" || value == "true" ){
+      wanted = true;
+    }
+    else if ( value != "no" && value != "false" ){
+      throw runtime_error( "invalid value for 'perf': " + value );
+    }
+    value = config->lookUp( "perf_sample" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, sample ) || sample == 0 ){
+	throw runtime_error( "invalid value for 'perf_sample': " + value );
+      }
+    }
+  }
+
+  string PerfCounters::to_string( Event e ){
+    switch ( e ){
+    case Cycles:
+      return "cycles";
+    case Instructions:
+      return "instructions";
+    case CacheMisses:
+      return "cache_misses";
+    case BranchMisses:
+      return "branch_misses";
+    default:
+      return "unknown";
+    }
+  }
+
+  void PerfCounters::probe( TiCC::LogStream& log ){
+    // find out which events this machine counts. Called once, at startup
+    if ( !wanted ){
+      return;
+    }
+    CounterGroup group;
+    unsigned int all = ( 1u << NumEvents ) - 1;
+    if ( group.open( all, error ) ){
+      uint64_t values[NumEvents+2];
+      if ( group.read( values ) ){
+	available = true;
+      }
+      else {
+	error = "reading the counters failed";
+      }
+    }
+    if ( !available ){
+      log << "perf: counters unavailable (" << error
+	  << "), not counting" << endl;
+      return;
+    }
+    // the events that failed to open are left out of every group
+    events = group.counted();
+    string names;
+    for ( int e=0; e < NumEvents; ++e ){
+      if ( events & ( 1u << e ) ){
+	names += " " + to_string( Event(e) );
+      }
+    }
+    log << "perf: counting" << names;
+    if ( sample > 1 ){
+      log << ", 1 in " << sample << " classifications";
+    }
+    log << endl;
+  }
+
+  void PerfCounters::record( const string& name,
+			     const double *values ) const {
+    lock_guard<mutex> lock( mtx );
+    Totals& t = totals[name];
+    ++t.samples;
+    for ( int e=0; e < NumEvents; ++e ){
+      t.values[e] += values[e];
+    }
+  }
+
+  json PerfCounters::stats() const {
+    json result;
+    result["available"] = available;
+    if ( !available ){
+      result["error"] = error;
+      return result;
+    }
+    json counted = json::array();
+    for ( int e=0; e < NumEvents; ++e ){
+      if ( events & ( 1u << e ) ){
+	counted.push_back( to_string( Event(e) ) );
+      }
+    }
+    result["events"] = counted;
+    result["sample"] = sample;
+    lock_guard<mutex> lock( mtx );
+    result["failures"] = failures;
+    json bases = json::object();
+    for ( const auto& it : totals ){
+      const Totals& t = it.second;
+      json base;
+      base["samples"] = t.samples;
+      for ( int e=0; e < NumEvents; ++e ){
+	if ( events & ( 1u << e ) ){
+	  base[to_string( Event(e) ) + "_per_call"] = t.values[e] / t.samples;
+	}
+      }
+      double instructions = t.values[Instructions];
+      if ( instructions > 0 ){
+	if ( t.values[Cycles] > 0 ){
+	  base["ipc"] = instructions / t.values[Cycles];
+	}
+	// misses per 1000 instructions: high cache MPKI and a low IPC
+	// point at a memory bound base
+	base["cache_mpki"] = 1000 * t.values[CacheMisses] / instructions;
+	base["branch_mpki"] = 1000 * t.values[BranchMisses] / instructions;
+      }
+      bases[it.first] = base;
+    }
+    result["bases"] = bases;
+    return result;
+  }
+
+  PerfScope::PerfScope( const PerfCounters& p, const string& n ):
+    perf(p),
+    active(false)
+  {
+    if ( !perf.enabled()
+	 || ++thread_calls % perf.sample != 0 ){
+      return;
+    }
+    if ( !thread_group.tried ){
+      string error;
+      if ( !thread_group.open( perf.events, error ) ){
+	lock_guard<mutex> lock( perf.mtx );
+	++perf.failures;
+      }
+    }
+    if ( thread_group.read( start ) ){
+      name = n;
+      active = true;
+    }
+  }
+
+  PerfScope::~PerfScope(){
+    if ( !active ){
+      return;
+    }
+    uint64_t end[PerfCounters::NumEvents+2];
+    if ( !thread_group.read( end ) ){
+      return;
+    }
+    uint64_t enabled = end[0] - start[0];
+    uint64_t running = end[1] - start[1];
+    if ( running == 0 ){
+      // the counters were not on the PMU at all: nothing to scale
+      return;
+    }
+    // when more events are wanted than the PMU has room for, the kernel
+    // multiplexes them. Scale to the whole time enabled
+    double scale = double(enabled) / running;
+    double values[PerfCounters::NumEvents];
+    for ( int e=0; e < PerfCounters::NumEvents; ++e ){
+      values[e] = ( end[2+e] - start[2+e] ) * scale;
+    }
+    perf.record( name, values );
+  }
+
+}
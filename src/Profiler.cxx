@@ -0,0 +1,313 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Protocol.h"
+#include "timblserver/Profiler.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  const int MAX_DEPTH = 64;
+  const int SKIP_FRAMES = 2; // the handler and the signal trampoline
+  const size_t MAX_SAMPLES = 1 << 17;
+  const size_t BASE_LEN = 48;
+
+  struct Sample {
+    const char *protocol;
+    char base[BASE_LEN];
+    int depth;
+    void *pcs[MAX_DEPTH];
+  };
+
+  // the tags of a thread. initial-exec TLS is never allocated lazily,
+  // so the signal handler may read it
+  static thread_local const char *protocol_tag
+  __attribute__((tls_model("initial-exec"))) = 0;
+  static thread_local const char *base_tag
+  __attribute__((tls_model("initial-exec"))) = 0;
+
+  // the profile being taken. Only one at a time, for the whole process
+  static Sample *samples = 0;
+  static size_t capacity = 0;
+  static atomic<size_t> taken( 0 );
+  static atomic<int> in_handler( 0 );
+  static atomic<bool> sampling( false );
+
+  static void on_sigprof( int, siginfo_t *, void * ){
+    // runs in whatever thread used the CPU: only async-signal-safe work
+    ++in_handler;
+    if ( sampling.load() ){
+      int saved = errno;
+      size_t i = taken++;
+      if ( i < capacity ){
+	Sample& s = samples[i];
+	void *pcs[MAX_DEPTH+SKIP_FRAMES];
+	int depth = backtrace( pcs, MAX_DEPTH+SKIP_FRAMES ) - SKIP_FRAMES;
+	s.depth = 0;
+	for ( int d=0; d < depth; ++d ){
+	  s.pcs[s.depth++] = pcs[d+SKIP_FRAMES];
+	}
+	s.protocol = protocol_tag;
+	size_t len = 0;
+	if ( base_tag ){
+	  while ( len < BASE_LEN-1 && base_tag[len] ){
+	    s.base[len] = base_tag[len];
+	    ++len;
+	  }
+	}
+	s.base[len] = 0;
+      }
+      errno = saved;
+    }
+    --in_handler;
+  }
+
+  static string frame_name( void *pc, map<void*,string>& names ){
+    auto it = names.find( pc );
+    if ( it != names.end() ){
+      return it->second;
+    }
+    string result;
+    Dl_info info;
+    if ( dladdr( pc, &info ) && info.dli_sname ){
+      int status = 0;
+      char *demangled = abi::__cxa_demangle( info.dli_sname, 0, 0, &status );
+      result = ( status == 0 && demangled ) ? demangled : info.dli_sname;
+      free( demangled );
+    }
+    else if ( info.dli_fname ){
+      // no symbol (a static function): the module and the offset
+      string module = info.dli_fname;
+      string::size_type pos = module.rfind( '/' );
+      if ( pos != string::npos ){
+	module = module.substr( pos+1 );
+      }
+      ostringstream os;
+      os << module << "+0x" << hex
+	 << ( (char*)pc - (char*)info.dli_fbase );
+      result = os.str();
+    }
+    else {
+      ostringstream os;
+      os << pc;
+      result = os.str();
+    }
+    // ';' separates the frames of a folded stack
+    for ( auto& c : result ){
+      if ( c == ';' ){
+	c = ':';
+      }
+    }
+    names[pc] = result;
+    return result;
+  }
+
+  Profiler::Profiler( const TiCC::Configuration *config ):
+    hz(99),
+    max_seconds(300),
+    busy(false),
+    last_samples(0),
+    last_dropped(0)
+  {
+    directory = config->lookUp( "profile_dir" );
+    string value = config->lookUp( "profile_hz" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, hz ) || hz <= 0 || hz > 10000 ){
+	throw runtime_error( "invalid value for 'profile_hz': " + value );
+      }
+    }
+    value = config->lookUp( "profile_max" );
+    if ( !value.empty() ){
+      if ( !TiCC::stringTo( value, max_seconds ) || max_seconds <= 0 ){
+	throw runtime_error( "invalid value for 'profile_max': " + value );
+      }
+    }
+  }
+
+  json Profiler::start( double seconds, TiCC::LogStream& log ){
+    // begin a profile of 'seconds' seconds. It is written by a thread of
+    // its own when done; the answer holds the name of the file
+    if ( !enabled() ){
+      return json_error( "profiling is not enabled (no profile_dir)" );
+    }
+    if ( seconds <= 0 || seconds > max_seconds ){
+      return json_error( "profile duration must be between 0 and "
+			 + TiCC::toString( max_seconds ) + " seconds" );
+    }
+    lock_guard<mutex> lock( mtx );
+    if ( busy ){
+      return json_error( "a profile is being taken already" );
+    }
+    size_t cpus = max( 1u, thread::hardware_concurrency() );
+    capacity = min( MAX_SAMPLES, size_t( seconds * hz * cpus ) + 1 );
+    samples = new Sample[capacity];
+    taken = 0;
+    // the first backtrace() loads the unwinder, which isn't safe in a
+    // signal handler
+    void *dummy[2];
+    backtrace( dummy, 2 );
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_sigaction = on_sigprof;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset( &sa.sa_mask );
+    sigaction( SIGPROF, &sa, 0 );
+    sampling = true;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    if ( setitimer( ITIMER_PROF, &timer, 0 ) < 0 ){
+      sampling = false;
+      delete [] samples;
+      samples = 0;
+      return json_error( string("setitimer failed: ") + strerror(errno) );
+    }
+    busy = true;
+    char stamp[32];
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r( &now, &tm );
+    strftime( stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm );
+    string file = directory + "/timblserver-" + TiCC::toString( getpid() )
+      + "-" + stamp + ".folded";
+    thread( &Profiler::finish, this, seconds, file, &log ).detach();
+    json result;
+    result["status"] = "ok";
+    result["profile"] = file;
+    result["seconds"] = seconds;
+    return result;
+  }
+
+  void Profiler::finish( double seconds,
+			 const string& file,
+			 TiCC::LogStream *log ){
+    this_thread::sleep_for( chrono::duration<double>( seconds ) );
+    struct itimerval off;
+    memset( &off, 0, sizeof(off) );
+    setitimer( ITIMER_PROF, &off, 0 );
+    sampling = false;
+    // a late SIGPROF must not kill the server
+    signal( SIGPROF, SIG_IGN );
+    while ( in_handler.load() > 0 ){
+      this_thread::yield();
+    }
+    size_t count = min( taken.load(), capacity );
+    unsigned long dropped = taken.load() - count;
+    map<string,unsigned long> stacks;
+    map<void*,string> names;
+    for ( size_t i=0; i < count; ++i ){
+      const Sample& s = samples[i];
+      string stack = s.protocol ? s.protocol : "-";
+      stack += ";";
+      stack += s.base[0] ? s.base : "-";
+      for ( int d = s.depth-1; d >= 0; --d ){
+	// return addresses point after the call, except the innermost
+	void *pc = d == 0 ? s.pcs[d] : (char*)s.pcs[d] - 1;
+	stack += ";" + frame_name( pc, names );
+      }
+      ++stacks[stack];
+    }
+    delete [] samples;
+    samples = 0;
+    ofstream os( file );
+    for ( const auto& it : stacks ){
+      os << it.first << " " << it.second << "\n";
+    }
+    os.close();
+    if ( !os ){
+      *log << "profile: unable to write " << file << endl;
+    }
+    else {
+      *log << "profile: wrote " << count << " samples to " << file;
+      if ( dropped > 0 ){
+	*log << " (" << dropped << " dropped)";
+      }
+      *log << endl;
+    }
+    lock_guard<mutex> lock( mtx );
+    last_file = file;
+    last_samples = count;
+    last_dropped = dropped;
+    busy = false;
+  }
+
+  json Profiler::stats() const {
+    json result;
+    lock_guard<mutex> lock( mtx );
+    result["running"] = busy;
+    result["hz"] = hz;
+    if ( !last_file.empty() ){
+      result["last_profile"] = last_file;
+      result["samples"] = last_samples;
+      result["dropped"] = last_dropped;
+    }
+    return result;
+  }
+
+  ProfileTag::ProfileTag( const char *protocol, const string& base ):
+    prev_protocol( protocol_tag ),
+    prev_base( base_tag )
+  {
+    protocol_tag = protocol;
+    if ( !base.empty() ){
+      base_tag = base.c_str();
+    }
+  }
+
+  ProfileTag::~ProfileTag(){
+    protocol_tag = prev_protocol;
+    base_tag = prev_base;
+  }
+
+}
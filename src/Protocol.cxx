@@ -0,0 +1,309 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+
+#include "ticcutils/StringOps.h"
+#include "timbl/TimblAPI.h"
+#include "timblserver/Protocol.h"
+
+using namespace std;
+using namespace nlohmann;
+
+#define IS_DIGIT(x) (((x) >= '0') && ((x) <= '9'))
+#define IS_HEX(x) ((IS_DIGIT(x)) || (((x) >= 'a') && ((x) <= 'f')) || \
+            (((x) >= 'A') && ((x) <= 'F')))
+
+namespace TimblServer {
+
+  using Timbl::compare_nocase_n;
+
+  CommandType check_command( const string& com ){
+    CommandType result = UnknownCommand;
+    if ( compare_nocase_n( com, "CLASSIFY" ) )
+      result = Classify;
+    else if ( compare_nocase_n( com, "QUERY" ) )
+      result = Query;
+    else if ( compare_nocase_n( com, "BASE") )
+      result = Base;
+    else if ( compare_nocase_n( com, "SET") )
+      result = Set;
+    else if ( compare_nocase_n( com, "EXIT" ) )
+      result = Exit;
+    else if ( compare_nocase_n( com, "VOCABULARY" ) )
+      result = Vocab;
+    else if ( compare_nocase_n( com, "FANOUT" ) )
+      result = Multi;
+    else if ( compare_nocase_n( com, "LEARN" ) )
+      result = Learn;
+    else if ( compare_nocase_n( com, "ASYNC" ) )
+      result = Async;
+    else if ( com[0] == '#' )
+      result = Comment;
+    return result;
+  }
+
+  static const char *SPACE = " \t\r\n";
+
+  static void split_first( const string& line, string& first, string& rest ){
+    // split off the first word, like TiCC::split( line, 2 ), but into the
+    // strings of the caller, so they keep their capacity between requests
+    string::size_type b = line.find_first_not_of( SPACE );
+    if ( b == string::npos ){
+      first.clear();
+      rest.clear();
+      return;
+    }
+    string::size_type e = line.find_first_of( SPACE, b );
+    if ( e == string::npos ){
+      first.assign( line, b, string::npos );
+      rest.clear();
+      return;
+    }
+    first.assign( line, b, e - b );
+    string::size_type r = line.find_first_not_of( SPACE, e );
+    if ( r == string::npos ){
+      rest.clear();
+    }
+    else {
+      rest.assign( line, r, string::npos );
+    }
+  }
+
+  void split_command( const string& line, string& com, string& rest ){
+    split_first( line, com, rest );
+  }
+
+  static bool equal_nocase( const char *s, size_t len, const char *word ){
+    size_t i = 0;
+    for ( ; i < len && word[i]; ++i ){
+      if ( toupper( (unsigned char)s[i] ) != word[i] ){
+	return false;
+      }
+    }
+    return i == len && !word[i];
+  }
+
+  static code_t code_of( const char *s, size_t len ){
+    static const struct { const char *word; code_t code; } codes[] = {
+      { "CATEGORY", Result },
+      { "ERROR", Err },
+      { "OK", OK },
+      { "AVAILABLE", Echo },
+      { "SELECTED", Echo },
+      { "SKIP", Skip },
+      { "NEIGHBORS", Neighbors },
+      { "ENDNEIGHBORS", EndNeighbors },
+      { "STATUS", Status },
+      { "ENDSTATUS", EndStatus },
+      { "ANSWER", Tagged } };
+    for ( const auto& c : codes ){
+      if ( equal_nocase( s, len, c.word ) ){
+	return c.code;
+      }
+    }
+    return UnknownCode;
+  }
+
+  code_t toCode( const string& command ){
+    return code_of( command.c_str(), command.size() );
+  }
+
+  code_t extract_code( const string& line, string& rest ){
+    // the code of an answer line, without copying it
+    string::size_type b = line.find_first_not_of( SPACE );
+    if ( b == string::npos ){
+      rest.clear();
+      return UnknownCode;
+    }
+    string::size_type e = line.find_first_of( SPACE, b );
+    if ( e == string::npos ){
+      rest.clear();
+      return code_of( line.c_str() + b, line.size() - b );
+    }
+    string::size_type r = line.find_first_not_of( SPACE, e );
+    if ( r == string::npos ){
+      rest.clear();
+    }
+    else {
+      rest.assign( line, r, string::npos );
+    }
+    return code_of( line.c_str() + b, e - b );
+  }
+
+  bool parse_result( const string& line,
+		     string& cls,
+		     string& db,
+		     string& dist,
+		     bool& neighbors ){
+    // the fields of an answer '{cls} DISTRIBUTION {db} DISTANCE {dist}'
+    // neighbors is set when a NEIGHBORS block follows
+    cls.clear();
+    db.clear();
+    dist.clear();
+    neighbors = false;
+    string::size_type pos1 = line.find( "{" );
+    if ( pos1 != string::npos ) {
+      string::size_type pos2 = line.find( "}", pos1 );
+      if ( pos2 != string::npos ){
+	cls.assign( line, pos1+1, pos2 - pos1 -1 );
+	pos1 = line.find( "DISTRIBUTION" );
+	if ( pos1 != string::npos ) {
+	  pos1 = line.find( "{", pos1 + 13 );
+	  if ( pos1 != string::npos ) {
+	    pos2 = line.find( "}", pos1 );
+	    if ( pos2 != string::npos ){
+	      db.assign( line, pos1, pos2 - pos1 + 1 );
+	    }
+	    else
+	      return false;
+	  }
+	  else
+	    return false;
+	}
+	pos1 = line.find( "DISTANCE" );
+	if ( pos1 != string::npos ) {
+	  pos1 = line.find( "{", pos1 + 9 );
+	  if ( pos1 != string::npos ) {
+	    pos2 = line.find( "}", pos1 );
+	    if ( pos2 != string::npos ){
+	      dist.assign( line, pos1+1, pos2 - pos1-1 );
+	    }
+	    else
+	      return false;
+	  }
+	  else
+	    return false;
+	}
+	neighbors = ( line.find( "NEIGHBORS" ) != string::npos );
+	return true;
+      }
+    }
+    return false;
+  }
+
+  static int hex_value( char c ){
+    if ( IS_DIGIT(c) ){
+      return c - '0';
+    }
+    if ( c >= 'a' && c <= 'f' ){
+      return c - 'a' + 10;
+    }
+    return c - 'A' + 10;
+  }
+
+  string urlDecode( const string& s ) {
+    string result;
+    size_t len=s.size();
+    result.reserve( len );
+    for ( size_t i=0; i<len ; ++i ) {
+      char cc=s[i];
+      if (cc == '+') {
+	result += ' ';
+      }
+      else if ( cc == '%' &&
+		( i+2 < len &&
+		  ( IS_HEX(s[i+1]) ) &&
+		  ( IS_HEX(s[i+2]) ) ) ){
+	result += char( hex_value( s[i+1] ) * 16 + hex_value( s[i+2] ) );
+	i += 2;
+      }
+      else {
+	result += cc;
+      }
+    }
+    return result;
+  }
+
+  multimap<string,string> parse_query( const string& qstring,
+				       ostream& log ){
+    // the attribute=value pairs of a query string
+    multimap<string,string> acts;
+    string::size_type pos = 0;
+    while ( pos <= qstring.size() ){
+      string::size_type amp = qstring.find( '&', pos );
+      if ( amp == string::npos ){
+	amp = qstring.size();
+      }
+      if ( amp > pos ){
+	string::size_type eq = qstring.find( '=', pos );
+	if ( eq != string::npos && eq < amp && eq > pos && eq+1 < amp ){
+	  acts.emplace( qstring.substr( pos, eq - pos ),
+			qstring.substr( eq+1, amp - eq - 1 ) );
+	}
+	else {
+	  log << "unknown word in query "
+	      << qstring.substr( pos, amp - pos ) << endl;
+	}
+      }
+      pos = amp + 1;
+    }
+    return acts;
+  }
+
+  string strip_quotes( const string& params ){
+    int len = params.length();
+    if ( len > 2 ){
+      if ( ( params[0] == '"' && params[len-1] == '"' )
+	   || ( params[0] == '\'' && params[len-1] == '\'' ) ){
+	return params.substr( 1, len-2 );
+      }
+    }
+    return params;
+  }
+
+  json json_error( const string& message ){
+    json result;
+    result["status"] = "error";
+    result["message"] = message;
+    return result;
+  }
+
+  bool parse_json_request( const string& line,
+			   json& the_json,
+			   string& error ){
+    // one request of the JSON protocol. the_json is empty on failure
+    try {
+      the_json = json::parse( line );
+    }
+    catch ( const exception& e ){
+      the_json.clear();
+      error = e.what();
+      return false;
+    }
+    return true;
+  }
+
+}
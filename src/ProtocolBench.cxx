@@ -0,0 +1,453 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+// microbenchmarks of the string handling done for every request:
+// command splitting, url decoding, JSON parsing and the parsing of
+// answers by the client. Inputs are generated with a fixed seed, so
+// runs are comparable; results are written as JSON
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/json.hpp"
+#include "timblserver/Protocol.h"
+
+using namespace std;
+using namespace TimblServer;
+using namespace nlohmann;
+
+inline void usage(){
+  cerr << "protocolbench [-t MilliSeconds] [-r Repeats] [-f Filter]"
+       << " [-o OutputFile]" << endl
+       << "runs every benchmark whose name contains 'Filter' 'Repeats'"
+       << " times (default 5)," << endl
+       << "each run lasting at least 'MilliSeconds' (default 50), and"
+       << " writes the results" << endl
+       << "as JSON to OutputFile (default: standard output)." << endl;
+}
+
+const unsigned int SEED = 4711;
+
+// every allocation of this program is counted, so the benchmarks can
+// report the allocations per operation too
+static std::atomic<size_t> allocations( 0 );
+
+void *operator new( size_t size ){
+  ++allocations;
+  void *p = malloc( size ? size : 1 );
+  if ( !p ){
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void operator delete( void *p ) noexcept {
+  free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept {
+  free( p );
+}
+
+struct Inputs {
+  // a fixed set of generated requests and answers per benchmark
+  explicit Inputs( unsigned int seed ): rng( seed ){};
+  string word( size_t len ){
+    static const string letters = "abcdefghijklmnopqrstuvwxyz";
+    string result;
+    for ( size_t i=0; i < len; ++i ){
+      result += letters[rng() % letters.size()];
+    }
+    return result;
+  }
+  string instance( size_t features ){
+    string result;
+    for ( size_t i=0; i < features; ++i ){
+      result += word( 1 + rng() % 8 ) + ",";
+    }
+    result += "?";
+    return result;
+  }
+  string distribution( size_t classes ){
+    string result = "{ ";
+    for ( size_t i=0; i < classes; ++i ){
+      if ( i > 0 ){
+	result += ", ";
+      }
+      result += "C" + TiCC::toString( i ) + " "
+	+ TiCC::toString( 1 + rng() % 100 );
+    }
+    result += " }";
+    return result;
+  }
+  string result_line( size_t classes, bool neighbors ){
+    string result = "CATEGORY {C" + TiCC::toString( rng() % classes )
+      + "} DISTRIBUTION " + distribution( classes )
+      + " DISTANCE {0." + TiCC::toString( rng() % 100000 ) + "}";
+    if ( neighbors ){
+      result += " NEIGHBORS";
+    }
+    return result;
+  }
+  vector<string> neighbor_block( size_t k, size_t classes ){
+    vector<string> result;
+    for ( size_t i=0; i < k; ++i ){
+      result.push_back( "# k=" + TiCC::toString( i+1 ) + "\t"
+			+ distribution( classes ) + "\t0."
+			+ TiCC::toString( rng() % 100000 ) );
+    }
+    result.push_back( "ENDNEIGHBORS" );
+    return result;
+  }
+  string url_encode( const string& s ){
+    ostringstream os;
+    for ( const auto c : s ){
+      if ( isalnum( (unsigned char)c ) ){
+	os << c;
+      }
+      else if ( c == ' ' ){
+	os << '+';
+      }
+      else {
+	os << '%' << uppercase << hex << setw(2) << setfill('0')
+	   << int((unsigned char)c) << dec;
+      }
+    }
+    return os.str();
+  }
+  mt19937 rng;
+};
+
+struct Benchmark {
+  string name;
+  function<size_t(size_t)> op; // one operation on input i, returns a size
+};
+
+struct Measurement {
+  string name;
+  double median;
+  double min;
+  double allocs;
+  size_t ops;
+  size_t repeats;
+};
+
+size_t sink = 0;
+
+Measurement measure( const Benchmark& bench,
+		     double min_ms,
+		     size_t repeats ){
+  // grow the number of operations until one run takes at least min_ms,
+  // then keep the median and the fastest of 'repeats' runs
+  size_t ops = 1;
+  while ( true ){
+    auto t0 = chrono::steady_clock::now();
+    for ( size_t i=0; i < ops; ++i ){
+      sink += bench.op( i );
+    }
+    chrono::duration<double,milli> d = chrono::steady_clock::now() - t0;
+    if ( d.count() >= min_ms ){
+      break;
+    }
+    if ( d.count() < min_ms / 10 ){
+      ops *= 10;
+    }
+    else {
+      ops = size_t( ops * 1.2 * min_ms / d.count() ) + 1;
+    }
+  }
+  vector<double> ns_per_op;
+  size_t allocs_before = allocations;
+  for ( size_t r=0; r < repeats; ++r ){
+    auto t0 = chrono::steady_clock::now();
+    for ( size_t i=0; i < ops; ++i ){
+      sink += bench.op( i );
+    }
+    chrono::duration<double,nano> d = chrono::steady_clock::now() - t0;
+    ns_per_op.push_back( d.count() / ops );
+  }
+  size_t allocs = allocations - allocs_before;
+  sort( ns_per_op.begin(), ns_per_op.end() );
+  Measurement result;
+  result.allocs = double(allocs) / ( ops * repeats );
+  result.name = bench.name;
+  result.median = ns_per_op[ns_per_op.size()/2];
+  result.min = ns_per_op.front();
+  result.ops = ops;
+  result.repeats = repeats;
+  return result;
+}
+
+const size_t N_INPUTS = 256;
+
+struct Scratch {
+  // the strings a connection reuses from one request to the next
+  string com;
+  string rest;
+  string cls;
+  string db;
+  string dist;
+};
+
+vector<Benchmark> create_benchmarks( Inputs& in ){
+  vector<Benchmark> result;
+  auto scratch = make_shared<Scratch>();
+  // TCP server: commands
+  auto tcp_lines = make_shared<vector<string>>();
+  static const vector<string> commands = { "classify", "c", "base",
+					   "query", "set", "learn",
+					   "# comment" };
+  for ( size_t i=0; i < N_INPUTS; ++i ){
+    (*tcp_lines).push_back( commands[i % commands.size()] + " "
+			    + in.instance( 8 ) );
+  }
+  result.push_back( { "tcp/split_command",
+	[tcp_lines,scratch]( size_t i ){
+	  Scratch& sc = *scratch;
+	  split_command( (*tcp_lines)[i % N_INPUTS], sc.com, sc.rest );
+	  return sc.com.size() + sc.rest.size();
+	} } );
+  result.push_back( { "tcp/check_command",
+	[tcp_lines,scratch]( size_t i ){
+	  Scratch& sc = *scratch;
+	  split_command( (*tcp_lines)[i % N_INPUTS], sc.com, sc.rest );
+	  return size_t( check_command( sc.com ) );
+	} } );
+  for ( const size_t width : { 8, 200 } ){
+    string label = width < 100 ? "short" : "wide";
+    auto lines = make_shared<vector<string>>();
+    for ( size_t i=0; i < N_INPUTS; ++i ){
+      (*lines).push_back( "classify " + in.instance( width ) );
+    }
+    result.push_back( { "tcp/split_command/" + label,
+	  [lines,scratch]( size_t i ){
+	    Scratch& sc = *scratch;
+	    split_command( (*lines)[i % N_INPUTS], sc.com, sc.rest );
+	    return sc.com.size() + sc.rest.size();
+	  } } );
+    // HTTP server: url decoding and the query string
+    auto queries = make_shared<vector<string>>();
+    for ( size_t i=0; i < N_INPUTS; ++i ){
+      (*queries).push_back( "base=dimin&set=" + in.url_encode( "-k 3 -mM" )
+			    + "&classify="
+			    + in.url_encode( "\"" + in.instance( width )
+					     + "\"" ) );
+    }
+    result.push_back( { "http/urlDecode/" + label,
+	  [queries]( size_t i ){
+	    return urlDecode( (*queries)[i % N_INPUTS] ).size();
+	  } } );
+    result.push_back( { "http/parse_query/" + label,
+	  [queries]( size_t i ){
+	    ostringstream log;
+	    auto acts = parse_query( (*queries)[i % N_INPUTS], log );
+	    size_t len = 0;
+	    for ( const auto& it : acts ){
+	      len += strip_quotes( urlDecode( it.second ) ).size();
+	    }
+	    return len;
+	  } } );
+    // JSON server: single requests and arrays of parameters
+    auto requests = make_shared<vector<string>>();
+    for ( size_t i=0; i < N_INPUTS; ++i ){
+      json req;
+      req["command"] = "classify";
+      if ( i % 2 == 0 ){
+	req["param"] = in.instance( width );
+      }
+      else {
+	json params = json::array();
+	for ( size_t j=0; j < 10; ++j ){
+	  params.push_back( in.instance( width ) );
+	}
+	req["params"] = params;
+      }
+      (*requests).push_back( req.dump() );
+    }
+    result.push_back( { "json/parse_request/" + label,
+	  [requests]( size_t i ){
+	    json the_json;
+	    string error;
+	    parse_json_request( (*requests)[i % N_INPUTS], the_json, error );
+	    return the_json.size();
+	  } } );
+  }
+  auto bad_requests = make_shared<vector<string>>();
+  for ( size_t i=0; i < N_INPUTS; ++i ){
+    (*bad_requests).push_back( "{\"command\":\"classify\",\"param\":\""
+			       + in.instance( 8 ) );
+  }
+  result.push_back( { "json/parse_request/invalid",
+	[bad_requests]( size_t i ){
+	  json the_json;
+	  string error;
+	  parse_json_request( (*bad_requests)[i % N_INPUTS],
+			      the_json, error );
+	  return error.size();
+	} } );
+  result.push_back( { "json/json_error",
+	[]( size_t i ){
+	  return json_error( i % 2 ? "missing 'param' key"
+			     : "unknown command" ).dump().size();
+	} } );
+  // client: the answers of the TCP server
+  for ( const size_t classes : { 2, 50, 1000 } ){
+    auto answers = make_shared<vector<string>>();
+    for ( size_t i=0; i < N_INPUTS; ++i ){
+      (*answers).push_back( in.result_line( classes, false ) );
+    }
+    string label = TiCC::toString( classes ) + "classes";
+    result.push_back( { "client/extract_code/" + label,
+	  [answers,scratch]( size_t i ){
+	    Scratch& sc = *scratch;
+	    return size_t( extract_code( (*answers)[i % N_INPUTS], sc.rest ) )
+	      + sc.rest.size();
+	  } } );
+    result.push_back( { "client/parse_result/" + label,
+	  [answers,scratch]( size_t i ){
+	    Scratch& sc = *scratch;
+	    extract_code( (*answers)[i % N_INPUTS], sc.rest );
+	    bool neighbors;
+	    parse_result( sc.rest, sc.cls, sc.db, sc.dist, neighbors );
+	    return sc.cls.size() + sc.db.size() + sc.dist.size();
+	  } } );
+  }
+  for ( const size_t k : { 1, 25 } ){
+    // an answer followed by a block of k neighbors, as read by the client
+    auto blocks = make_shared<vector<vector<string>>>();
+    for ( size_t i=0; i < N_INPUTS/4; ++i ){
+      vector<string> block = { in.result_line( 20, true ) };
+      vector<string> nb = in.neighbor_block( k, 20 );
+      block.insert( block.end(), nb.begin(), nb.end() );
+      (*blocks).push_back( block );
+    }
+    result.push_back( { "client/neighbors/k=" + TiCC::toString( k ),
+	  [blocks,scratch]( size_t i ){
+	    Scratch& sc = *scratch;
+	    const vector<string>& block = (*blocks)[i % blocks->size()];
+	    extract_code( block[0], sc.rest );
+	    bool neighbors;
+	    parse_result( sc.rest, sc.cls, sc.db, sc.dist, neighbors );
+	    vector<string> lines;
+	    for ( size_t j=1; neighbors && j < block.size(); ++j ){
+	      if ( extract_code( block[j], sc.rest ) == EndNeighbors ){
+		break;
+	      }
+	      lines.push_back( block[j] );
+	    }
+	    return lines.size() + sc.db.size();
+	  } } );
+  }
+  return result;
+}
+
+int main( int argc, char *argv[] ){
+  TiCC::CL_Options opts( "t:r:f:o:h", "" );
+  try {
+    opts.init( argc, argv );
+  }
+  catch( TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'h' ) ){
+    usage();
+    exit(EXIT_SUCCESS);
+  }
+  string value;
+  double min_ms = 50;
+  size_t repeats = 5;
+  string filter;
+  string output;
+  if ( opts.extract( 't', value )
+       && ( !TiCC::stringTo( value, min_ms ) || min_ms <= 0 ) ){
+    cerr << "invalid time: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'r', value )
+       && ( !TiCC::stringTo( value, repeats ) || repeats == 0 ) ){
+    cerr << "invalid number of repeats: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  opts.extract( 'f', filter );
+  opts.extract( 'o', output );
+  Inputs inputs( SEED );
+  vector<Benchmark> benchmarks = create_benchmarks( inputs );
+  json results = json::array();
+  for ( const auto& bench : benchmarks ){
+    if ( !filter.empty() && bench.name.find( filter ) == string::npos ){
+      continue;
+    }
+    Measurement m = measure( bench, min_ms, repeats );
+    cerr << left << setw(36) << m.name << right << fixed
+	 << setprecision(1) << setw(12) << m.median << " ns/op"
+	 << setw(10) << m.allocs << " allocs/op" << endl;
+    json entry;
+    entry["name"] = m.name;
+    entry["ns_per_op"] = m.median;
+    entry["min_ns_per_op"] = m.min;
+    entry["allocs_per_op"] = m.allocs;
+    entry["ops"] = m.ops;
+    entry["repeats"] = m.repeats;
+    results.push_back( entry );
+  }
+  json doc;
+  doc["seed"] = SEED;
+  doc["min_ms"] = min_ms;
+  doc["benchmarks"] = results;
+  doc["sink"] = sink;
+  if ( output.empty() ){
+    cout << doc.dump( 2 ) << endl;
+  }
+  else {
+    ofstream os( output );
+    if ( !os ){
+      cerr << "unable to open " << output << endl;
+      exit(EXIT_FAILURE);
+    }
+    os << doc.dump( 2 ) << endl;
+  }
+  exit(EXIT_SUCCESS);
+}
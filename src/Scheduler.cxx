@@ -0,0 +1,301 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Scheduler.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  Scheduler::Slot& Scheduler::Slot::operator=( Slot&& other ){
+    if ( this != &other ){
+      release();
+      sched = other.sched;
+      base = other.base;
+      ok = other.ok;
+      other.sched = 0;
+    }
+    return *this;
+  }
+
+  void Scheduler::Slot::release(){
+    if ( sched ){
+      sched->release( base );
+      sched = 0;
+    }
+  }
+
+  Scheduler::Scheduler( const TiCC::Configuration *config ):
+    _enabled(false),
+    workers(0),
+    active(0),
+    vclock(0),
+    queue_timeout(0)
+  {
+    string value = config->lookUp( "workers" );
+    if ( !value.empty() && !TiCC::stringTo( value, workers ) ){
+      throw runtime_error( "invalid value for 'workers': " + value );
+    }
+    value = config->lookUp( "queue_timeout" );
+    if ( !value.empty() && !TiCC::stringTo( value, queue_timeout ) ){
+      throw runtime_error( "invalid value for 'queue_timeout': " + value );
+    }
+    if ( config->hasSection( "bulkheads" ) ){
+      for ( const auto& it : config->lookUpAll( "bulkheads" ) ){
+	vector<string> parts = TiCC::split_at( it.second, ":" );
+	bulkhead& bh = bulkheads[it.first];
+	if ( parts.empty() || parts.size() > 3
+	     || !TiCC::stringTo( parts[0], bh.limit )
+	     || ( parts.size() > 1 && !TiCC::stringTo( parts[1], bh.queue ) )
+	     || ( parts.size() > 2 && !TiCC::stringTo( parts[2], bh.weight ) )
+	     || bh.weight <= 0 ){
+	  throw runtime_error( "invalid bulkhead for base '" + it.first
+			       + "': " + it.second
+			       + " (use limit[:queue[:weight]])" );
+	}
+      }
+    }
+    if ( config->hasSection( "clientclasses" ) ){
+      for ( const auto& it : config->lookUpAll( "clientclasses" ) ){
+	vector<string> parts = TiCC::split_at( it.second, ":", 2 );
+	double weight = 0;
+	if ( parts.size() != 2
+	     || !TiCC::stringTo( parts[0], weight )
+	     || weight <= 0 ){
+	  throw runtime_error( "invalid client class '" + it.first
+			       + "': " + it.second
+			       + " (use weight:prefix,prefix...)" );
+	}
+	class_weights[it.first] = weight;
+	for ( const auto& prefix : TiCC::split_at( parts[1], "," ) ){
+	  class_prefixes.push_back( make_pair( prefix, it.first ) );
+	}
+      }
+    }
+    _enabled = workers > 0 || !bulkheads.empty();
+  }
+
+  string Scheduler::client_class( int sock ) const {
+    // the class of the peer of socket 'sock', by longest prefix match
+    if ( class_prefixes.empty() ){
+      return "default";
+    }
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if ( getpeername( sock, (sockaddr*)&addr, &len ) != 0 ){
+      return "default";
+    }
+    char buf[INET6_ADDRSTRLEN] = "";
+    if ( addr.ss_family == AF_INET ){
+      inet_ntop( AF_INET, &((sockaddr_in*)&addr)->sin_addr,
+		 buf, sizeof(buf) );
+    }
+    else if ( addr.ss_family == AF_INET6 ){
+      inet_ntop( AF_INET6, &((sockaddr_in6*)&addr)->sin6_addr,
+		 buf, sizeof(buf) );
+    }
+    string peer = buf;
+    if ( addr.ss_family == AF_UNIX ){
+      peer = "local";
+    }
+    string result = "default";
+    size_t best = 0;
+    for ( const auto& it : class_prefixes ){
+      if ( it.first == "*" && best == 0 ){
+	result = it.second;
+      }
+      else if ( it.first.size() > best
+		&& peer.compare( 0, it.first.size(), it.first ) == 0 ){
+	best = it.first.size();
+	result = it.second;
+      }
+    }
+    return result;
+  }
+
+  Scheduler::bulkhead& Scheduler::get_bulkhead( const string& base ){
+    // bases without a [[bulkheads]] entry get an unlimited one
+    return bulkheads[base];
+  }
+
+  Scheduler::Slot Scheduler::acquire( const string& base,
+				      const string& cls ){
+    // wait for a place to classify on 'base'. An empty Slot is returned
+    // when the base is overloaded (queue full or waited too long)
+    if ( !_enabled ){
+      return Slot( 0, base );
+    }
+    auto start = chrono::steady_clock::now();
+    unique_lock<mutex> lock( mtx );
+    bulkhead& bh = get_bulkhead( base );
+    if ( bh.queue > 0 && bh.waiting >= bh.queue ){
+      ++bh.rejected;
+      return Slot();
+    }
+    auto cit = bh.classes.find( cls );
+    if ( cit == bh.classes.end() ){
+      client_queue cq;
+      auto wit = class_weights.find( cls );
+      if ( wit != class_weights.end() ){
+	cq.weight = wit->second;
+      }
+      cit = bh.classes.insert( make_pair( cls, cq ) ).first;
+    }
+    client_queue& cq = cit->second;
+    // queues that were idle start at the current virtual time, so
+    // they can't claim the capacity they didn't use
+    if ( bh.waiting == 0 && bh.active == 0 ){
+      bh.vtime = max( bh.vtime, vclock );
+    }
+    if ( cq.waiting.empty() ){
+      cq.vtime = max( cq.vtime, bh.vclock );
+    }
+    ticket t;
+    cq.waiting.push_back( &t );
+    ++bh.waiting;
+    dispatch();
+    auto granted = [&t]{ return t.granted; };
+    if ( queue_timeout > 0 ){
+      if ( !cv.wait_for( lock,
+			 chrono::milliseconds( queue_timeout ),
+			 granted ) ){
+	cq.waiting.erase( find( cq.waiting.begin(), cq.waiting.end(), &t ) );
+	--bh.waiting;
+	++bh.timed_out;
+	return Slot();
+      }
+    }
+    else {
+      cv.wait( lock, granted );
+    }
+    chrono::duration<double,milli> waited
+      = chrono::steady_clock::now() - start;
+    bh.wait_ms += waited.count();
+    return Slot( this, base );
+  }
+
+  void Scheduler::dispatch(){
+    // hand out free places, to the base with the lowest virtual time,
+    // and within that base to the client class with the lowest one.
+    // must be called with mtx locked
+    bool granted = false;
+    while ( workers == 0 || active < workers ){
+      bulkhead *best = 0;
+      for ( auto& it : bulkheads ){
+	bulkhead& bh = it.second;
+	if ( bh.waiting == 0
+	     || ( bh.limit > 0 && bh.active >= bh.limit ) ){
+	  continue;
+	}
+	if ( !best || bh.vtime < best->vtime ){
+	  best = &bh;
+	}
+      }
+      if ( !best ){
+	break;
+      }
+      client_queue *cbest = 0;
+      for ( auto& it : best->classes ){
+	client_queue& cq = it.second;
+	if ( cq.waiting.empty() ){
+	  continue;
+	}
+	if ( !cbest || cq.vtime < cbest->vtime ){
+	  cbest = &cq;
+	}
+      }
+      ticket *t = cbest->waiting.front();
+      cbest->waiting.pop_front();
+      t->granted = true;
+      granted = true;
+      vclock = best->vtime;
+      best->vtime += 1.0/best->weight;
+      best->vclock = cbest->vtime;
+      cbest->vtime += 1.0/cbest->weight;
+      ++cbest->served;
+      ++best->served;
+      ++best->active;
+      --best->waiting;
+      ++active;
+    }
+    if ( granted ){
+      cv.notify_all();
+    }
+  }
+
+  void Scheduler::release( const string& base ){
+    lock_guard<mutex> lock( mtx );
+    bulkhead& bh = get_bulkhead( base );
+    --bh.active;
+    --active;
+    dispatch();
+  }
+
+  json Scheduler::stats() const {
+    lock_guard<mutex> lock( mtx );
+    json result;
+    result["enabled"] = _enabled;
+    result["workers"] = workers;
+    result["active"] = active;
+    json bases = json::object();
+    for ( const auto& it : bulkheads ){
+      const bulkhead& bh = it.second;
+      json entry;
+      entry["limit"] = bh.limit;
+      entry["queue"] = bh.queue;
+      entry["weight"] = bh.weight;
+      entry["active"] = bh.active;
+      entry["waiting"] = bh.waiting;
+      entry["served"] = bh.served;
+      entry["rejected"] = bh.rejected;
+      entry["timed_out"] = bh.timed_out;
+      entry["avg_wait_ms"] = bh.served > 0 ? bh.wait_ms / bh.served : 0.0;
+      json classes = json::object();
+      for ( const auto& cit : bh.classes ){
+	classes[cit.first] = cit.second.served;
+      }
+      entry["classes"] = classes;
+      bases[it.first] = entry;
+    }
+    result["bases"] = bases;
+    return result;
+  }
+
+}
@@ -0,0 +1,291 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ticcutils/StringOps.h"
+#include "timbl/TimblAPI.h"
+#include "ticcutils/ServerBase.h"
+#include "timblserver/TimblServer.h"
+#include "timblserver/Protocol.h"
+
+using namespace std;
+using namespace Timbl;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  static void not_owned( TimblExperiment * ){
+    // the loaded experiments live as long as the server
+  }
+
+  shared_ptr<TimblExperiment> ServerCommon::find_experiment( const string& name,
+							     int node ) const {
+    // the experiment for base 'name': the latest version when the base
+    // learns, otherwise preferably the replica on 'node'
+    auto it = experiments.find( name );
+    if ( it == experiments.end() ){
+      return shared_ptr<TimblExperiment>();
+    }
+    if ( learner.learns( name ) ){
+      return learner.current( name );
+    }
+    if ( node > 0 ){
+      auto rit = replicas.find( name );
+      if ( rit != replicas.end()
+	   && (size_t)node < rit->second.size()
+	   && rit->second[node] != 0 ){
+	return shared_ptr<TimblExperiment>( rit->second[node], not_owned );
+      }
+    }
+    return shared_ptr<TimblExperiment>( it->second, not_owned );
+  }
+
+  void ServerCommon::refresh( TimblThread *client,
+			      const string& name ) const {
+    // let the client use the latest version of a learning base
+    if ( client && learner.learns( name ) ){
+      client->refresh( learner.current( name ) );
+    }
+  }
+
+  void ServerCommon::load_vocabularies( const TiCC::Configuration *config,
+				       TiCC::LogStream& s_log ){
+    // build the feature vocabularies of the [[vocabulary]] section
+    // (lines: basename=datafile)
+    if ( !config->hasSection( "vocabulary" ) ){
+      return;
+    }
+    for ( const auto& it : config->lookUpAll( "vocabulary" ) ){
+      if ( experiments.find( it.first ) == experiments.end() ){
+	s_log << "vocabulary: unknown base '" << it.first << "' skipped"
+	      << endl;
+	continue;
+      }
+      Vocabulary vocab;
+      string error;
+      if ( vocab.fill( it.second, error ) ){
+	s_log << "vocabulary for " << it.first << ": "
+	      << vocab.num_features() << " features, version "
+	      << vocab.version() << endl;
+	vocabularies[it.first] = vocab;
+      }
+      else {
+	s_log << "vocabulary for " << it.first << " failed: " << error << endl;
+      }
+    }
+  }
+
+  const Vocabulary *ServerCommon::find_vocabulary( const string& name ) const {
+    auto it = vocabularies.find( name );
+    if ( it == vocabularies.end() ){
+      return 0;
+    }
+    return &it->second;
+  }
+
+  static size_t warm_up_exp( TimblExperiment *exp,
+			     const vector<string>& lines,
+			     size_t num_threads,
+			     const Affinity& affinity,
+			     int node ){
+    // classify all lines on clones of exp, like connections would do
+    // returns the number of successful classifications
+    vector<size_t> counts( num_threads, 0 );
+    vector<thread> workers;
+    for ( size_t t = 0; t < num_threads; ++t ){
+      workers.push_back( thread( [&,t](){
+	    if ( affinity.numa() ){
+	      affinity.bind_to_node( node );
+	    }
+	    ostream null_stream( 0 );
+	    TimblExperiment *clone = exp->clone();
+	    *clone = *exp;
+	    clone->connectToSocket( &null_stream );
+	    if ( exp->getOptParams() ){
+	      clone->setOptParams( exp->getOptParams()->Clone( &null_stream ) );
+	    }
+	    string answer;
+	    string distrib;
+	    double distance;
+	    for ( size_t i = t; i < lines.size(); i += num_threads ){
+	      if ( clone->Classify( lines[i], answer, distrib, distance ) ){
+		++counts[t];
+	      }
+	    }
+	    delete clone;
+	  } ) );
+    }
+    size_t result = 0;
+    for ( size_t t = 0; t < num_threads; ++t ){
+      workers[t].join();
+      result += counts[t];
+    }
+    return result;
+  }
+
+  void ServerCommon::warm_up( const TiCC::Configuration *config,
+			      TiCC::LogStream& s_log ){
+    // classify the lines of the warm-up files of the [[warmup]] section
+    // (lines: basename=file) to fill the caches before going live
+    warmup_info = json::object();
+    if ( !config->hasSection( "warmup" ) ){
+      return;
+    }
+    size_t num_threads = thread::hardware_concurrency();
+    string value = config->lookUp( "warmup_threads" );
+    if ( !value.empty() && !TiCC::stringTo( value, num_threads ) ){
+      throw runtime_error( "invalid value for 'warmup_threads': " + value );
+    }
+    if ( num_threads == 0 ){
+      num_threads = 1;
+    }
+    for ( const auto& it : config->lookUpAll( "warmup" ) ){
+      auto exp_it = experiments.find( it.first );
+      if ( exp_it == experiments.end() ){
+	s_log << "warm-up: unknown base '" << it.first << "' skipped" << endl;
+	continue;
+      }
+      ifstream is( it.second );
+      if ( !is ){
+	s_log << "warm-up: unable to open '" << it.second << "' for base '"
+	      << it.first << "'" << endl;
+	continue;
+      }
+      vector<string> lines;
+      string line;
+      while ( getline( is, line ) ){
+	line = TiCC::trim( line );
+	if ( !line.empty() ){
+	  lines.push_back( line );
+	}
+      }
+      size_t threads = min( num_threads, lines.size() );
+      if ( threads == 0 ){
+	continue;
+      }
+      auto start = chrono::steady_clock::now();
+      vector<TimblExperiment*> copies;
+      auto rit = replicas.find( it.first );
+      if ( rit != replicas.end() ){
+	copies = rit->second;
+      }
+      else {
+	copies.push_back( exp_it->second );
+      }
+      size_t done = 0;
+      for ( size_t node = 0; node < copies.size(); ++node ){
+	if ( copies[node] ){
+	  done += warm_up_exp( copies[node], lines, threads,
+			       affinity, node );
+	}
+      }
+      chrono::duration<double,milli> took
+	= chrono::steady_clock::now() - start;
+      json entry;
+      entry["file"] = it.second;
+      entry["instances"] = lines.size();
+      entry["classified"] = done;
+      entry["threads"] = threads;
+      entry["ms"] = took.count();
+      warmup_info[it.first] = entry;
+      s_log << "warmed up " << it.first << " with " << done
+	    << " classifications in " << took.count() << " ms" << endl;
+    }
+  }
+
+  json ServerCommon::health_to_json() const {
+    json result;
+    result["status"] = ready ? "ready" : "starting";
+    result["warmup"] = warmup_info;
+    return result;
+  }
+
+  json ServerCommon::stats_to_json() const {
+    json result;
+    result["status"] = "ok";
+    json bases = json::array();
+    for ( const auto& it : experiments ){
+      bases.push_back( it.first );
+    }
+    result["bases"] = bases;
+    result["ready"] = is_ready();
+    result["affinity"] = affinity.stats();
+    result["scheduler"] = scheduler.stats();
+    if ( learner.enabled() ){
+      result["learn"] = learner.stats();
+    }
+    result["sessions"] = sessions.stats();
+    if ( batcher.enabled() ){
+      result["batching"] = batcher.stats();
+    }
+    if ( perf.requested() ){
+      result["perf"] = perf.stats();
+    }
+    if ( AllocTracker::active() ){
+      result["allocations"] = AllocTracker::stats();
+    }
+    if ( profiler.enabled() ){
+      result["profile"] = profiler.stats();
+    }
+    json fallback_stats = fallbacks.stats();
+    if ( !fallback_stats.empty() ){
+      result["fallback"] = fallback_stats;
+    }
+    return result;
+  }
+
+  bool ServerCommon::profile_request( const string& param,
+				      TiCC::LogStream& log,
+				      json& result ){
+    // handles 'profile [<seconds>]' (default 30): profile the server for
+    // that long. False when param is another request
+    vector<string> parts = TiCC::split( param );
+    if ( parts.empty() || TiCC::lowercase( parts[0] ) != "profile" ){
+      return false;
+    }
+    double seconds = 30;
+    if ( parts.size() > 2
+	 || ( parts.size() == 2 && !TiCC::stringTo( parts[1], seconds ) ) ){
+      result = json_error( "usage: profile [<seconds>]" );
+    }
+    else {
+      result = profiler.start( seconds, log );
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,189 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Session.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  using Clock = chrono::steady_clock;
+
+  static double limit_setting( const TiCC::Configuration *config,
+			       const string& key ){
+    string value = config->lookUp( key );
+    if ( value.empty() ){
+      return 0;
+    }
+    double result = 0;
+    if ( !TiCC::stringTo( value, result ) || result < 0 ){
+      throw runtime_error( "invalid value for '" + key + "': " + value );
+    }
+    return result;
+  }
+
+  SessionLimits::SessionLimits( const TiCC::Configuration *config ):
+    released(0),
+    revived(0),
+    multiplexed(0)
+  {
+    for ( auto& c : closed ){
+      c = 0;
+    }
+    idle_release_s = limit_setting( config, "idle_release" );
+    idle_timeout_s = limit_setting( config, "idle_timeout" );
+    lifetime_s = limit_setting( config, "session_lifetime" );
+    max_requests = limit_setting( config, "session_requests" );
+    max_in_flight = limit_setting( config, "session_concurrency" );
+    if ( max_in_flight == 0 ){
+      max_in_flight = 4;
+    }
+  }
+
+  string SessionLimits::to_string( Reason r ){
+    switch ( r ){
+    case Idle:
+      return "idle";
+    case Lifetime:
+      return "lifetime";
+    case Requests:
+      return "requests";
+    default:
+      return "unknown";
+    }
+  }
+
+  json SessionLimits::stats() const {
+    json result;
+    json reaped = json::object();
+    for ( int r = 0; r < NumReasons; ++r ){
+      reaped[to_string( Reason(r) )] = closed[r].load();
+    }
+    result["reaped"] = reaped;
+    result["released"] = released.load();
+    result["revived"] = revived.load();
+    result["concurrency"] = max_in_flight;
+    result["multiplexed"] = multiplexed.load();
+    return result;
+  }
+
+  Session::Session( SessionLimits& l, int sock, istream& in ):
+    limits(l),
+    fd(sock),
+    is(in),
+    born( Clock::now() ),
+    requests(0),
+    why( SessionLimits::NumReasons )
+  {
+  }
+
+  bool Session::close( SessionLimits::Reason r ){
+    why = r;
+    ++limits.closed[r];
+    return false;
+  }
+
+  static double seconds_since( Clock::time_point t, Clock::time_point now ){
+    return chrono::duration<double>( now - t ).count();
+  }
+
+  bool Session::wait( const function<void()>& on_idle ){
+    // wait until the next request arrives, or a limit is reached.
+    // on_idle is called when the connection has been idle for
+    // idle_release seconds
+    if ( limits.max_requests > 0 && requests >= limits.max_requests ){
+      return close( SessionLimits::Requests );
+    }
+    ++requests;
+    Clock::time_point now = Clock::now();
+    if ( limits.lifetime_s > 0
+	 && seconds_since( born, now ) >= limits.lifetime_s ){
+      return close( SessionLimits::Lifetime );
+    }
+    if ( fd < 0 || ( !limits.watch_idle() && limits.lifetime_s == 0 ) ){
+      // nothing to watch, or no socket to watch: just read
+      return true;
+    }
+    Clock::time_point idle_since = now;
+    bool released = false;
+    while ( is.rdbuf()->in_avail() <= 0 ){
+      // nothing buffered. Wait on the socket, at most until the next limit
+      double wait_s = -1;
+      auto until = [&]( double limit_s, Clock::time_point from ){
+	double left = limit_s - seconds_since( from, now );
+	if ( wait_s < 0 || left < wait_s ){
+	  wait_s = left;
+	}
+      };
+      if ( limits.lifetime_s > 0 ){
+	if ( seconds_since( born, now ) >= limits.lifetime_s ){
+	  return close( SessionLimits::Lifetime );
+	}
+	until( limits.lifetime_s, born );
+      }
+      if ( limits.idle_timeout_s > 0 ){
+	if ( seconds_since( idle_since, now ) >= limits.idle_timeout_s ){
+	  return close( SessionLimits::Idle );
+	}
+	until( limits.idle_timeout_s, idle_since );
+      }
+      if ( limits.idle_release_s > 0 && !released ){
+	if ( seconds_since( idle_since, now ) >= limits.idle_release_s ){
+	  on_idle();
+	  ++limits.released;
+	  released = true;
+	  continue;
+	}
+	until( limits.idle_release_s, idle_since );
+      }
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      int timeout_ms = wait_s < 0 ? -1 : max( 1, int( wait_s * 1000 ) );
+      int res = poll( &pfd, 1, timeout_ms );
+      if ( res > 0 || ( res < 0 && errno != EINTR ) ){
+	// input, a hangup or an error: let the reader find out
+	break;
+      }
+      now = Clock::now();
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,384 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "timblserver/ShmTransport.h"
+
+using namespace std;
+
+namespace TimblServer {
+
+  const uint32_t SHM_MAGIC = 0x54694d42; // "TiMB"
+  const uint32_t SHM_VERSION = 1;
+  const size_t SPIN_COUNT = 2000;
+
+  static size_t data_offset(){
+    return ( sizeof(ShmHeader) + 63 ) & ~size_t(63);
+  }
+
+  static void futex_wait( atomic<uint32_t> *word, uint32_t expected ){
+    // sleep until 'word' changes, or 100 ms passed
+#ifdef __linux__
+    timespec ts = { 0, 100*1000*1000 };
+    syscall( SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT,
+	     expected, &ts, 0, 0 );
+#else
+    for ( int i=0; i < 1000 && word->load() == expected; ++i ){
+      this_thread::sleep_for( chrono::microseconds( 100 ) );
+    }
+#endif
+  }
+
+  static void futex_wake( atomic<uint32_t> *word ){
+#ifdef __linux__
+    syscall( SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE,
+	     1, 0, 0, 0 );
+#else
+    (void)word;
+#endif
+  }
+
+  ShmChannel::ShmChannel():
+    header(0),
+    mapped(0),
+    owner(false)
+  {}
+
+  ShmChannel::~ShmChannel(){
+    if ( header ){
+      munmap( header, mapped );
+    }
+    if ( owner ){
+      unlink();
+    }
+  }
+
+  bool ShmChannel::create( const string& name, size_t ring_size ){
+    _name = name;
+    mapped = data_offset() + 2 * ring_size;
+    int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+    if ( fd < 0 ){
+      mess = "shm_open " + name + ": " + strerror(errno);
+      return false;
+    }
+    owner = true;
+    if ( ftruncate( fd, mapped ) < 0 ){
+      mess = "ftruncate " + name + ": " + strerror(errno);
+      ::close( fd );
+      return false;
+    }
+    void *p = mmap( 0, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( p == MAP_FAILED ){
+      mess = "mmap " + name + ": " + strerror(errno);
+      return false;
+    }
+    // a fresh segment is zero filled, which is a pair of empty rings
+    header = static_cast<ShmHeader*>( p );
+    header->ring_size = ring_size;
+    header->version = SHM_VERSION;
+    header->magic = SHM_MAGIC;
+    return true;
+  }
+
+  bool ShmChannel::open( const string& name ){
+    _name = name;
+    int fd = shm_open( name.c_str(), O_RDWR, 0 );
+    if ( fd < 0 ){
+      mess = "shm_open " + name + ": " + strerror(errno);
+      return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || (size_t)st.st_size < data_offset() ){
+      mess = "invalid shared memory segment: " + name;
+      ::close( fd );
+      return false;
+    }
+    mapped = st.st_size;
+    void *p = mmap( 0, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( p == MAP_FAILED ){
+      mess = "mmap " + name + ": " + strerror(errno);
+      return false;
+    }
+    header = static_cast<ShmHeader*>( p );
+    if ( header->magic != SHM_MAGIC
+	 || header->version != SHM_VERSION
+	 || header->ring_size == 0
+	 || data_offset() + 2 * header->ring_size != mapped ){
+      mess = "invalid shared memory segment: " + name;
+      munmap( header, mapped );
+      header = 0;
+      return false;
+    }
+    return true;
+  }
+
+  void ShmChannel::unlink(){
+    // the mapping stays valid, only the name in /dev/shm goes
+    if ( owner ){
+      shm_unlink( _name.c_str() );
+      owner = false;
+    }
+  }
+
+  ShmRing *ShmChannel::in_ring( bool server ) const {
+    return server ? &header->to_server : &header->to_client;
+  }
+
+  ShmRing *ShmChannel::out_ring( bool server ) const {
+    return server ? &header->to_client : &header->to_server;
+  }
+
+  char *ShmChannel::in_data( bool server ) const {
+    char *base = reinterpret_cast<char*>( header ) + data_offset();
+    return server ? base : base + header->ring_size;
+  }
+
+  char *ShmChannel::out_data( bool server ) const {
+    char *base = reinterpret_cast<char*>( header ) + data_offset();
+    return server ? base + header->ring_size : base;
+  }
+
+  ShmStreamBuf::ShmStreamBuf( ShmChannel& c,
+			      bool server,
+			      const function<bool()>& a ):
+    in( c.in_ring( server ) ),
+    out( c.out_ring( server ) ),
+    in_data( c.in_data( server ) ),
+    out_data( c.out_data( server ) ),
+    size( c.ring_size() ),
+    read_pos( in->tail.load( memory_order_relaxed ) ),
+    write_pos( out->head.load( memory_order_relaxed ) ),
+    broken( false ),
+    alive( a )
+  {
+    setg( get_buf, get_buf, get_buf );
+    setp( put_buf, put_buf + sizeof(put_buf) );
+  }
+
+  ShmStreamBuf::int_type ShmStreamBuf::underflow(){
+    if ( broken ){
+      return traits_type::eof();
+    }
+    uint64_t tail = read_pos;
+    uint64_t head = in->head.load( memory_order_acquire );
+    size_t spins = 0;
+    while ( head == tail ){
+      if ( ++spins < SPIN_COUNT ){
+	this_thread::yield();
+      }
+      else {
+	// announce we're going to sleep, then look once more, so a
+	// writer either sees the flag or we see its data
+	uint32_t seq = in->data_seq.load( memory_order_acquire );
+	in->reader_waiting.store( 1, memory_order_seq_cst );
+	head = in->head.load( memory_order_seq_cst );
+	if ( head == tail ){
+	  futex_wait( &in->data_seq, seq );
+	}
+	in->reader_waiting.store( 0, memory_order_relaxed );
+	if ( !alive() ){
+	  return traits_type::eof();
+	}
+      }
+      head = in->head.load( memory_order_acquire );
+    }
+    if ( head - tail > size ){
+      // not written by a sane peer (this includes head < tail)
+      broken = true;
+      return traits_type::eof();
+    }
+    size_t avail = min<uint64_t>( head - tail, sizeof(get_buf) );
+    size_t pos = tail % size;
+    size_t first = min( avail, size - pos );
+    memcpy( get_buf, in_data + pos, first );
+    memcpy( get_buf + first, in_data, avail - first );
+    read_pos = tail + avail;
+    in->tail.store( read_pos, memory_order_release );
+    in->space_seq.fetch_add( 1, memory_order_seq_cst );
+    if ( in->writer_waiting.load( memory_order_seq_cst ) ){
+      futex_wake( &in->space_seq );
+    }
+    setg( get_buf, get_buf, get_buf + avail );
+    return traits_type::to_int_type( *gptr() );
+  }
+
+  bool ShmStreamBuf::write_out( const char *data, size_t len ){
+    if ( broken ){
+      return false;
+    }
+    size_t spins = 0;
+    while ( len > 0 ){
+      uint64_t head = write_pos;
+      uint64_t tail = out->tail.load( memory_order_acquire );
+      if ( head - tail > size ){
+	broken = true;
+	return false;
+      }
+      size_t room = size - ( head - tail );
+      if ( room == 0 ){
+	if ( ++spins < SPIN_COUNT ){
+	  this_thread::yield();
+	}
+	else {
+	  uint32_t seq = out->space_seq.load( memory_order_acquire );
+	  out->writer_waiting.store( 1, memory_order_seq_cst );
+	  tail = out->tail.load( memory_order_seq_cst );
+	  if ( size == head - tail ){
+	    futex_wait( &out->space_seq, seq );
+	  }
+	  out->writer_waiting.store( 0, memory_order_relaxed );
+	  if ( !alive() ){
+	    return false;
+	  }
+	}
+	continue;
+      }
+      spins = 0;
+      size_t n = min( len, room );
+      size_t pos = head % size;
+      size_t first = min( n, size - pos );
+      memcpy( out_data + pos, data, first );
+      memcpy( out_data, data + first, n - first );
+      write_pos = head + n;
+      out->head.store( write_pos, memory_order_release );
+      out->data_seq.fetch_add( 1, memory_order_seq_cst );
+      if ( out->reader_waiting.load( memory_order_seq_cst ) ){
+	futex_wake( &out->data_seq );
+      }
+      data += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  ShmStreamBuf::int_type ShmStreamBuf::overflow( int_type c ){
+    if ( sync() != 0 ){
+      return traits_type::eof();
+    }
+    if ( !traits_type::eq_int_type( c, traits_type::eof() ) ){
+      *pptr() = traits_type::to_char_type( c );
+      pbump( 1 );
+    }
+    return traits_type::not_eof( c );
+  }
+
+  int ShmStreamBuf::sync(){
+    size_t len = pptr() - pbase();
+    if ( len > 0 && !write_out( pbase(), len ) ){
+      return -1;
+    }
+    setp( put_buf, put_buf + sizeof(put_buf) );
+    return 0;
+  }
+
+  bool peer_alive( int fd ){
+    // the other side of a control connection is gone when it is
+    // readable but has nothing to say
+    pollfd pfd = { fd, POLLIN, 0 };
+    if ( poll( &pfd, 1, 0 ) <= 0 ){
+      return true;
+    }
+    if ( pfd.revents & ( POLLHUP | POLLERR | POLLNVAL ) ){
+      return false;
+    }
+    char c;
+    return recv( fd, &c, 1, MSG_PEEK | MSG_DONTWAIT ) > 0;
+  }
+
+  ShmClient::~ShmClient(){
+    delete stream;
+  }
+
+  bool ShmClient::connect( const string& path, size_t ring_size ){
+    static atomic<unsigned int> count(0);
+    string name = "/timbl-" + to_string( getpid() ) + "-"
+      + to_string( count++ );
+    if ( !channel.create( name, ring_size ) ){
+      mess = channel.getMessage();
+      return false;
+    }
+    if ( !control.connect_path( path ) ){
+      mess = control.getMessage();
+      return false;
+    }
+    string line;
+    if ( !control.write( name + "\n" ) || !control.read( line ) ){
+      mess = "shared memory handshake failed: " + control.getMessage();
+      return false;
+    }
+    if ( line != "OK" ){
+      mess = "server refused shared memory session: " + line;
+      return false;
+    }
+    // the server has it mapped, the name isn't needed anymore
+    channel.unlink();
+    int fd = control.getSockId();
+    stream = new ShmStream( channel, false,
+			    [fd](){ return peer_alive( fd ); } );
+    if ( !getline( *stream, _greeting ) ){
+      mess = "no greeting from the server";
+      return false;
+    }
+    return true;
+  }
+
+  bool ShmClient::request( const string& req, string& response ){
+    if ( !stream ){
+      mess = "not connected";
+      return false;
+    }
+    *stream << req << endl;
+    if ( !*stream || !getline( *stream, response ) ){
+      mess = "shared memory session lost";
+      return false;
+    }
+    return true;
+  }
+
+}
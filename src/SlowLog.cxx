@@ -0,0 +1,143 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include "ticcutils/StringOps.h"
+#include "ticcutils/Timer.h"
+#include "ticcutils/json.hpp"
+#include "timblserver/SlowLog.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  void StageTimer::reset(){
+    last = chrono::steady_clock::now();
+    for ( auto& s : spent ){
+      s = 0;
+    }
+    for ( auto& a : allocated ){
+      a.clear();
+    }
+    if ( AllocTracker::active() ){
+      meter.restart();
+    }
+  }
+
+  void StageTimer::mark( Stage stage ){
+    auto now = chrono::steady_clock::now();
+    chrono::duration<double,milli> d = now - last;
+    spent[stage] += d.count();
+    last = now;
+    if ( AllocTracker::active() ){
+      allocated[stage].add( meter.lap() );
+    }
+  }
+
+  double StageTimer::service_ms() const {
+    // reading is left out: on a persistent connection it includes the
+    // time the client was idle
+    return spent[Parse] + spent[Queue] + spent[Classify] + spent[Write];
+  }
+
+  SlowLog::SlowLog( const TiCC::Configuration *config ):
+    threshold(-1),
+    rate(10),
+    tokens(10),
+    suppressed(0)
+  {
+    string file_name = config->lookUp( "slowlog" );
+    if ( file_name.empty() ){
+      return;
+    }
+    threshold = 100;
+    string value = config->lookUp( "slowlog_ms" );
+    if ( !value.empty() && !TiCC::stringTo( value, threshold ) ){
+      throw runtime_error( "invalid value for 'slowlog_ms': " + value );
+    }
+    value = config->lookUp( "slowlog_rate" );
+    if ( !value.empty()
+	 && ( !TiCC::stringTo( value, rate ) || rate <= 0 ) ){
+      throw runtime_error( "invalid value for 'slowlog_rate': " + value );
+    }
+    tokens = rate;
+    log_file.open( file_name, ios::app );
+    if ( !log_file ){
+      throw runtime_error( "unable to open slowlog: " + file_name );
+    }
+    last_fill = chrono::steady_clock::now();
+  }
+
+  void SlowLog::check( const string& protocol,
+		       const string& base,
+		       const string& options,
+		       const string& instance,
+		       const StageTimer& timer ){
+    if ( !is_slow( timer ) ){
+      return;
+    }
+    lock_guard<mutex> lock( mtx );
+    // token bucket: at most 'rate' entries per second, bursts of 'rate'
+    auto now = chrono::steady_clock::now();
+    chrono::duration<double> d = now - last_fill;
+    last_fill = now;
+    tokens = min( rate, tokens + d.count() * rate );
+    if ( tokens < 1 ){
+      ++suppressed;
+      return;
+    }
+    tokens -= 1;
+    json entry;
+    entry["time"] = TiCC::Timer::now();
+    entry["protocol"] = protocol;
+    entry["base"] = base;
+    entry["options"] = options;
+    entry["instance"] = instance.size() > 1024
+      ? instance.substr( 0, 1024 ) + "..."
+      : instance;
+    entry["service_ms"] = timer.service_ms();
+    entry["read_ms"] = timer.ms( StageTimer::Read );
+    entry["parse_ms"] = timer.ms( StageTimer::Parse );
+    entry["queue_ms"] = timer.ms( StageTimer::Queue );
+    entry["classify_ms"] = timer.ms( StageTimer::Classify );
+    entry["write_ms"] = timer.ms( StageTimer::Write );
+    if ( suppressed > 0 ){
+      entry["suppressed"] = suppressed;
+      suppressed = 0;
+    }
+    // instances need not be valid UTF-8
+    log_file << entry.dump( -1, ' ', false, json::error_handler_t::replace )
+	     << endl;
+  }
+
+}
@@ -30,12 +30,14 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <sstream>
 
 #include "ticcutils/CommandLine.h"
 #include "ticcutils/PrettyPrint.h"
 #include "timbl/TimblAPI.h"
 #include "ticcutils/ServerBase.h"
 #include "timblserver/TimblServer.h"
+#include "timblserver/Protocol.h"
 
 using namespace std;
 using namespace Timbl;
@@ -44,86 +46,79 @@ using namespace TimblServer;
 
 using TiCC::operator<<;
 
-#define LOG *TiCC::Log(logstream())
-#define DBG *TiCC::Dbg(logstream())
-
-#define SDBG *TiCC::Dbg(client->myLog)
-
-enum CommandType { UnknownCommand, Classify, Base,
-		   Query, Set, Exit, Comment };
-
-CommandType check_command( const string& com ){
-  CommandType result = UnknownCommand;
-  if ( compare_nocase_n( com, "CLASSIFY" ) )
-    result = Classify;
-  else if ( compare_nocase_n( com, "QUERY" ) )
-    result = Query;
-  else if ( compare_nocase_n( com, "BASE") )
-    result = Base;
-  else if ( compare_nocase_n( com, "SET") )
-    result = Set;
-  else if ( compare_nocase_n( com, "EXIT" ) )
-    result = Exit;
-  else if ( com[0] == '#' )
-    result = Comment;
-  return result;
-}
+#define LOG ASYNC_LOG( async_log, logstream() )
+#define DBG ASYNC_DBG( async_log, logstream() )
+
+#define SDBG ASYNC_DBG( async_log, client->myLog )
 
-inline void Split( const string& line, string& com, string& rest ){
-  vector<string> parts = TiCC::split( line, 2 );
-  if ( parts.size() == 2 ){
-    com = parts[0];
-    rest = parts[1];
+static bool write_answer( TimblExperiment *_exp,
+			  const string& Answer,
+			  const string& Distrib,
+			  double Distance,
+			  ostream *os,
+			  const string& engine ){
+  // the answer line for a classification just done by _exp
+  *os << "CATEGORY {" << Answer << "}";
+  if ( os->good() ){
+    if ( _exp->Verbosity(DISTRIB) ){
+      *os << " DISTRIBUTION " <<Distrib;
+    }
   }
-  else {
-    com = parts[0];
-    rest = "";
+  if ( os->good() ){
+    if ( _exp->Verbosity(DISTANCE) ){
+      *os << " DISTANCE {" << Distance << "}";
+    }
+  }
+  if ( os->good() ){
+    if ( _exp->Verbosity(MATCH_DEPTH) ){
+      *os << " MATCH_DEPTH {" << _exp->matchDepth() << "}";
+    }
+  }
+  if ( os->good() ){
+    if ( _exp->Verbosity(CONFIDENCE) ){
+      *os << " CONFIDENCE {" <<_exp->confidence() << "}";
+    }
+  }
+  if ( os->good() && !engine.empty() ){
+    // the base that really answered, for bases with a fallback
+    *os << " ENGINE {" << engine << "}";
+  }
+  if ( os->good() ){
+    if ( _exp->Verbosity(NEAR_N) ){
+      *os << " NEIGHBORS" << endl;
+      _exp->showBestNeighbors( *os );
+      *os << "ENDNEIGHBORS";
+    }
   }
+  if ( os->good() )
+    *os << endl;
+  return os->good();
 }
 
-
 bool TcpServer::classifyLine( TimblThread *client,
-			      const string& params ) const {
+			      const string& params,
+			      StageTimer *timer,
+			      ostream *out,
+			      const string& engine ) const {
   double Distance;
   string Distrib;
   string Answer;
   TimblExperiment *_exp = client->_exp;
-  ostream *os = &client->os;
-  if ( _exp->Classify( params, Answer, Distrib, Distance ) ){
+  ostream *os = out ? out : &client->os;
+  bool ok;
+  {
+    ProfileTag tag( "tcp", client->base() );
+    PerfScope counted( perf, client->base() );
+    ok = _exp->Classify( params, Answer, Distrib, Distance );
+  }
+  if ( timer ){
+    timer->mark( StageTimer::Classify );
+  }
+  if ( ok ){
     SDBG << _exp->ExpName() << ":" << params << " --> "
 		<< Answer << " " << Distrib
 		<< " " << Distance << endl;
-    *os << "CATEGORY {" << Answer << "}";
-    if ( os->good() ){
-      if ( _exp->Verbosity(DISTRIB) ){
-	*os << " DISTRIBUTION " <<Distrib;
-      }
-    }
-    if ( os->good() ){
-      if ( _exp->Verbosity(DISTANCE) ){
-	*os << " DISTANCE {" << Distance << "}";
-      }
-    }
-    if ( os->good() ){
-      if ( _exp->Verbosity(MATCH_DEPTH) ){
-	*os << " MATCH_DEPTH {" << _exp->matchDepth() << "}";
-      }
-    }
-    if ( os->good() ){
-      if ( _exp->Verbosity(CONFIDENCE) ){
-	*os << " CONFIDENCE {" <<_exp->confidence() << "}";
-      }
-    }
-    if ( os->good() ){
-      if ( _exp->Verbosity(NEAR_N) ){
-	*os << " NEIGHBORS" << endl;
-	_exp->showBestNeighbors( *os );
-	*os << "ENDNEIGHBORS";
-      }
-    }
-    if ( os->good() )
-      *os << endl;
-    return os->good();
+    return write_answer( _exp, Answer, Distrib, Distance, os, engine );
   }
   else {
     SDBG << _exp->ExpName() << ": Classify Failed on '"
@@ -132,17 +127,145 @@ bool TcpServer::classifyLine( TimblThread *client,
   }
 }
 
+bool TcpServer::classifyBatched( const string& base,
+				 const string& options,
+				 const string& params,
+				 ostream& os,
+				 const string& engine ){
+  // classify on a worker of the batcher, and send the answer ourselves
+  bool ok = false;
+  string answer;
+  Batcher::Work work = [&]( TimblExperiment *exp ){
+    double Distance;
+    string Distrib;
+    string Answer;
+    ostringstream out;
+    {
+      ProfileTag tag( "tcp", base );
+      PerfScope counted( perf, base );
+      ok = exp->Classify( params, Answer, Distrib, Distance );
+    }
+    ok = ok && write_answer( exp, Answer, Distrib, Distance,
+			     &out, engine );
+    answer = out.str();
+  };
+  string error;
+  if ( !batcher.run( base, options, work, error ) ){
+    os << "ERROR { " << error << "}" << endl;
+    return false;
+  }
+  os << answer;
+  return ok;
+}
+
+bool TcpServer::decode_instance( const string& base,
+				 string& instance,
+				 string& error ) const {
+  // a coded instance: @version code code ...
+  vector<string> codes = TiCC::split( instance );
+  const Vocabulary *vocab = find_vocabulary( base );
+  if ( !vocab ){
+    error = "no vocabulary for base: " + base;
+  }
+  else if ( codes[0].substr( 1 ) != vocab->version() ){
+    error = "stale vocabulary version: " + codes[0].substr( 1 )
+      + ", current is " + vocab->version();
+  }
+  else {
+    codes.erase( codes.begin() );
+    vocab->decode( codes, instance, error );
+  }
+  return error.empty();
+}
+
+bool TcpServer::classifyTagged( FanOut& clones,
+				const string& base,
+				const string& options,
+				const string& client_class,
+				const string& instance,
+				ostream& os,
+				StageTimer& timer ){
+  // classify the instance of an ASYNC request on a worker of the
+  // multiplexer, with its clones. Every request gets an answer, also
+  // when it fails
+  Fallbacks::Route route = fallbacks.route( base );
+  string engine;
+  if ( fallbacks.has_fallback( base ) ){
+    engine = route.base();
+  }
+  string error;
+  TimblThread *worker = 0;
+  if ( !batcher.enabled() ){
+    worker = clones.client( route.base(), options, error );
+  }
+  Scheduler::Slot slot;
+  if ( error.empty() ){
+    slot = scheduler.acquire( route.base(), client_class );
+  }
+  timer.mark( StageTimer::Queue );
+  if ( !error.empty() ){
+    os << "ERROR { " << error << "}" << endl;
+    return false;
+  }
+  if ( !slot ){
+    os << "ERROR { server busy: base " << route.base()
+       << " is overloaded }" << endl;
+    return false;
+  }
+  ostringstream answer;
+  bool ok;
+  if ( batcher.enabled() ){
+    ok = classifyBatched( route.base(), options, instance, answer, engine );
+    timer.mark( StageTimer::Classify );
+  }
+  else {
+    ok = classifyLine( worker, instance, &timer, &answer, engine );
+  }
+  if ( answer.str().empty() ){
+    os << "ERROR { classification failed }" << endl;
+  }
+  else {
+    os << answer.str();
+  }
+  return ok;
+}
+
 void TcpServer::callback( childArgs *args ){
+  ProfileTag profile_tag( "tcp" );
   string Line;
   int sockId = args->id();
+  AllocConnection alloc_connection( "tcp", sockId, logstream() );
   TimblThread *client = 0;
   int result = 0;
+  int numa_node = affinity.bind_connection();
+  string client_class = scheduler.client_class( sockId );
+  string base_name;
+  FanOut fan_out( this, args, numa_node, client_class );
+  atomic<int> multiplexed_result( 0 );
+  Multiplexer multiplexer( this, args, numa_node, client_class, false,
+			   args->os() );
+  unsigned long capture_id = capture.open( "tcp" );
+  Session session( sessions, sockId, args->is() );
+  string released_options;
+  auto release = [&](){
+    // idle: free our clones until the next request
+    if ( client ){
+      released_options = client->options;
+      delete client;
+      client = 0;
+    }
+    fan_out.release();
+    multiplexer.release();
+    DBG << "TcpServer::idle, clones released" << endl;
+  };
   args->os() << "Welcome to the Timbl server." << endl;
   if ( experiments.size() == 1
        && experiments.find("default") != experiments.end() ){
     DBG << " Voor Create Default Client " << endl;
-    TimblExperiment *exp = experiments["default"];
+    shared_ptr<TimblExperiment> exp = find_experiment( "default", numa_node );
+    affinity.bind_experiment( "default", numa_node );
     client = new TimblThread( exp, args );
+    base_name = "default";
     DBG << " Na Create Client " << endl;
     // report connection to the server terminal
     //
@@ -154,28 +277,57 @@ void TcpServer::callback( childArgs *args ){
     }
     args->os() << endl;
   }
-  if ( getline( args->is(), Line ) ){
+  StageTimer timer;
+  if ( session.wait( release ) && getline( args->is(), Line ) ){
     DBG << "TcpServer::FirstLine='" << Line << "'" << endl;
     string Command, Param;
+    nlohmann::json profile_json;
+    // answers are put together here, and written in one go: the workers
+    // of the multiplexer may write theirs in between, but not halfway
+    ostringstream reply;
+    auto send_reply = [&](){
+      if ( reply.tellp() > 0 ){
+	multiplexer.write( reply.str() );
+	reply.str( "" );
+      }
+    };
     bool go_on = true;
     DBG << "TcpServer::running FromSocket: " << sockId << endl;
 
     do {
+      timer.mark( StageTimer::Read );
+      if ( !client && !base_name.empty() ){
+	// released while idle
+	client = new TimblThread( find_experiment( base_name, numa_node ),
+				  args );
+	if ( !released_options.empty() ){
+	  client->setOptions( released_options );
+	}
+	session.revived();
+      }
       Line = TiCC::trim( Line );
+      capture.record( capture_id, Line );
       DBG << "TcpServer::Line='" << Line << "'" << endl;
-      Split( Line, Command, Param );
+      split_command( Line, Command, Param );
       DBG << "TcpServer::Command='" << Command << "'" << endl;
       DBG << "TcpServer::Param='" << Param << "'" << endl;
-      switch ( check_command(Command) ){
+      CommandType command_type = check_command( Command );
+      if ( command_type == Exit ){
+	multiplexer.drain();
+      }
+      switch ( command_type ){
       case Base:{
 	auto exp_it = experiments.find(Param);
 	if ( exp_it != experiments.end() ){
-	  args->os() << "selected base: '" << Param << "'" << endl;
+	  reply << "selected base: '" << Param << "'" << endl;
 	  if ( client ){
 	    delete client;
 	  }
 	  DBG << "TcpServer::before Create Default Client " << endl;
-	  client = new TimblThread( exp_it->second, args );
+	  affinity.bind_experiment( Param, numa_node );
+	  client = new TimblThread( find_experiment( Param, numa_node ),
+				    args );
+	  base_name = Param;
 	  DBG << " TcpServer::After Create Client " << endl;
 	  // report connection to the server terminal
 	  //
@@ -183,60 +335,260 @@ void TcpServer::callback( childArgs *args ){
 	      << " on Socket " << sockId << " started." << endl;
 	}
 	else {
-	  args->os() << "ERROR { Unknown basename: " << Param << "}" << endl;
+	  reply << "ERROR { Unknown basename: " << Param << "}" << endl;
 	}
       }
 	break;
       case Set:
 	if ( !client ){
-	  args->os() << "you haven't selected a base yet!" << endl;
+	  reply << "you haven't selected a base yet!" << endl;
 	}
 	else if ( client->setOptions( Param ) ){
 	  DBG << "TcpServer::setOptions: " << Param << endl;
-	  args->os() << "OK" << endl;
+	  reply << "OK" << endl;
 	}
 	else {
-	  args->os() << "ERROR { set options failed: " << Param << "}" << endl;
+	  reply << "ERROR { set options failed: " << Param << "}" << endl;
 	}
 	break;
       case Query:
-	if ( !client )
-	  args->os() << "you haven't selected a base yet!" << endl;
+	if ( TiCC::lowercase( Param ) == "stats" ){
+	  reply << "STATUS" << endl
+		     << stats_to_json().dump(2) << endl
+		     << "ENDSTATUS" << endl;
+	}
+	else if ( profile_request( Param, logstream(), profile_json ) ){
+	  reply << "STATUS" << endl
+		     << profile_json.dump(2) << endl
+		     << "ENDSTATUS" << endl;
+	}
+	else if ( TiCC::lowercase( Param ) == "health" ){
+	  reply << "STATUS" << endl
+		     << health_to_json().dump(2) << endl
+		     << "ENDSTATUS" << endl;
+	}
+	else if ( !client )
+	  reply << "you haven't selected a base yet!" << endl;
 	else {
-	  args->os() << "STATUS" << endl;
-	  client->_exp->ShowSettings( args->os() );
-	  args->os() << "ENDSTATUS" << endl;
+	  reply << "STATUS" << endl;
+	  client->_exp->ShowSettings( reply );
+	  reply << "ENDSTATUS" << endl;
 	}
 	break;
       case Exit:
-	args->os() << "OK Closing" << endl;
+	reply << "OK Closing" << endl;
 	go_on = false;
 	break;
+      case Vocab:
+	if ( !client ){
+	  reply << "you haven't selected a base yet!" << endl;
+	}
+	else if ( !find_vocabulary( base_name ) ){
+	  reply << "ERROR { no vocabulary for base: " << base_name
+		     << "}" << endl;
+	}
+	else {
+	  reply << "STATUS" << endl
+		     << find_vocabulary( base_name )->to_json() << endl
+		     << "ENDSTATUS" << endl;
+	}
+	break;
       case Classify:
 	if ( !client ){
-	  args->os() << "you haven't selected a base yet!" << endl;
+	  reply << "you haven't selected a base yet!" << endl;
 	}
 	else {
-	  if ( classifyLine( client, Param ) ){
+	  refresh( client, base_name );
+	  if ( !Param.empty() && Param[0] == '@' ){
+	    string error;
+	    if ( !decode_instance( base_name, Param, error ) ){
+	      reply << "ERROR { " << error << "}" << endl;
+	      break;
+	    }
+	  }
+	  timer.mark( StageTimer::Parse );
+	  Fallbacks::Route route = fallbacks.route( base_name );
+	  TimblThread *worker = client;
+	  string error;
+	  if ( route.fallback() && !batcher.enabled() ){
+	    worker = fan_out.client( route.base(), client->options, error );
+	  }
+	  string engine;
+	  if ( fallbacks.has_fallback( base_name ) ){
+	    engine = route.base();
+	  }
+	  Scheduler::Slot slot = scheduler.acquire( route.base(),
+						    client_class );
+	  timer.mark( StageTimer::Queue );
+	  if ( !worker ){
+	    reply << "ERROR { " << error << "}" << endl;
+	  }
+	  else if ( !slot ){
+	    reply << "ERROR { server busy: base " << route.base()
+		       << " is overloaded }" << endl;
+	  }
+	  else if ( batcher.enabled() ){
+	    if ( classifyBatched( route.base(), client->options, Param,
+				  reply, engine ) ){
+	      result++;
+	    }
+	    timer.mark( StageTimer::Classify );
+	  }
+	  else if ( classifyLine( worker, Param, &timer, &reply, engine ) ){
 	    result++;
 	  }
+	  send_reply();
+	  timer.mark( StageTimer::Write );
+	  slowlog.check( "tcp", base_name, client->options, Param, timer );
+	  AllocTracker::record( "tcp", base_name, timer );
 	  go_on = true; // HACK?
 	}
 	break;
+      case Multi:{
+	// FANOUT base1,base2,... instance
+	string bases_string, instance;
+	split_command( Param, bases_string, instance );
+	vector<string> bases;
+	string error;
+	if ( instance.empty() ){
+	  reply << "ERROR { FANOUT needs a list of bases and an instance }"
+		     << endl;
+	  break;
+	}
+	if ( !fan_out.parse_bases( bases_string, bases, error ) ){
+	  reply << "ERROR { " << error << "}" << endl;
+	  break;
+	}
+	timer.mark( StageTimer::Parse );
+	vector<string> answers( bases.size() );
+	vector<int> ok( bases.size(), 0 );
+	vector<string> errors
+	  = fan_out.run( bases,
+			 client ? client->options : "",
+			 [&]( size_t i, TimblThread *worker ){
+			   ostringstream os;
+			   ok[i] = classifyLine( worker, instance, 0, &os );
+			   answers[i] = os.str();
+			 } );
+	timer.mark( StageTimer::Classify );
+	reply << "RESULTS" << endl;
+	for ( size_t i=0; i < bases.size(); ++i ){
+	  reply << bases[i] << " ";
+	  if ( !errors[i].empty() ){
+	    reply << "ERROR { " << errors[i] << "}" << endl;
+	  }
+	  else if ( !ok[i] ){
+	    reply << "ERROR { classification failed }" << endl;
+	  }
+	  else {
+	    ++result;
+	    reply << answers[i];
+	  }
+	}
+	reply << "ENDRESULTS" << endl;
+	send_reply();
+	timer.mark( StageTimer::Write );
+	slowlog.check( "tcp", bases_string, client ? client->options : "",
+		       instance, timer );
+	AllocTracker::record( "tcp", bases_string, timer );
+      }
+	break;
+      case Async:{
+	// ASYNC id[:base] instance: classified on a worker of the
+	// multiplexer, answered with 'ANSWER id ...' as soon as it is ready
+	string tag, instance;
+	split_command( Param, tag, instance );
+	string id = tag;
+	string request_base = base_name;
+	string::size_type pos = tag.find( ':' );
+	if ( pos != string::npos ){
+	  id = tag.substr( 0, pos );
+	  request_base = tag.substr( pos+1 );
+	}
+	string error;
+	if ( id.empty() || instance.empty() ){
+	  error = "ASYNC needs an id and an instance";
+	}
+	else if ( request_base.empty() ){
+	  error = "you haven't selected a base yet!";
+	}
+	else if ( experiments.find( request_base ) == experiments.end() ){
+	  error = "Unknown basename: " + request_base;
+	}
+	else if ( instance[0] == '@' ){
+	  decode_instance( request_base, instance, error );
+	}
+	if ( !error.empty() ){
+	  multiplexer.write( "ANSWER " + id + " ERROR { " + error + "}\n" );
+	  break;
+	}
+	string options = client ? client->options : "";
+	multiplexer.submit( [this,id,request_base,options,instance,
+			     client_class,&multiplexer,
+			     &multiplexed_result]( FanOut& clones ){
+	    StageTimer job_timer;
+	    ostringstream answer;
+	    answer << "ANSWER " << id << " ";
+	    try {
+	      if ( classifyTagged( clones, request_base, options,
+				   client_class, instance, answer,
+				   job_timer ) ){
+		++multiplexed_result;
+	      }
+	    }
+	    catch ( const exception& e ){
+	      // the client waits for an answer with this id
+	      answer.str( "" );
+	      answer << "ANSWER " << id << " ERROR { " << e.what() << "}"
+		     << endl;
+	    }
+	    multiplexer.write( answer.str() );
+	    job_timer.mark( StageTimer::Write );
+	    slowlog.check( "tcp", request_base, options, instance, job_timer );
+	    AllocTracker::record( "tcp", request_base, job_timer );
+	  } );
+      }
+	break;
+      case Learn:{
+	// LEARN instance: add a labelled instance to the selected base
+	string error;
+	if ( !client ){
+	  reply << "you haven't selected a base yet!" << endl;
+	}
+	else if ( learner.add( base_name, Param, error ) ){
+	  reply << "OK queued" << endl;
+	}
+	else {
+	  reply << "ERROR { " << error << "}" << endl;
+	}
+      }
+	break;
       case Comment:
-	args->os() << "SKIP '" << Line << "'" << endl;
+	reply << "SKIP '" << Line << "'" << endl;
 	break;
       default:
 	DBG << sockId << "TcpServer::Don't understand '"
 		    << Line << "'" << endl;
-	args->os() << "ERROR { Illegal instruction:'" << Command
+	reply << "ERROR { Illegal instruction:'" << Command
 		   << "' in line:" << Line << "}" << endl;
 	break;
       }
+      send_reply();
+      timer.reset();
     }
-    while ( go_on && getline( args->is(), Line ) );
+    while ( go_on && session.wait( release ) && getline( args->is(), Line ) );
+  }
+  multiplexer.drain();
+  result += multiplexed_result;
+  if ( session.limit_reached() ){
+    args->os() << "CLOSING { " << session.reason() << " limit reached }"
+	       << endl;
+    LOG << sockId << " connection closed, " << session.reason()
+	<< " limit reached" << endl;
   }
   delete client;
+  capture.close( capture_id );
+  affinity.count( numa_node, result );
   LOG << "Thread " << (uintptr_t)pthread_self()
 	      << " terminated, " << result
 	      << " instances processed " << endl;
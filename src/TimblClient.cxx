@@ -35,6 +35,8 @@
 #include <cctype>
 #include <ctime>
 #include <map>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -52,6 +54,8 @@ inline void usage(){
        << "For demonstration purposes only!" << endl
        << "Usage:" << endl
        << "timblclient -n NodeName -p PortNumber [-i InputFile ][-o OutputFile] [--batch] [-b basename]"
+       << endl
+       << "timblclient -u SocketPath [-i InputFile ][-o OutputFile] [--batch] [-b basename]"
        << endl;
 }
 
@@ -66,7 +70,8 @@ int main(int argc, char *argv[] ){
   string base;
   string node;
   string port;
-  TiCC::CL_Options opts( "i:o:p:n:b:", "batch" );
+  string socket_path;
+  TiCC::CL_Options opts( "i:o:p:n:b:u:", "batch" );
   try {
     opts.init( argc, argv );
   }
@@ -76,25 +81,44 @@ int main(int argc, char *argv[] ){
     exit(EXIT_FAILURE);
   }
   string value;
+  if ( opts.extract( "batch" ) ){
+    c_mode = true;
+  }
+  // batch mode reads and writes the files itself, in large blocks
+  TimblServer::LineSource batch_input;
+  int batch_output = 1;
   if ( opts.extract( "i", value ) ){
-    if ( (input_file.open( value, ios::in ), !input_file.good() ) ){
+    if ( c_mode ){
+      if ( !batch_input.open( value ) ){
+	cerr << argv[0] << " - couldn't open inputfile " << value << endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+    else if ( (input_file.open( value, ios::in ), !input_file.good() ) ){
       cerr << argv[0] << " - couldn't open inputfile " << value << endl;
       exit(EXIT_FAILURE);
     }
     cout << "reading input from: " << value << endl;
     Input = &input_file;
   }
+  else if ( c_mode ){
+    batch_input.open( 0 );
+  }
   if ( opts.extract( "o", value ) ){
-    if ( (output_file.open( value, ios::out ), !output_file.good() ) ){
+    if ( c_mode ){
+      batch_output = open( value.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666 );
+      if ( batch_output < 0 ){
+	cerr << argv[0] << " - couldn't open outputfile " << value << endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+    else if ( (output_file.open( value, ios::out ), !output_file.good() ) ){
       cerr << argv[0] << " - couldn't open outputfile " << value << endl;
       exit(EXIT_FAILURE);
     }
     cout << "writing output to: " << value << endl;
     Output = &output_file;
   }
-  if ( opts.extract( "batch" ) ){
-    c_mode = true;
-  }
   if ( opts.extract( "p", value ) ){
     port = value;
   }
@@ -104,9 +128,20 @@ int main(int argc, char *argv[] ){
   if ( opts.extract( "b", value ) ){
     base = value;
   }
-  if ( !node.empty() && !port.empty() ){
+  if ( opts.extract( "u", value ) ){
+    socket_path = value;
+  }
+  if ( !socket_path.empty()
+       || ( !node.empty() && !port.empty() ) ){
     TimblServer::ClientClass client;
-    if ( !client.connect( node, port ) ){
+    bool connected;
+    if ( socket_path.empty() ){
+      connected = client.connect( node, port );
+    }
+    else {
+      connected = client.connect( socket_path );
+    }
+    if ( !connected ){
       cerr << "connection failed " << endl;
       exit(EXIT_FAILURE);
     }
@@ -117,7 +152,14 @@ int main(int argc, char *argv[] ){
       }
     }
     if ( c_mode ){
-      if ( !client.classifyFile( *Input, *Output ) ){
+      cout.flush();
+      TimblServer::AsyncWriter writer( batch_output );
+      bool ok = client.classifyFile( batch_input, writer );
+      if ( !writer.close() ){
+	cerr << writer.getMessage() << endl;
+	ok = false;
+      }
+      if ( !ok ){
 	cerr << "classification failed." << endl;
 	exit(EXIT_FAILURE);
       }
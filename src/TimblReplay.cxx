@@ -0,0 +1,660 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/json.hpp"
+#include "timblserver/UnixSocket.h"
+
+using namespace std;
+using nlohmann::json;
+using TimblServer::UnixClientSocket;
+
+struct Event {
+  long long usec;
+  char type;
+  string data;
+};
+
+struct Connection {
+  string protocol;
+  vector<Event> events;
+};
+
+struct Result {
+  unsigned long conn;
+  size_t seq;
+  long long latency;
+  string response;
+};
+
+string host;
+string port;
+string socket_path;
+double speed = 1.0;
+
+inline void usage(){
+  cerr << "timblreplay V0.1" << endl
+       << "Usage:" << endl
+       << "timblreplay -n NodeName -p PortNumber [options] capturefile" << endl
+       << "timblreplay -u SocketPath [options] capturefile" << endl
+       << "options:" << endl
+       << "  -s N        replay N times faster (default 1, 0: no delays)"
+       << endl
+       << "  -o file     write responses and latencies to 'file'" << endl
+       << "  -c file     compare with the results of an earlier run" << endl;
+}
+
+bool read_capture( const string& file_name,
+		   map<unsigned long,Connection>& connections ){
+  ifstream is( file_name );
+  if ( !is ){
+    cerr << "unable to open capture file: " << file_name << endl;
+    return false;
+  }
+  string line;
+  size_t line_no = 0;
+  while ( getline( is, line ) ){
+    ++line_no;
+    // usec TAB id TAB type [TAB data], the data may contain TABs itself
+    vector<string::size_type> tabs;
+    string::size_type pos = 0;
+    while ( tabs.size() < 3
+	    && ( pos = line.find( '\t', pos ) ) != string::npos ){
+      tabs.push_back( pos++ );
+    }
+    Event ev;
+    unsigned long id = 0;
+    if ( tabs.size() < 2
+	 || !TiCC::stringTo( line.substr( 0, tabs[0] ), ev.usec )
+	 || !TiCC::stringTo( line.substr( tabs[0]+1, tabs[1]-tabs[0]-1 ), id )
+	 || line.size() < tabs[1]+2 ){
+      cerr << file_name << ":" << line_no << ": invalid record" << endl;
+      return false;
+    }
+    ev.type = line[tabs[1]+1];
+    if ( tabs.size() == 3 ){
+      ev.data = line.substr( tabs[2]+1 );
+    }
+    Connection& conn = connections[id];
+    if ( ev.type == 'O' ){
+      conn.protocol = ev.data;
+    }
+    conn.events.push_back( ev );
+  }
+  for ( auto& it : connections ){
+    // the server stamps a record before it gets the lock on the file, so
+    // within a connection the order in the file is the order of events,
+    // but an earlier stamp may follow a later one
+    auto& events = it.second.events;
+    for ( size_t i=1; i < events.size(); ++i ){
+      events[i].usec = max( events[i].usec, events[i-1].usec );
+    }
+  }
+  return true;
+}
+
+string escape( const string& s ){
+  string result;
+  for ( const auto& c : s ){
+    switch ( c ){
+    case '\\':
+      result += "\\\\";
+      break;
+    case '\n':
+      result += "\\n";
+      break;
+    case '\t':
+      result += "\\t";
+      break;
+    default:
+      result += c;
+    }
+  }
+  return result;
+}
+
+bool connect( UnixClientSocket& sock ){
+  if ( !socket_path.empty() ){
+    return sock.connect_path( socket_path );
+  }
+  return sock.connect( host, port );
+}
+
+bool greet( UnixClientSocket& sock, const string& protocol ){
+  // the tcp and json servers say hello first. For tcp an 'available
+  // bases' line may follow, it is skipped when reading the first response
+  if ( protocol == "http" ){
+    return true;
+  }
+  string line;
+  return sock.read( line );
+}
+
+string request_id( const string& protocol, const string& request ){
+  // the id of a request which is answered out of order, if any:
+  // 'ASYNC id[:base] instance' for tcp, a classify with an "id" for json
+  if ( protocol == "tcp" ){
+    if ( request.compare( 0, 6, "ASYNC " ) != 0 ){
+      return "";
+    }
+    string tag = TiCC::trim( request.substr( 6 ) );
+    return tag.substr( 0, tag.find_first_of( ": \t" ) );
+  }
+  if ( protocol == "json" ){
+    json request_json = json::parse( request, nullptr, false );
+    if ( request_json.is_object()
+	 && request_json.find("id") != request_json.end()
+	 && request_json.value( "command", "" ) == "classify" ){
+      return request_json["id"].dump();
+    }
+  }
+  return "";
+}
+
+string reply_id( const string& protocol, const string& line ){
+  // the id of a reply to such a request: 'ANSWER id ...' for tcp, an
+  // object with an "id" for json
+  if ( protocol == "tcp" ){
+    if ( line.compare( 0, 7, "ANSWER " ) != 0 ){
+      return "";
+    }
+    string::size_type pos = line.find( ' ', 7 );
+    return line.substr( 7, pos == string::npos ? pos : pos-7 );
+  }
+  if ( !line.empty() && line[0] == '{' ){
+    json reply_json = json::parse( line, nullptr, false );
+    if ( reply_json.is_object()
+	 && reply_json.find("id") != reply_json.end() ){
+      return reply_json["id"].dump();
+    }
+  }
+  return "";
+}
+
+bool is_closing( const string& protocol, const string& line ){
+  // the server says goodbye when a session limit is reached. That is no
+  // answer to a request
+  if ( protocol == "tcp" ){
+    return line.compare( 0, 9, "CLOSING {" ) == 0;
+  }
+  if ( line.find( "\"reason\"" ) == string::npos ){
+    return false;
+  }
+  json reply_json = json::parse( line, nullptr, false );
+  return reply_json.is_object()
+    && reply_json.find("reason") != reply_json.end()
+    && reply_json.value( "status", "" ) == "closed";
+}
+
+bool read_block( UnixClientSocket& sock,
+		 const string& line,
+		 string& response ){
+  // a tcp answer which continues on the next lines
+  response = line;
+  string end_tag;
+  if ( line.find( "STATUS" ) == 0 ){
+    end_tag = "ENDSTATUS";
+  }
+  else if ( line.find( "RESULTS" ) == 0 ){
+    // FANOUT: an answer per base, neighbors included
+    end_tag = "ENDRESULTS";
+  }
+  else if ( line.size() >= 9
+	    && line.compare( line.size()-9, 9, "NEIGHBORS" ) == 0
+	    && ( line.find( "CATEGORY" ) == 0
+		 || line.find( "ANSWER" ) == 0 ) ){
+    end_tag = "ENDNEIGHBORS";
+  }
+  string next;
+  while ( !end_tag.empty() ){
+    if ( !sock.read( next ) ){
+      return false;
+    }
+    response += "\n" + next;
+    if ( next.find( end_tag ) == 0 ){
+      end_tag.clear();
+    }
+  }
+  return true;
+}
+
+class Tagged {
+  // the requests with an id which still wait for their answer. The server
+  // sends those answers as soon as they are ready, so they may arrive
+  // before, after, or in between the answers to other requests
+public:
+  explicit Tagged( vector<Result>& r ): results( r ) {};
+  void sent( const string& id, size_t index ){
+    pending[id] = { index, chrono::steady_clock::now() };
+  };
+  bool waiting() const { return !pending.empty(); };
+  bool take( UnixClientSocket&, const string&, const string&, bool& );
+  void fail( const string& );
+private:
+  struct Pending {
+    size_t index;
+    chrono::steady_clock::time_point sent;
+  };
+  vector<Result>& results;
+  map<string,Pending> pending;
+};
+
+bool Tagged::take( UnixClientSocket& sock,
+		   const string& protocol,
+		   const string& line,
+		   bool& ok ){
+  // true when 'line' answers one of the pending requests. 'ok' is false
+  // when the connection was lost while reading the rest of it
+  ok = true;
+  if ( pending.empty() ){
+    return false;
+  }
+  auto it = pending.find( reply_id( protocol, line ) );
+  if ( it == pending.end() ){
+    return false;
+  }
+  Result& res = results[it->second.index];
+  if ( protocol == "tcp" ){
+    ok = read_block( sock, line, res.response );
+  }
+  else {
+    res.response = line;
+  }
+  if ( ok ){
+    auto t1 = chrono::steady_clock::now();
+    res.latency
+      = chrono::duration_cast<chrono::microseconds>( t1
+						     - it->second.sent ).count();
+    pending.erase( it );
+  }
+  return true;
+}
+
+void Tagged::fail( const string& message ){
+  for ( const auto& it : pending ){
+    results[it.second.index].response = message;
+  }
+  pending.clear();
+}
+
+bool read_line( UnixClientSocket& sock,
+		const string& protocol,
+		Tagged& tagged,
+		string& line ){
+  // the next line which is not an answer to a request with an id
+  while ( sock.read( line ) ){
+    bool ok;
+    if ( tagged.take( sock, protocol, line, ok ) ){
+      if ( !ok ){
+	return false;
+      }
+    }
+    else if ( !is_closing( protocol, line ) ){
+      return true;
+    }
+  }
+  return false;
+}
+
+bool read_response( UnixClientSocket& sock,
+		    const string& protocol,
+		    bool& first,
+		    Tagged& tagged,
+		    string& response ){
+  response.clear();
+  string line;
+  if ( protocol == "http" ){
+    // the server closes the connection after the answer
+    bool got_one = false;
+    while ( sock.read( line ) ){
+      response += line + "\n";
+      got_one = true;
+    }
+    return got_one;
+  }
+  if ( !read_line( sock, protocol, tagged, line ) ){
+    return false;
+  }
+  if ( protocol == "tcp" ){
+    if ( first && line.find( "available bases:" ) == 0 ){
+      if ( !read_line( sock, protocol, tagged, line ) ){
+	return false;
+      }
+    }
+    if ( !read_block( sock, line, response ) ){
+      return false;
+    }
+  }
+  else {
+    response = line;
+  }
+  first = false;
+  return true;
+}
+
+void wait_tagged( UnixClientSocket& sock,
+		  const string& protocol,
+		  Tagged& tagged ){
+  // collect the answers still underway, before the connection is closed
+  string line;
+  while ( tagged.waiting() && sock.read( line ) ){
+    if ( protocol == "tcp" && line.find( "available bases:" ) == 0 ){
+      continue;
+    }
+    bool ok;
+    if ( tagged.take( sock, protocol, line, ok ) && !ok ){
+      break;
+    }
+  }
+  tagged.fail( "!ERROR: connection lost " + sock.getMessage() );
+}
+
+void replay( unsigned long id,
+	     const Connection& conn,
+	     chrono::steady_clock::time_point start,
+	     vector<Result>& results ){
+  UnixClientSocket sock;
+  bool connected = false;
+  bool failed = false;
+  bool first = true;
+  size_t seq = 0;
+  Tagged tagged( results );
+  for ( const auto& ev : conn.events ){
+    if ( speed > 0 ){
+      auto due = start + chrono::microseconds( (long long)(ev.usec / speed) );
+      this_thread::sleep_until( due );
+    }
+    if ( ev.type == 'O' ){
+      connected = connect( sock ) && greet( sock, conn.protocol );
+      failed = !connected;
+    }
+    else if ( ev.type == 'R' ){
+      Result res;
+      res.conn = id;
+      res.seq = seq++;
+      res.latency = -1;
+      if ( failed ){
+	res.response = "!ERROR: " + sock.getMessage();
+	results.push_back( res );
+	continue;
+      }
+      string request = ev.data;
+      if ( conn.protocol == "http" ){
+	request += "\r\n\r\n";
+      }
+      else {
+	request += "\n";
+      }
+      string id = request_id( conn.protocol, ev.data );
+      if ( !id.empty() ){
+	// don't wait: the client didn't either
+	if ( sock.write( request ) ){
+	  tagged.sent( id, results.size() );
+	}
+	else {
+	  res.response = "!ERROR: connection lost " + sock.getMessage();
+	  failed = true;
+	}
+	results.push_back( res );
+	continue;
+      }
+      auto t0 = chrono::steady_clock::now();
+      if ( sock.write( request )
+	   && read_response( sock, conn.protocol, first, tagged,
+			     res.response ) ){
+	auto t1 = chrono::steady_clock::now();
+	res.latency
+	  = chrono::duration_cast<chrono::microseconds>( t1 - t0 ).count();
+      }
+      else {
+	res.response = "!ERROR: connection lost " + sock.getMessage();
+	failed = true;
+      }
+      results.push_back( res );
+    }
+    else if ( ev.type == 'C' ){
+      break;
+    }
+  }
+  if ( connected ){
+    wait_tagged( sock, conn.protocol, tagged );
+  }
+}
+
+struct Baseline {
+  long long latency;
+  string response;
+};
+
+bool read_results( const string& file_name,
+		   map<pair<unsigned long,size_t>,Baseline>& baseline ){
+  ifstream is( file_name );
+  if ( !is ){
+    cerr << "unable to open results file: " << file_name << endl;
+    return false;
+  }
+  string line;
+  while ( getline( is, line ) ){
+    // conn TAB seq TAB latency TAB response
+    string::size_type t1 = line.find( '\t' );
+    string::size_type t2 = line.find( '\t', t1+1 );
+    string::size_type t3 = line.find( '\t', t2+1 );
+    unsigned long conn;
+    size_t seq;
+    Baseline b;
+    if ( t1 == string::npos || t2 == string::npos || t3 == string::npos
+	 || !TiCC::stringTo( line.substr( 0, t1 ), conn )
+	 || !TiCC::stringTo( line.substr( t1+1, t2-t1-1 ), seq )
+	 || !TiCC::stringTo( line.substr( t2+1, t3-t2-1 ), b.latency ) ){
+      cerr << "invalid line in " << file_name << ": " << line << endl;
+      return false;
+    }
+    b.response = line.substr( t3+1 );
+    baseline[make_pair(conn,seq)] = b;
+  }
+  return true;
+}
+
+void show_latencies( const string& label, vector<long long> lat ){
+  if ( lat.empty() ){
+    cout << label << ": no successful requests" << endl;
+    return;
+  }
+  sort( lat.begin(), lat.end() );
+  auto pct = [&]( double p ){
+    return lat[ min( lat.size()-1, size_t( p * lat.size() ) ) ] / 1000.0;
+  };
+  double mean = accumulate( lat.begin(), lat.end(), 0.0 ) / lat.size();
+  cout << fixed << setprecision(3)
+       << label << " latency (ms): mean=" << mean / 1000.0
+       << " p50=" << pct(0.5) << " p90=" << pct(0.9)
+       << " p99=" << pct(0.99) << " max=" << lat.back() / 1000.0 << endl;
+}
+
+int main( int argc, char *argv[] ){
+  TiCC::CL_Options opts( "n:p:u:s:o:c:h", "" );
+  try {
+    opts.init( argc, argv );
+  }
+  catch( TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'h' ) ){
+    usage();
+    exit(EXIT_SUCCESS);
+  }
+  string value;
+  opts.extract( 'n', host );
+  opts.extract( 'p', port );
+  opts.extract( 'u', socket_path );
+  if ( opts.extract( 's', value )
+       && ( !TiCC::stringTo( value, speed ) || speed < 0 ) ){
+    cerr << "invalid value for -s: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  string out_name;
+  opts.extract( 'o', out_name );
+  string compare_name;
+  opts.extract( 'c', compare_name );
+  vector<string> files = opts.getMassOpts();
+  if ( files.size() != 1
+       || ( socket_path.empty() && ( host.empty() || port.empty() ) ) ){
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  map<unsigned long,Connection> connections;
+  if ( !read_capture( files[0], connections ) ){
+    exit(EXIT_FAILURE);
+  }
+  map<pair<unsigned long,size_t>,Baseline> baseline;
+  if ( !compare_name.empty() && !read_results( compare_name, baseline ) ){
+    exit(EXIT_FAILURE);
+  }
+  // start the clock at the first event, not at the start of the server
+  long long first_usec = -1;
+  for ( const auto& it : connections ){
+    if ( !it.second.events.empty()
+	 && ( first_usec < 0 || it.second.events[0].usec < first_usec ) ){
+      first_usec = it.second.events[0].usec;
+    }
+  }
+  for ( auto& it : connections ){
+    for ( auto& ev : it.second.events ){
+      ev.usec -= first_usec;
+    }
+  }
+  // one thread per captured connection, as in the server
+  vector<vector<Result>> results( connections.size() );
+  vector<thread> threads;
+  auto start = chrono::steady_clock::now();
+  size_t i = 0;
+  for ( const auto& it : connections ){
+    threads.push_back( thread( replay, it.first, cref(it.second),
+			       start, ref(results[i++]) ) );
+  }
+  for ( auto& t : threads ){
+    t.join();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  ofstream out_file;
+  if ( !out_name.empty() ){
+    out_file.open( out_name );
+    if ( !out_file ){
+      cerr << "unable to open results file: " << out_name << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  size_t requests = 0;
+  size_t errors = 0;
+  size_t equal = 0;
+  size_t different = 0;
+  size_t missing = 0;
+  vector<long long> latencies;
+  vector<long long> base_latencies;
+  vector<long long> deltas;
+  for ( const auto& conn_results : results ){
+    for ( const auto& res : conn_results ){
+      ++requests;
+      string response = escape( res.response );
+      if ( res.latency < 0 ){
+	++errors;
+      }
+      else {
+	latencies.push_back( res.latency );
+      }
+      if ( out_file.is_open() ){
+	out_file << res.conn << "\t" << res.seq << "\t" << res.latency
+		 << "\t" << response << "\n";
+      }
+      if ( compare_name.empty() ){
+	continue;
+      }
+      auto it = baseline.find( make_pair( res.conn, res.seq ) );
+      if ( it == baseline.end() ){
+	++missing;
+	continue;
+      }
+      if ( it->second.response == response ){
+	++equal;
+      }
+      else {
+	if ( different < 10 ){
+	  cout << "connection " << res.conn << " request " << res.seq
+	       << " differs:" << endl
+	       << "  was: " << it->second.response << endl
+	       << "  now: " << response << endl;
+	}
+	++different;
+      }
+      if ( res.latency >= 0 && it->second.latency >= 0 ){
+	base_latencies.push_back( it->second.latency );
+	deltas.push_back( res.latency - it->second.latency );
+      }
+    }
+  }
+  cout << "replayed " << requests << " requests on " << connections.size()
+       << " connections in " << elapsed.count() << " seconds, "
+       << errors << " failed" << endl;
+  show_latencies( "this run", latencies );
+  if ( !compare_name.empty() ){
+    cout << "compared with " << compare_name << ": " << equal
+	 << " responses equal, " << different << " different, "
+	 << missing << " not in " << compare_name << endl;
+    show_latencies( "earlier run", base_latencies );
+    if ( !deltas.empty() ){
+      // per request differences: positive means this run is slower
+      sort( deltas.begin(), deltas.end() );
+      double mean = accumulate( deltas.begin(), deltas.end(), 0.0 )
+	/ deltas.size();
+      cout << fixed << setprecision(3)
+	   << "difference (ms, this run - earlier run): mean="
+	   << mean / 1000.0
+	   << " median=" << deltas[deltas.size()/2] / 1000.0 << endl;
+    }
+    if ( different > 0 ){
+      exit(EXIT_FAILURE);
+    }
+  }
+  exit(EXIT_SUCCESS);
+}
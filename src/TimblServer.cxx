@@ -29,6 +29,11 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
 
 #include "ticcutils/CommandLine.h"
 #include "ticcutils/PrettyPrint.h"
@@ -36,6 +41,8 @@
 #include "timbl/TimblAPI.h"
 #include "ticcutils/ServerBase.h"
 #include "timblserver/TimblServer.h"
+#include "timblserver/UnixSocket.h"
+#include "timblserver/Experiments.h"
 #include "config.h"
 
 using namespace std;
@@ -55,6 +62,15 @@ inline void usage_full(void){
   cerr << "for an overwiew of all TiMBLoptions, use 'timbl -h'" << endl;
   cerr << endl;
   ServerBase::server_usage();
+  cerr << "\t--unixsocket=<path> listen on a Unix domain socket too. When no"
+       << endl
+       << "\t\tport is given, ONLY on that socket." << endl;
+  cerr << "\t--shmsocket=<path> accept shared memory sessions, set up over a"
+       << endl
+       << "\t\tUnix domain socket at 'path' (protocol=json only)." << endl;
+  cerr << "\t--cachedir=<dir> store learned instance bases in 'dir' and reuse"
+       << endl
+       << "\t\tthem on the next start." << endl;
 }
 
 inline void usage(void){
@@ -71,31 +87,10 @@ inline void usage(void){
 void startExperiments( ServerBase *server ){
   map<string,TimblExperiment*> *experiments
     = static_cast<map<string, TimblExperiment*> *>(server->callback_data());
+  ServerCommon *common = dynamic_cast<ServerCommon*>( server );
   TiCC::LogStream &s_log = server->logstream();
-  map<string,string> allvals;
-  if ( server->config()->hasSection("experiments") )
-    allvals = server->config()->lookUpAll("experiments");
-  else {
-    allvals = server->config()->lookUpAll("global");
-    // old style, everything is global
-    // remove all already processed stuff
-    auto it = allvals.begin();
-    while ( it != allvals.end() ){
-      if ( it->first == "port" ||
-	   it->first == "protocol" ||
-	   it->first == "logfile" ||
-	   it->first == "debug" ||
-	   it->first == "pidfile" ||
-	   it->first == "daemonize" ||
-	   it->first == "configDir" ||
-	   it->first == "maxconn" ){
-	allvals.erase(it++);
-      }
-      else {
-	++it;
-      }
-    }
-  }
+  string cache_dir = cache_directory( server->config(), s_log );
+  map<string,string> allvals = experiment_definitions( server->config() );
   if ( allvals.empty() ){
     string mess = "TimblServer: Unable to initalize at least one experiment\n";
     mess += "please check your commandline or configuration file";
@@ -103,104 +98,44 @@ void startExperiments( ServerBase *server ){
   }
 
   for ( const auto& it : allvals ){
-    string exp_name = it.first;
-    TiCC::CL_Options opts;
-    opts.add_short_options( timbl_short_opts );
-    opts.add_short_options( serv_short_opts );
-    opts.add_long_options( timbl_long_opts );
-    opts.add_long_options( serv_long_opts );
-    opts.init( it.second );
-    string treeName;
-    string trainName;
-    string MatrixInFile = "";
-    string WgtInFile = "";
-    Weighting WgtType = GR;
-    Algorithm algorithm = IB1;
-    string ProbInFile = "";
-    string value;
-    if ( opts.is_present( 'a', value ) ){
-      // the user gave an algorithm
-      if ( !string_to( value, algorithm ) ){
-	string mess = exp_name + ":start(): illegal -a value: " + value;
-	throw runtime_error( mess );
-      }
-    }
-    if ( !opts.extract( 'f', trainName ) ){
-      opts.extract( 'i', treeName );
-    }
-    if ( opts.extract( 'u', ProbInFile ) ){
-      if ( algorithm == IGTREE ){
-	string mess = exp_name + ":start(): -u option is useless for IGtree";
-	throw runtime_error( mess );
-      }
-    }
-    if ( opts.extract( 'w', value ) ){
-      Weighting W;
-      if ( !string_to( value, W ) ){
-	// No valid weighting, so assume it also has a filename
-	vector<string> parts = TiCC::split_at( value, ":" );
-	size_t num = parts.size();
-	if ( num == 2 ){
-	  if ( !string_to( parts[1], W ) ){
-	    string mess = exp_name + ":start(): invalid weighting option:"
-	      + value;
-	    throw runtime_error( mess );
-	  }
-	  WgtInFile = parts[0];
-	  WgtType = W;
+    const string& exp_name = it.first;
+    if ( common && common->affinity.replicate() ){
+      // load a copy on every NUMA node, each one by a thread bound to
+      // that node, so its memory is allocated locally
+      size_t nodes = common->affinity.nodes();
+      vector<TimblExperiment*> copies( nodes, 0 );
+      for ( size_t node = 0; node < nodes; ++node ){
+	exception_ptr failure;
+	thread loader( [&,node](){
+	    try {
+	      common->affinity.bind_to_node( node );
+	      copies[node] = create_experiment( exp_name, it.second, s_log,
+						cache_dir );
+	    }
+	    catch ( ... ){
+	      failure = current_exception();
+	    }
+	  } );
+	loader.join();
+	if ( failure ){
+	  rethrow_exception( failure );
 	}
-	else if ( num == 1 ){
-	  WgtInFile = value;
-	}
-	else {
-	  string mess = exp_name + ":start(): invalid weighting option:"
-	    + value;
-	  throw runtime_error( mess );
+	if ( copies[0] == 0 ){
+	  // no use to try the other nodes
+	  break;
 	}
+	s_log << "loaded " << exp_name << " on NUMA node " << node << endl;
+      }
+      if ( copies[0] ){
+	(*experiments)[exp_name] = copies[0];
+	common->replicas[exp_name] = copies;
       }
-    }
-    opts.extract( "matrixin", MatrixInFile );
-    if ( treeName.empty()
-	 && trainName.empty() ) {
-      // we need to learn from trainName
-      // OR read a tree from treeName
-      s_log << "missing '-i' or '-f' option in serverconfig entry: '"
-	    << exp_name << "=" << it.second << "'" << endl;
     }
     else {
-      // let's start
-      TimblAPI *run = new TimblAPI( opts, exp_name );
-      bool result = false;
-      if ( run && run->Valid() ){
-	if ( treeName.empty() ){
-	  s_log << "trainName = " << trainName << endl;
-	  result = run->Learn( trainName );
-	}
-	else {
-	  s_log << "treeName = " << treeName << endl;
-	  result = run->GetInstanceBase( treeName );
-	}
-	if ( result && WgtInFile != "" ) {
-	  result = run->GetWeights( WgtInFile, WgtType );
-	}
-	if ( result && ProbInFile != "" ){
-	  result = run->GetArrays( ProbInFile );
-	}
-	if ( result && MatrixInFile != "" ) {
-	  result = run->GetMatrices( MatrixInFile );
-	}
-      }
-      if ( result ){
-	run->initExperiment();
-	TimblExperiment *exp = run->grabAndDisconnectExp();
+      TimblExperiment *exp = create_experiment( exp_name, it.second, s_log,
+						cache_dir );
+      if ( exp ){
 	(*experiments)[exp_name] = exp;
-	delete run;
-	s_log << "started experiment " << exp_name
-	      << " with parameters: " << it.second << endl;
-      }
-      else {
-	s_log << "FAILED to start experiment " << exp_name
-	      << " with parameters: " << it.second << endl;
       }
     }
   }
@@ -211,6 +146,70 @@ void startExperiments( ServerBase *server ){
   }
 }
 
+bool listening( unsigned long port ){
+  // is a TCP socket listening on 'port'? Looked up in the tables of the
+  // kernel: a test connection would be served, and counted, as a session
+  for ( const auto& table : { "/proc/net/tcp", "/proc/net/tcp6" } ){
+    ifstream is( table );
+    string line;
+    getline( is, line ); // the header
+    while ( getline( is, line ) ){
+      // sl local_address rem_address st ... with address:port in hex
+      istringstream ls( line );
+      string sl, local, remote, state;
+      if ( !( ls >> sl >> local >> remote >> state ) || state != "0A" ){
+	continue;
+      }
+      string::size_type pos = local.rfind( ':' );
+      if ( pos != string::npos
+	   && strtoul( local.c_str()+pos+1, 0, 16 ) == port ){
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+void go_live( ServerBase *server,
+	      const TiCC::Configuration *config,
+	      const string& ready_file ){
+  // wait until the server accepts connections, then warm up the caches,
+  // mark the server ready and write the ready file. Until then, health
+  // requests are answered with 'starting'
+  ServerCommon *common = dynamic_cast<ServerCommon*>( server );
+  string port = config->lookUp( "port" );
+  if ( !port.empty() ){
+    unsigned long port_num = 0;
+    if ( !TiCC::stringTo( port, port_num ) ){
+      server->logstream() << "go live: invalid port '" << port << "'"
+			  << endl;
+      exit(EXIT_FAILURE);
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::seconds( 60 );
+    while ( !listening( port_num ) ){
+      if ( chrono::steady_clock::now() > deadline ){
+	server->logstream() << "go live: nothing listens on port " << port
+			    << " after 60 seconds, giving up" << endl;
+	exit(EXIT_FAILURE);
+      }
+      this_thread::sleep_for( chrono::milliseconds( 10 ) );
+    }
+  }
+  try {
+    common->warm_up( config, server->logstream() );
+  }
+  catch ( const exception& e ){
+    server->logstream() << "warm-up failed: " << e.what() << endl;
+    exit(EXIT_FAILURE);
+  }
+  common->set_ready( true );
+  if ( !ready_file.empty() ){
+    ofstream ready_stream( ready_file );
+    ready_stream << common->health_to_json() << endl;
+  }
+  server->logstream() << "server is ready" << endl;
+}
+
 int main(int argc, char *argv[]){
   try {
     // Start.
@@ -233,6 +232,7 @@ int main(int argc, char *argv[]){
     opts.add_short_options( serv_short_opts );
     opts.add_long_options( timbl_long_opts );
     opts.add_long_options( serv_long_opts );
+    opts.add_long_options( "unixsocket:,shmsocket:,cachedir:" );
     opts.init( argc, argv );
     if ( opts.is_present( 'h' )
 	 || opts.is_present( "help" ) ){
@@ -248,10 +248,39 @@ int main(int argc, char *argv[]){
 
     opts.insert( 'v', "F", true );
     opts.insert( 'v', "S", false );
+    string unix_path;
+    opts.extract( "unixsocket", unix_path );
+    string shm_path;
+    opts.extract( "shmsocket", shm_path );
+    string cache_dir;
+    opts.extract( "cachedir", cache_dir );
     TiCC::Configuration *config = initServerConfig( opts );
     if ( !config ){
       exit(EXIT_FAILURE);
     }
+    if ( !unix_path.empty() ){
+      config->setatt( "unixsocket", unix_path );
+    }
+    if ( !shm_path.empty() ){
+      config->setatt( "shmsocket", shm_path );
+    }
+    if ( !cache_dir.empty() ){
+      config->setatt( "cachedir", cache_dir );
+    }
+    unix_path = config->lookUp( "unixsocket" );
+    shm_path = config->lookUp( "shmsocket" );
+    string ready_file = config->lookUp( "readyfile" );
+    // warming up and reporting ready wait until we accept connections
+    bool go_live_later = !ready_file.empty()
+      || config->hasSection( "warmup" );
+    bool self_daemon = false;
+    if ( !unix_path.empty() || !shm_path.empty() || go_live_later ){
+      // the Unix socket listener and the go-live thread would not
+      // survive the fork in ServerBase::Run(). So we daemonize ourselves.
+      string value = config->lookUp( "daemonize" );
+      self_daemon = ( value != "no" && value != "false" );
+      config->setatt( "daemonize", "no" );
+    }
     ServerBase *server = 0;
     string protocol = config->lookUp( "protocol" );
     if ( protocol.empty() ){
@@ -273,7 +302,72 @@ int main(int argc, char *argv[]){
       cerr << "unknown protocol " << protocol << endl;
       exit(EXIT_FAILURE);
     }
+    if ( !ready_file.empty() ){
+      // a left-over from a previous run would lie
+      unlink( ready_file.c_str() );
+    }
     startExperiments( server );
+    ServerCommon *common = dynamic_cast<ServerCommon*>( server );
+    common->learner.setup( common->experiments, config, server->logstream() );
+    common->fallbacks.check( common->experiments, server->logstream() );
+    common->batcher.setup( [common]( const string& base ){
+	return common->find_experiment( base );
+      }, &common->affinity );
+    common->perf.probe( server->logstream() );
+    common->load_vocabularies( config, server->logstream() );
+    if ( !go_live_later ){
+      common->set_ready( true );
+    }
+    common->async_log.start( server->logstream() );
+    vector<UnixListener*> listeners;
+    if ( !unix_path.empty() ){
+      listeners.push_back( new UnixListener( server, unix_path ) );
+    }
+    if ( !shm_path.empty() ){
+      JsonServer *json_server = dynamic_cast<JsonServer*>( server );
+      if ( !json_server ){
+	cerr << "shared memory sessions need protocol=json" << endl;
+	exit(EXIT_FAILURE);
+      }
+      listeners.push_back( new UnixListener( server, shm_path,
+					     [json_server]( childArgs *args ){
+					       json_server->shm_callback( args );
+					     } ) );
+    }
+    for ( const auto& listener : listeners ){
+      if ( !listener->open() ){
+	cerr << "unable to listen on Unix socket: "
+	     << listener->getMessage() << endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+    if ( self_daemon && daemon( 0, 0 ) != 0 ){
+      cerr << "failed to daemonize" << endl;
+      exit(EXIT_FAILURE);
+    }
+    if ( !listeners.empty() && config->lookUp( "port" ).empty() ){
+      // only Unix sockets, no TCP port
+      string pid_file = config->lookUp( "pidfile" );
+      if ( !pid_file.empty() ){
+	ofstream pid_stream( pid_file );
+	pid_stream << getpid() << endl;
+      }
+      for ( size_t i=1; i < listeners.size(); ++i ){
+	listeners[i]->start();
+      }
+      if ( go_live_later ){
+	thread( go_live, server, config, ready_file ).detach();
+      }
+      listeners[0]->run();
+      return EXIT_FAILURE;
+    }
+    for ( const auto& listener : listeners ){
+      listener->start();
+    }
+    if ( go_live_later ){
+      // started after we daemonized; Run() doesn't fork anymore
+      thread( go_live, server, config, ready_file ).detach();
+    }
     return server->Run(); // returns EXIT_SUCCESS or EXIT_FAIL
   }
   catch( const std::bad_alloc& ){
@@ -29,8 +29,10 @@
 #include <exception>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <cstdlib>
 
+#include "ticcutils/StringOps.h"
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/ServerBase.h"
 #include "timbl/TimblAPI.h"
@@ -47,31 +49,104 @@ using TiCC::operator<<;
 #define DBG *TiCC::Dbg(myLog)
 #define LOG *TiCC::Log(myLog)
 
-TimblThread::TimblThread( TimblExperiment *exp,
+TimblThread::TimblThread( const shared_ptr<TimblExperiment>& exp,
 			  childArgs* args,
 			  bool json ):
+  _exp(0),
   myLog(args->logstream()),
   doDebug(args->debug()),
   os(args->os()),
-  is(args->is())
+  is(args->is()),
+  json(json),
+  sock_id(args->id())
 {
   if ( doDebug ){
     myLog.set_level(LogHeavy);
   }
-  _exp = exp->clone();
-  *_exp = *exp;
-  if ( !_exp->connectToSocket( &(args->os() ) , json ) ){
+  attach( exp );
+}
+
+void TimblThread::attach( const shared_ptr<TimblExperiment>& exp ){
+  // make our working clone of exp. The clone shares the instance base
+  // of exp, so we keep exp alive as long as we use it
+  AllocScope setup( exp->ExpName() );
+  TimblExperiment *clone = exp->clone();
+  *clone = *exp;
+  if ( !clone->connectToSocket( &os, json ) ){
+    delete clone;
     throw logic_error( "unable to create working client" );
   }
   if ( exp->getOptParams() ){
-    _exp->setOptParams( exp->getOptParams()->Clone( &(args->os() ) ) );
+    clone->setOptParams( exp->getOptParams()->Clone( &os ) );
+  }
+  clone->setExpName(string("exp-")+TiCC::toString( sock_id ) );
+  if ( !options.empty()
+       && !( clone->SetOptions( options ) && clone->ConfirmOptions() ) ){
+    LOG << "unable to set options '" << options << "' on a new version of "
+	<< "the base" << endl;
+  }
+  delete _exp;
+  _exp = clone;
+  source = exp;
+}
+
+void TimblThread::refresh( const shared_ptr<TimblExperiment>& exp ){
+  // switch to another version of our base, if there is one
+  if ( exp && exp != source ){
+    attach( exp );
+  }
+}
+
+static string option_key( const string& option ){
+  // which option 'option' sets: -k3 and -k5 both set k. The verbosity
+  // flags are options of their own: +vdi and -vdi set vdi
+  if ( option.compare( 0, 2, "--" ) == 0 ){
+    return option.substr( 0, option.find( '=' ) );
+  }
+  if ( option.size() < 2 || ( option[0] != '-' && option[0] != '+' ) ){
+    return option;
+  }
+  if ( option[1] == 'v' ){
+    return option.substr( 1 );
   }
-  _exp->setExpName(string("exp-")+TiCC::toString( args->id() ) );
+  return option.substr( 1, 1 );
 }
 
 bool TimblThread::setOptions( const string& param ){
   if ( _exp->SetOptions( param )
        && _exp->ConfirmOptions() ){
+    // remember only the last value of every option. A client setting
+    // the same option before every request would otherwise make this
+    // string, and replaying it on a new version of the base, ever longer
+    vector<string> words = TiCC::split( param );
+    for ( size_t i=0; i < words.size(); ++i ){
+      string option = words[i];
+      if ( option.size() == 2
+	   && ( option[0] == '-' || option[0] == '+' )
+	   && i+1 < words.size()
+	   && words[i+1][0] != '-' && words[i+1][0] != '+' ){
+	// '-k 3'
+	option += words[++i];
+      }
+      string key = option_key( option );
+      auto it = find_if( option_set.begin(), option_set.end(),
+			 [&key]( const pair<string,string>& o ){
+			   return o.first == key;
+			 } );
+      if ( it == option_set.end() ){
+	option_set.push_back( make_pair( key, option ) );
+      }
+      else {
+	it->second = option;
+      }
+    }
+    options.clear();
+    for ( const auto& it : option_set ){
+      if ( !options.empty() ){
+	options += " ";
+      }
+      options += it.second;
+    }
     return true;
   }
   return false;
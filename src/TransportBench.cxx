@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+// compares the round trip time of JSON requests to a running timblserver
+// (protocol=json) over TCP, a Unix domain socket and shared memory
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <cstdlib>
+
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/json.hpp"
+#include "timblserver/UnixSocket.h"
+#include "timblserver/ShmTransport.h"
+
+using namespace std;
+using namespace TimblServer;
+using namespace nlohmann;
+
+inline void usage(){
+  cerr << "transportbench -i InstanceFile [-b basename] [-c count]" << endl
+       << "\t[-n NodeName -p PortNumber] [-u SocketPath] [-m ShmSocketPath]"
+       << endl
+       << "sends 'count' classify requests (default 10000) over every"
+       << " transport given," << endl
+       << "cycling through the instances, and reports the latencies."
+       << endl;
+}
+
+typedef function<bool(const string&, string&)> round_trip;
+
+void report( const string& name, vector<double>& lat, double seconds ){
+  if ( lat.empty() ){
+    return;
+  }
+  sort( lat.begin(), lat.end() );
+  double mean = accumulate( lat.begin(), lat.end(), 0.0 ) / lat.size();
+  cout << left << setw(8) << name << right << fixed << setprecision(1)
+       << setw(10) << mean
+       << setw(10) << lat[lat.size()/2]
+       << setw(10) << lat[ min( lat.size()-1, size_t(lat.size()*0.99) ) ]
+       << setw(12) << setprecision(0) << lat.size() / seconds << endl;
+}
+
+bool run( const string& name,
+	  const round_trip& rt,
+	  const vector<string>& requests,
+	  const string& base,
+	  size_t count ){
+  string answer;
+  if ( !base.empty() ){
+    json req = { { "command", "base" }, { "param", base } };
+    if ( !rt( req.dump(), answer ) ){
+      cerr << name << ": selecting base failed" << endl;
+      return false;
+    }
+  }
+  // warm up: the server clones the experiment, caches fill
+  for ( size_t i=0; i < min( count, size_t(100) ); ++i ){
+    if ( !rt( requests[i % requests.size()], answer ) ){
+      cerr << name << ": request failed" << endl;
+      return false;
+    }
+  }
+  vector<double> latencies;
+  latencies.reserve( count );
+  auto start = chrono::steady_clock::now();
+  for ( size_t i=0; i < count; ++i ){
+    auto t0 = chrono::steady_clock::now();
+    if ( !rt( requests[i % requests.size()], answer ) ){
+      cerr << name << ": request failed" << endl;
+      return false;
+    }
+    chrono::duration<double,micro> d = chrono::steady_clock::now() - t0;
+    latencies.push_back( d.count() );
+  }
+  chrono::duration<double> total = chrono::steady_clock::now() - start;
+  report( name, latencies, total.count() );
+  return true;
+}
+
+int main( int argc, char *argv[] ){
+  TiCC::CL_Options opts( "i:b:c:n:p:u:m:h", "" );
+  try {
+    opts.init( argc, argv );
+  }
+  catch( TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  if ( opts.extract( 'h' ) ){
+    usage();
+    exit(EXIT_SUCCESS);
+  }
+  string value;
+  string instance_file;
+  string base;
+  string host;
+  string port;
+  string unix_path;
+  string shm_path;
+  size_t count = 10000;
+  opts.extract( 'i', instance_file );
+  opts.extract( 'b', base );
+  opts.extract( 'n', host );
+  opts.extract( 'p', port );
+  opts.extract( 'u', unix_path );
+  opts.extract( 'm', shm_path );
+  if ( opts.extract( 'c', value )
+       && ( !TiCC::stringTo( value, count ) || count == 0 ) ){
+    cerr << "invalid count: " << value << endl;
+    exit(EXIT_FAILURE);
+  }
+  if ( instance_file.empty() ){
+    usage();
+    exit(EXIT_FAILURE);
+  }
+  vector<string> requests;
+  ifstream is( instance_file );
+  string line;
+  while ( getline( is, line ) ){
+    line = TiCC::trim( line );
+    if ( !line.empty() ){
+      json req = { { "command", "classify" }, { "param", line } };
+      requests.push_back( req.dump() );
+    }
+  }
+  if ( requests.empty() ){
+    cerr << "no instances in " << instance_file << endl;
+    exit(EXIT_FAILURE);
+  }
+  cout << "transport mean(us) p50(us) p99(us)  requests/s" << endl;
+  bool ok = true;
+  if ( !host.empty() && !port.empty() ){
+    UnixClientSocket sock;
+    string greeting;
+    if ( !sock.connect( host, port ) || !sock.read( greeting ) ){
+      cerr << "tcp: " << sock.getMessage() << endl;
+      ok = false;
+    }
+    else {
+      ok = run( "tcp",
+		[&]( const string& req, string& ans ){
+		  return sock.write( req + "\n" ) && sock.read( ans );
+		},
+		requests, base, count ) && ok;
+    }
+  }
+  if ( !unix_path.empty() ){
+    UnixClientSocket sock;
+    string greeting;
+    if ( !sock.connect_path( unix_path ) || !sock.read( greeting ) ){
+      cerr << "unix: " << sock.getMessage() << endl;
+      ok = false;
+    }
+    else {
+      ok = run( "unix",
+		[&]( const string& req, string& ans ){
+		  return sock.write( req + "\n" ) && sock.read( ans );
+		},
+		requests, base, count ) && ok;
+    }
+  }
+  if ( !shm_path.empty() ){
+    ShmClient client;
+    if ( !client.connect( shm_path ) ){
+      cerr << "shm: " << client.getMessage() << endl;
+      ok = false;
+    }
+    else {
+      ok = run( "shm",
+		[&]( const string& req, string& ans ){
+		  return client.request( req, ans );
+		},
+		requests, base, count ) && ok;
+    }
+  }
+  exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
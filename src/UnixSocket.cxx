@@ -0,0 +1,190 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <thread>
+#include <exception>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ticcutils/StringOps.h"
+#include "ticcutils/ServerBase.h"
+#include "timblserver/UnixSocket.h"
+
+using namespace std;
+using namespace TiCCServer;
+
+#define LOG *TiCC::Log(server->logstream())
+
+namespace TimblServer {
+
+  static bool fill_address( const string& path, sockaddr_un& addr ){
+    if ( path.size() >= sizeof(addr.sun_path) ){
+      return false;
+    }
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1 );
+    return true;
+  }
+
+  UnixServerSocket::UnixServerSocket( int fd ){
+    sock = fd;
+    isconnected = true;
+  }
+
+  bool UnixClientSocket::connect_path( const string& path ){
+    sockaddr_un addr;
+    if ( !fill_address( path, addr ) ){
+      mess = "connect: socket path too long: " + path;
+      return false;
+    }
+    sock = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( sock < 0 ){
+      mess = string("socket: ") + strerror(errno);
+      return false;
+    }
+    if ( ::connect( sock, (sockaddr*)&addr, sizeof(addr) ) < 0 ){
+      mess = "connect " + path + ": " + strerror(errno);
+      ::close( sock );
+      sock = -1;
+      return false;
+    }
+    isconnected = true;
+    return true;
+  }
+
+  UnixListener::UnixListener( ServerBase *s,
+			      const string& p,
+			      const function<void(childArgs*)>& h ):
+    server(s),
+    handler(h),
+    path(p),
+    sock(-1),
+    maxconn(0),
+    connections(0)
+  {
+    string value = server->config()->lookUp( "maxconn" );
+    if ( !value.empty() ){
+      TiCC::stringTo( value, maxconn );
+    }
+  }
+
+  UnixListener::~UnixListener(){
+    if ( sock >= 0 ){
+      ::close( sock );
+      ::unlink( path.c_str() );
+    }
+  }
+
+  bool UnixListener::open(){
+    sockaddr_un addr;
+    if ( !fill_address( path, addr ) ){
+      mess = "socket path too long: " + path;
+      return false;
+    }
+    sock = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( sock < 0 ){
+      mess = string("socket: ") + strerror(errno);
+      return false;
+    }
+    // a stale socket file of a previous run would make bind() fail
+    ::unlink( path.c_str() );
+    if ( ::bind( sock, (sockaddr*)&addr, sizeof(addr) ) < 0 ){
+      mess = "bind " + path + ": " + strerror(errno);
+      return false;
+    }
+    if ( ::listen( sock, 64 ) < 0 ){
+      mess = "listen " + path + ": " + strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+  void UnixListener::start(){
+    thread acceptor( &UnixListener::run, this );
+    acceptor.detach();
+  }
+
+  void UnixListener::run(){
+    LOG << "listening on Unix socket " << path << endl;
+    signal( SIGPIPE, SIG_IGN );
+    int failcount = 0;
+    while ( true ){
+      int fd = ::accept( sock, 0, 0 );
+      if ( fd < 0 ){
+	if ( errno == EINTR ){
+	  continue;
+	}
+	LOG << "accept on " << path << " failed: " << strerror(errno) << endl;
+	if ( ++failcount > 20 ){
+	  LOG << "accept failcount >20, Unix socket listener stopped" << endl;
+	  return;
+	}
+	continue;
+      }
+      failcount = 0;
+      if ( maxconn > 0 && connections >= maxconn ){
+	LOG << "Unix socket: maximum number of connections reached ("
+	    << maxconn << ")" << endl;
+	::close( fd );
+	continue;
+      }
+      ++connections;
+      thread child( [this,fd](){
+	  // childArgs takes ownership of the socket
+	  childArgs *args = new childArgs( server, new UnixServerSocket( fd ) );
+	  try {
+	    if ( handler ){
+	      handler( args );
+	    }
+	    else {
+	      server->callback( args );
+	    }
+	  }
+	  catch ( const exception& e ){
+	    LOG << "Unix socket connection " << fd << " failed: "
+		<< e.what() << endl;
+	  }
+	  catch ( ... ){
+	    LOG << "Unix socket connection " << fd << " failed" << endl;
+	  }
+	  // always, or the connection would count forever
+	  delete args;
+	  --connections;
+	} );
+      child.detach();
+    }
+  }
+
+}
@@ -0,0 +1,218 @@
+/*
+  Copyright (c) 1998 - 2026
+  CLST  - Radboud University
+  ILK   - Tilburg University
+  CLiPS - University of Antwerp
+
+  This file is part of timblserver
+
+  timblserver is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  timblserver is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/timblserver/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <unordered_map>
+
+#include "ticcutils/StringOps.h"
+#include "timblserver/Vocabulary.h"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace TimblServer {
+
+  static vector<string> split_instance( const string& line, char sep ){
+    if ( sep == ',' ){
+      return TiCC::split_at( line, "," );
+    }
+    else if ( sep == '\t' ){
+      return TiCC::split_at( line, "\t" );
+    }
+    return TiCC::split( line );
+  }
+
+  bool Vocabulary::fill( const string& file_name, string& error ){
+    ifstream is( file_name );
+    if ( !is ){
+      error = "unable to open " + file_name;
+      return false;
+    }
+    values.clear();
+    vector<unordered_map<string,size_t>> index;
+    string line;
+    bool first = true;
+    while ( getline( is, line ) ){
+      line = TiCC::trim( line );
+      if ( line.empty() ){
+	continue;
+      }
+      if ( first ){
+	// the same guess Timbl makes when no -F is given
+	if ( line[0] == '@' ){
+	  error = file_name + ": ARFF files are not supported";
+	  return false;
+	}
+	if ( line.find( ',' ) != string::npos ){
+	  separator = ',';
+	}
+	else if ( line.find( '\t' ) != string::npos ){
+	  separator = '\t';
+	}
+	else {
+	  separator = ' ';
+	}
+      }
+      vector<string> fields = split_instance( line, separator );
+      if ( fields.size() < 2 ){
+	continue;
+      }
+      // the last field is the class
+      size_t num = fields.size() - 1;
+      if ( first ){
+	values.resize( num );
+	index.resize( num );
+	first = false;
+      }
+      else if ( num != values.size() ){
+	error = file_name + ": inconsistent number of features in line '"
+	  + line + "'";
+	return false;
+      }
+      for ( size_t i = 0; i < num; ++i ){
+	if ( index[i].find( fields[i] ) == index[i].end() ){
+	  index[i][fields[i]] = values[i].size();
+	  values[i].push_back( fields[i] );
+	}
+      }
+    }
+    if ( values.empty() ){
+      error = file_name + ": no instances found";
+      return false;
+    }
+    // 64 bits FNV-1a over all values, so any change gives a new version
+    uint64_t hash = 14695981039346656037ULL;
+    for ( const auto& feature : values ){
+      for ( const auto& value : feature ){
+	for ( const auto c : value ){
+	  hash ^= (unsigned char)c;
+	  hash *= 1099511628211ULL;
+	}
+	hash ^= 0xff;
+	hash *= 1099511628211ULL;
+      }
+      hash ^= 0xfe;
+      hash *= 1099511628211ULL;
+    }
+    ostringstream os;
+    os << hex << setw(16) << setfill('0') << hash;
+    _version = os.str();
+    return true;
+  }
+
+  void Vocabulary::add_value( size_t pos,
+			      const string& value,
+			      string& instance ) const {
+    if ( pos > 0 ){
+      instance += separator;
+    }
+    instance += value;
+  }
+
+  bool Vocabulary::decode( const json& codes,
+			   string& instance,
+			   string& error ) const {
+    // codes is an array with a code per feature. A string instead of
+    // a number is taken literally (e.g. for an unseen value)
+    instance.clear();
+    if ( !codes.is_array() || codes.size() != values.size() ){
+      error = "expected an array of " + to_string( values.size() )
+	+ " codes";
+      return false;
+    }
+    for ( size_t i = 0; i < codes.size(); ++i ){
+      const json& code = codes[i];
+      if ( code.is_string() ){
+	add_value( i, code.get<string>(), instance );
+      }
+      else if ( code.is_number_unsigned()
+		&& code.get<size_t>() < values[i].size() ){
+	add_value( i, values[i][code.get<size_t>()], instance );
+      }
+      else {
+	error = "invalid code for feature " + to_string( i+1 )
+	  + ": " + code.dump();
+	return false;
+      }
+    }
+    // a dummy target value
+    instance += separator;
+    instance += "?";
+    return true;
+  }
+
+  bool Vocabulary::decode( const vector<string>& codes,
+			   string& instance,
+			   string& error ) const {
+    // the tcp variant: numbers, or =value for a literal value
+    instance.clear();
+    if ( codes.size() != values.size() ){
+      error = "expected " + to_string( values.size() ) + " codes";
+      return false;
+    }
+    for ( size_t i = 0; i < codes.size(); ++i ){
+      const string& code = codes[i];
+      size_t num = 0;
+      if ( !code.empty() && code[0] == '=' ){
+	add_value( i, code.substr( 1 ), instance );
+      }
+      else if ( code.find_first_not_of( "0123456789" ) == string::npos
+		&& TiCC::stringTo( code, num )
+		&& num < values[i].size() ){
+	add_value( i, values[i][num], instance );
+      }
+      else {
+	error = "invalid code for feature " + to_string( i+1 )
+	  + ": " + code;
+	return false;
+      }
+    }
+    instance += separator;
+    instance += "?";
+    return true;
+  }
+
+  json Vocabulary::to_json() const {
+    json result;
+    result["version"] = _version;
+    result["separator"] = string( 1, separator );
+    json features = json::array();
+    for ( const auto& feature : values ){
+      features.push_back( feature );
+    }
+    result["features"] = features;
+    return result;
+  }
+
+}